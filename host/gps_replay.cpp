@@ -0,0 +1,706 @@
+/*
+ * GPS/PPS trace replay for the host build.
+ *
+ * Feeds a recorded trace (binary file or a console capture of GPSTRACE
+ * lines, see src/gps_trace.h) or a synthetic one into GPS::pps() and
+ * GPS::process() on the simulated clock, optionally with PPS jitter, missing
+ * pulses and late RMC sentences injected, and samples GPS::getNTPTime() at a
+ * fixed interval to report the error of the time that would be served.
+ * PPS edges reach GPS::pps() either as the GPIO interrupt would deliver
+ * them (late by the interrupt latency) or, with -P, through the PIO capture
+ * path: the counter value the state machine would latch is synthesized and
+ * converted back by PpsCapture, as the firmware does.  Synthetic traces can
+ * put the receiver's pulse quantization error on the edges (-q) and announce
+ * each edge with UBX TIM-TP and NAV-TIMEUTC frames (-U), and lose the fix
+ * for a while (-F) with the pulses and TIM-TP still coming.
+ *
+ * The reference ("true") time is a straight line through the unperturbed PPS
+ * edges, each labelled with the UTC second of the RMC that followed it.  For
+ * a synthetic trace that is exact; for a recording it assumes the oscillator
+ * is steady within each second, which is the best a trace can tell us.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hal_host.h"
+#include "gps.h"
+#include "gps_trace.h"
+#include "pps_capture.h"
+#include "ubx.h"
+
+#define US_PER_S            1000000ULL
+#define CAPTURE_HZ          125000000  // PIO counter, sys_clk / 2
+
+// UTC second of the first synthetic PPS edge
+#define REPLAY_EPOCH        1704067200 // 2024-01-01 00:00:00
+#define REPLAY_LEAP_SECONDS 18         // GPS - UTC at REPLAY_EPOCH
+// Synthetic receiver clock: the pulse quantization error steps by this
+// fraction of a clock period each second, a slow sawtooth
+#define QERR_STEP           0.0731
+
+typedef struct trace_event
+{
+    uint64_t    timestamp_us; // local clock
+    uint8_t     type;
+    std::string line;         // GPS_TRACE_NMEA without CR/LF, GPS_TRACE_UBX the whole frame
+    int32_t     qerr_ps;      // GPS_TRACE_PPS: the pulse came out this late (synthetic only)
+} TraceEvent;
+
+typedef struct anchor
+{
+    uint64_t timestamp_us;    // local clock of an unperturbed PPS edge
+    int64_t  utc_seconds;     // the second it started
+} Anchor;
+
+typedef struct replay_config
+{
+    uint32_t    jitter_us;      // PPS edges moved by up to +/- this
+    double      missing_pct;    // PPS edges dropped
+    double      late_pct;       // RMC sentences delayed
+    uint32_t    late_ms;        // by this much
+    uint32_t    interval_ms;    // sampling interval
+    uint32_t    seed;
+    uint32_t    outage_start_s; // everything dropped for outage_s seconds from here
+    uint32_t    outage_s;
+    double      glitch_pct;     // seconds with a spurious extra PPS edge
+    double      corrupt_pct;    // NMEA sentences with one byte damaged on the wire
+    uint32_t    latency_us;     // PPS interrupt latency, up to this
+    bool        capture;        // PPS through PpsCapture instead of the interrupt time
+    // synthetic traces
+    uint32_t    seconds;
+    double      ppm;            // local oscillator frequency error
+    uint32_t    nmea_delay_ms;  // PPS edge to RMC
+    uint32_t    qerr_period_ps; // receiver clock period, 0 for no quantization error
+    bool        ubx;            // announce edges with TIM-TP
+    uint32_t    nofix_start_s;  // no fix for nofix_s seconds from here, PPS and TIM-TP go on
+    uint32_t    nofix_s;
+} ReplayConfig;
+
+static GPS*     gps;
+static uint64_t rng_state;
+
+static uint64_t rng_next()
+{
+    // xorshift64*, seeded from the command line so runs are repeatable
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double rng_uniform()
+{
+    return (double)(rng_next() >> 11) / (double)(1ULL << 53);
+}
+
+static std::string nmea_sentence(const char* body)
+{
+    uint8_t checksum = 0;
+    for (const char* p = body; *p; ++p)
+        checksum ^= (uint8_t)*p;
+
+    char sentence[128];
+    snprintf(sentence, sizeof(sentence), "$%s*%02X", body, checksum);
+    return sentence;
+}
+
+// UTC second an RMC sentence labels, -1 if it is not a valid RMC
+static int64_t rmc_seconds(const std::string& line)
+{
+    if (line.size() < 7 || line.compare(3, 3, "RMC") != 0)
+        return -1;
+
+    int         field = 0;
+    const char* time_field = NULL;
+    const char* status = NULL;
+    const char* date_field = NULL;
+    for (const char* p = line.c_str(); *p; ++p)
+    {
+        if (*p != ',')
+            continue;
+        ++field;
+        if (field == 1) time_field = p + 1;
+        if (field == 2) status = p + 1;
+        if (field == 9) date_field = p + 1;
+    }
+    if (!time_field || !status || !date_field || *status != 'A')
+        return -1;
+
+    struct tm tm = {};
+    if (sscanf(time_field, "%2d%2d%2d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 3 ||
+        sscanf(date_field, "%2d%2d%2d", &tm.tm_mday, &tm.tm_mon, &tm.tm_year) != 3)
+        return -1;
+    tm.tm_mon  -= 1;
+    tm.tm_year += 100;
+    return (int64_t)timegm(&tm);
+}
+
+static std::string ubx_wire_frame(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len)
+{
+    uint8_t frame[256 + UBX_FRAME_OVERHEAD];
+    size_t  size = ubx_frame(frame, sizeof(frame), msg_class, msg_id, payload, len);
+    return std::string((const char*)frame, size);
+}
+
+// Decodes one record, returns its size or 0 if buf doesn't hold a whole one
+static size_t decode_record(const uint8_t* buf, size_t len, uint64_t* last_us, TraceEvent* event)
+{
+    if (len < GPS_TRACE_HEADER_SIZE)
+        return 0;
+
+    size_t size = GPS_TRACE_HEADER_SIZE;
+    if (buf[0] == GPS_TRACE_NMEA || buf[0] == GPS_TRACE_UBX)
+    {
+        if (len < size + 1 || len < size + 1 + buf[size])
+            return 0;
+        size += 1 + buf[size];
+    }
+    else if (buf[0] != GPS_TRACE_PPS)
+        return 0;
+
+    // timestamps are the low 32 bits of the local clock, unwrap against the previous record
+    uint32_t low = buf[1] | (buf[2] << 8) | (buf[3] << 16) | ((uint32_t)buf[4] << 24);
+    uint64_t timestamp_us = (*last_us & ~0xffffffffULL) | low;
+    if (timestamp_us < *last_us)
+        timestamp_us += 0x100000000ULL;
+    *last_us = timestamp_us;
+
+    event->timestamp_us = timestamp_us;
+    event->type         = buf[0];
+    event->line.assign((const char*)buf + GPS_TRACE_HEADER_SIZE + 1,
+                       buf[0] != GPS_TRACE_PPS ? buf[GPS_TRACE_HEADER_SIZE] : 0);
+    event->qerr_ps      = 0;
+    if (buf[0] == GPS_TRACE_UBX)
+    {
+        // recorded as class, id and payload, replayed as it was on the wire
+        if (size < GPS_TRACE_HEADER_SIZE + 3)
+            return 0;
+        event->line = ubx_wire_frame((uint8_t)event->line[0], (uint8_t)event->line[1],
+                                     (const uint8_t*)event->line.data() + 2, (uint16_t)(event->line.size() - 2));
+    }
+    return size;
+}
+
+static bool load_binary(const char* path, std::vector<TraceEvent>* events)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+    std::vector<uint8_t> buf;
+    uint8_t chunk[4096];
+    size_t  n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        buf.insert(buf.end(), chunk, chunk + n);
+    fclose(f);
+
+    if (buf.size() < GPS_TRACE_MAGIC_SIZE || memcmp(buf.data(), GPS_TRACE_MAGIC, GPS_TRACE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "%s: not a GPS trace\n", path);
+        return false;
+    }
+
+    uint64_t last_us = 0;
+    size_t   pos = GPS_TRACE_MAGIC_SIZE;
+    while (pos < buf.size())
+    {
+        TraceEvent event;
+        size_t size = decode_record(buf.data() + pos, buf.size() - pos, &last_us, &event);
+        if (!size)
+        {
+            fprintf(stderr, "%s: bad record at offset %zu\n", path, pos);
+            return false;
+        }
+        events->push_back(event);
+        pos += size;
+    }
+    return true;
+}
+
+// A console capture from a GPS_TRACE firmware: everything but "GPSTRACE <hex>" lines is ignored
+static bool load_console(const char* path, std::vector<TraceEvent>* events)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+
+    char     text[1024];
+    uint64_t last_us = 0;
+    while (fgets(text, sizeof(text), f))
+    {
+        const char* hex = strstr(text, "GPSTRACE ");
+        if (!hex)
+            continue;
+        hex += strlen("GPSTRACE ");
+
+        uint8_t record[GPS_TRACE_RECORD_MAX];
+        size_t  len = 0;
+        unsigned value;
+        while (len < sizeof(record) && sscanf(hex, "%2x", &value) == 1)
+        {
+            record[len++] = (uint8_t)value;
+            hex += 2;
+        }
+
+        TraceEvent event;
+        if (decode_record(record, len, &last_us, &event))
+            events->push_back(event);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool save_binary(const char* path, const std::vector<TraceEvent>& events)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+    fwrite(GPS_TRACE_MAGIC, 1, GPS_TRACE_MAGIC_SIZE, f);
+    for (const TraceEvent& event : events)
+    {
+        // UBX without its sync, length and checksum, as the firmware records it
+        std::string body = event.type == GPS_TRACE_UBX && event.line.size() >= UBX_FRAME_OVERHEAD
+                         ? event.line.substr(2, 2) + event.line.substr(6, event.line.size() - UBX_FRAME_OVERHEAD)
+                         : event.line;
+        uint32_t low = (uint32_t)event.timestamp_us;
+        uint8_t  header[GPS_TRACE_HEADER_SIZE + 1] = {
+            event.type, (uint8_t)low, (uint8_t)(low >> 8), (uint8_t)(low >> 16), (uint8_t)(low >> 24),
+            (uint8_t)body.size()
+        };
+        fwrite(header, 1, event.type != GPS_TRACE_PPS ? sizeof(header) : GPS_TRACE_HEADER_SIZE, f);
+        fwrite(body.data(), 1, body.size(), f);
+    }
+    fclose(f);
+    return true;
+}
+
+// Quantization error of synthetic pulse i, a sawtooth over one receiver clock period
+static int32_t qerr_ps(const ReplayConfig* config, uint32_t i)
+{
+    double phase = i * QERR_STEP;
+    return (int32_t)llround((phase - floor(phase) - 0.5) * config->qerr_period_ps);
+}
+
+static std::string ubx_timeutc(int64_t utc_seconds, bool fix)
+{
+    time_t    t = (time_t)utc_seconds;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    uint32_t itow_ms = (uint32_t)((utc_seconds + REPLAY_LEAP_SECONDS - UBX_GPS_EPOCH) % UBX_SECONDS_PER_WEEK) * 1000;
+    uint8_t  payload[UBX_NAV_TIMEUTC_LEN] = {
+        (uint8_t)itow_ms, (uint8_t)(itow_ms >> 8), (uint8_t)(itow_ms >> 16), (uint8_t)(itow_ms >> 24),
+        20, 0, 0, 0,                                        // tAcc
+        0, 0, 0, 0,                                         // nano
+        (uint8_t)(tm.tm_year + 1900), (uint8_t)((tm.tm_year + 1900) >> 8),
+        (uint8_t)(tm.tm_mon + 1), (uint8_t)tm.tm_mday, (uint8_t)tm.tm_hour, (uint8_t)tm.tm_min, (uint8_t)tm.tm_sec,
+        // free running, the receiver still knows the week and time of week
+        (uint8_t)(fix ? UBX_TIMEUTC_VALID_ALL : UBX_TIMEUTC_VALID_TOW | UBX_TIMEUTC_VALID_WKN)
+    };
+    return ubx_wire_frame(UBX_CLASS_NAV, UBX_NAV_TIMEUTC, payload, sizeof(payload));
+}
+
+static std::string ubx_tim_tp(int64_t utc_seconds, int32_t qerr, bool fix)
+{
+    int64_t  gps_seconds = utc_seconds + REPLAY_LEAP_SECONDS - UBX_GPS_EPOCH;
+    uint32_t tow_ms = (uint32_t)(gps_seconds % UBX_SECONDS_PER_WEEK) * 1000;
+    uint16_t week   = (uint16_t)(gps_seconds / UBX_SECONDS_PER_WEEK);
+    uint32_t q      = (uint32_t)qerr;
+    uint8_t  payload[UBX_TIM_TP_LEN] = {
+        (uint8_t)tow_ms, (uint8_t)(tow_ms >> 8), (uint8_t)(tow_ms >> 16), (uint8_t)(tow_ms >> 24),
+        0, 0, 0, 0,                                         // towSubMS
+        (uint8_t)q, (uint8_t)(q >> 8), (uint8_t)(q >> 16), (uint8_t)(q >> 24),
+        (uint8_t)week, (uint8_t)(week >> 8),
+        (uint8_t)(UBX_TP_UTC_AVAILABLE | (fix ? 0 : UBX_TP_QERR_INVALID)), // pulse on GPS time
+        0
+    };
+    return ubx_wire_frame(UBX_CLASS_TIM, UBX_TIM_TP, payload, sizeof(payload));
+}
+
+// A receiver that locks at the first edge, with a local oscillator off by config->ppm
+static void synthesize(const ReplayConfig* config, std::vector<TraceEvent>* events)
+{
+    const uint64_t start_us = US_PER_S;
+    const double   rate     = 1.0 + config->ppm * 1e-6; // local us per true us
+
+    for (uint32_t i = 0; i < config->seconds; ++i)
+    {
+        uint64_t edge_us = start_us + (uint64_t)llround(i * (double)US_PER_S * rate);
+        TraceEvent pps = { edge_us, GPS_TRACE_PPS, "", qerr_ps(config, i) };
+        events->push_back(pps);
+
+        time_t    seconds = REPLAY_EPOCH + i;
+        bool      fix = i < config->nofix_start_s || i >= config->nofix_start_s + config->nofix_s;
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        char body[96];
+        snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.00,%c,4807.038,N,01131.000,E,0.0,0.0,%02d%02d%02d,,,%c",
+            tm.tm_hour, tm.tm_min, tm.tm_sec, fix ? 'A' : 'V', tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100,
+            fix ? 'A' : 'N');
+        uint64_t   nmea_us = edge_us + (uint64_t)llround(config->nmea_delay_ms * 1000.0 * rate);
+        TraceEvent rmc = { nmea_us, GPS_TRACE_NMEA, nmea_sentence(body), 0 };
+        events->push_back(rmc);
+
+        if (config->ubx && i == 0)
+        {
+            // the receiver was already announcing pulses before the trace starts
+            uint64_t ahead_us = edge_us - (uint64_t)llround((1000 - config->nmea_delay_ms) * 1000.0 * rate);
+            TraceEvent timeutc = { ahead_us, GPS_TRACE_UBX, ubx_timeutc(seconds - 1, fix), 0 };
+            TraceEvent tp      = { ahead_us + 1, GPS_TRACE_UBX, ubx_tim_tp(seconds, qerr_ps(config, 0), fix), 0 };
+            events->insert(events->end() - 2, timeutc);
+            events->insert(events->end() - 2, tp);
+        }
+        if (config->ubx)
+        {
+            // this second's solution, then the next pulse announced on GPS time
+            TraceEvent timeutc = { nmea_us + 1, GPS_TRACE_UBX, ubx_timeutc(seconds, fix), 0 };
+            TraceEvent tp      = { nmea_us + 2, GPS_TRACE_UBX, ubx_tim_tp(seconds + 1, qerr_ps(config, i + 1), fix), 0 };
+            events->push_back(timeutc);
+            events->push_back(tp);
+        }
+    }
+}
+
+// Reference timeline: every PPS edge labelled by the next RMC before the
+// following edge, unlabelled edges in between filled in by counting.
+static void build_anchors(const std::vector<TraceEvent>& events, std::vector<Anchor>* anchors)
+{
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        if (events[i].type != GPS_TRACE_PPS)
+            continue;
+        Anchor anchor = { events[i].timestamp_us, -1 };
+        for (size_t j = i + 1; j < events.size() && events[j].type != GPS_TRACE_PPS; ++j)
+        {
+            int64_t seconds = rmc_seconds(events[j].line);
+            if (seconds >= 0)
+            {
+                anchor.utc_seconds = seconds;
+                break;
+            }
+        }
+        anchors->push_back(anchor);
+    }
+
+    for (size_t i = 1; i < anchors->size(); ++i)
+    {
+        if ((*anchors)[i].utc_seconds < 0 && (*anchors)[i - 1].utc_seconds >= 0)
+            (*anchors)[i].utc_seconds = (*anchors)[i - 1].utc_seconds + 1;
+    }
+}
+
+static void perturb(const ReplayConfig* config, std::vector<TraceEvent>* events)
+{
+    std::vector<TraceEvent> out;
+    uint64_t outage_start_us = events->empty() ? 0 : events->front().timestamp_us + config->outage_start_s * US_PER_S;
+    uint64_t outage_end_us   = outage_start_us + config->outage_s * US_PER_S;
+    for (TraceEvent event : *events)
+    {
+        if (event.timestamp_us >= outage_start_us && event.timestamp_us < outage_end_us)
+            continue;
+        if (event.type == GPS_TRACE_PPS)
+        {
+            if (rng_uniform() * 100.0 < config->missing_pct)
+                continue;
+            if (config->jitter_us)
+                event.timestamp_us += (int64_t)(rng_next() % (2 * config->jitter_us + 1)) - config->jitter_us;
+        }
+        else
+        {
+            if (rmc_seconds(event.line) >= 0 && rng_uniform() * 100.0 < config->late_pct)
+                event.timestamp_us += (uint64_t)config->late_ms * 1000;
+            if (!event.line.empty() && rng_uniform() * 100.0 < config->corrupt_pct)
+                event.line[rng_next() % event.line.size()] ^= 1 << (rng_next() % 8);
+        }
+        out.push_back(event);
+        if (event.type == GPS_TRACE_PPS && rng_uniform() * 100.0 < config->glitch_pct)
+        {
+            // noise on the PPS line somewhere in the following second
+            TraceEvent glitch = event;
+            glitch.timestamp_us += 1 + rng_next() % (US_PER_S - 1);
+            out.push_back(glitch);
+        }
+    }
+    std::stable_sort(out.begin(), out.end(),
+        [](const TraceEvent& a, const TraceEvent& b) { return a.timestamp_us < b.timestamp_us; });
+    events->swap(out);
+}
+
+// Reference time at a local timestamp as NTP 32.32, false outside the labelled span
+static bool reference_time(const std::vector<Anchor>& anchors, uint64_t timestamp_us, int64_t* ntp)
+{
+    auto next = std::upper_bound(anchors.begin(), anchors.end(), timestamp_us,
+        [](uint64_t ts, const Anchor& a) { return ts < a.timestamp_us; });
+    if (next == anchors.begin() || next == anchors.end())
+        return false;
+    const Anchor& a = *(next - 1);
+    const Anchor& b = *next;
+    if (a.utc_seconds < 0 || b.utc_seconds != a.utc_seconds + 1)
+        return false;
+
+    double fraction = (double)(timestamp_us - a.timestamp_us) / (double)(b.timestamp_us - a.timestamp_us);
+    *ntp = ((int64_t)toNTP(a.utc_seconds) << 32) + (int64_t)llround(fraction * 4294967296.0);
+    return true;
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [-f trace.bin | -c console.log | -s seconds] [options]\n"
+           "  -f  binary trace file\n"
+           "  -c  console capture containing GPSTRACE lines\n"
+           "  -s  synthetic trace of this many seconds\n"
+           "  -o  synthetic oscillator error in ppm (default 0)\n"
+           "  -N  synthetic PPS to RMC delay in ms (default 150)\n"
+           "  -j  PPS jitter, +/- us\n"
+           "  -m  percentage of PPS edges to drop\n"
+           "  -L  percentage of RMC sentences to delay\n"
+           "  -l  RMC delay in ms (default 1100)\n"
+           "  -O  outage: drop everything for len seconds from start, as start,len\n"
+           "  -g  percentage of seconds with a spurious PPS edge\n"
+           "  -B  percentage of NMEA sentences with a damaged byte\n"
+           "  -I  PPS interrupt latency, up to this many us\n"
+           "  -P  timestamp PPS with the PIO capture path instead of the interrupt\n"
+           "  -q  synthetic receiver clock period in ps: PPS quantization error\n"
+           "  -U  synthetic UBX TIM-TP and NAV-TIMEUTC ahead of each edge\n"
+           "  -F  fix lost: no fix for len seconds from start, as start,len; PPS and TIM-TP go on\n"
+           "  -i  sampling interval in ms (default 10)\n"
+           "  -S  random seed (default 1)\n"
+           "  -w  write the (perturbed) trace to a binary file\n"
+           "  -C  write per-sample local_us,error_ns,valid to a CSV file\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    ReplayConfig config = { 0, 0.0, 0.0, 1100, 10, 1, 0, 0, 0.0, 0.0, 0, false, 0, 0.0, 150, 0, false, 0, 0 };
+    const char*  binary_path = NULL;
+    const char*  console_path = NULL;
+    const char*  write_path = NULL;
+    const char*  csv_path = NULL;
+    int          opt;
+
+    while ((opt = getopt(argc, argv, "f:c:s:o:N:j:m:L:l:O:g:B:I:Pq:UF:i:S:w:C:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': binary_path          = optarg; break;
+            case 'c': console_path         = optarg; break;
+            case 's': config.seconds       = strtoul(optarg, NULL, 0); break;
+            case 'o': config.ppm           = atof(optarg); break;
+            case 'N': config.nmea_delay_ms = strtoul(optarg, NULL, 0); break;
+            case 'j': config.jitter_us     = strtoul(optarg, NULL, 0); break;
+            case 'm': config.missing_pct   = atof(optarg); break;
+            case 'L': config.late_pct      = atof(optarg); break;
+            case 'l': config.late_ms       = strtoul(optarg, NULL, 0); break;
+            case 'O':
+                if (sscanf(optarg, "%u,%u", &config.outage_start_s, &config.outage_s) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'g': config.glitch_pct    = atof(optarg); break;
+            case 'B': config.corrupt_pct   = atof(optarg); break;
+            case 'I': config.latency_us    = strtoul(optarg, NULL, 0); break;
+            case 'P': config.capture       = true; break;
+            case 'q': config.qerr_period_ps = strtoul(optarg, NULL, 0); break;
+            case 'U': config.ubx           = true; break;
+            case 'F':
+                if (sscanf(optarg, "%u,%u", &config.nofix_start_s, &config.nofix_s) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'i': config.interval_ms   = strtoul(optarg, NULL, 0); break;
+            case 'S': config.seed          = strtoul(optarg, NULL, 0); break;
+            case 'w': write_path           = optarg; break;
+            case 'C': csv_path             = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if ((!binary_path + !console_path + !config.seconds) != 2 || !config.interval_ms)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    rng_state = 0x9e3779b97f4a7c15ULL ^ config.seed;
+
+    std::vector<TraceEvent> events;
+    if (binary_path && !load_binary(binary_path, &events))
+        return 1;
+    if (console_path && !load_console(console_path, &events))
+        return 1;
+    if (config.seconds)
+        synthesize(&config, &events);
+
+    std::vector<Anchor> anchors;
+    build_anchors(events, &anchors);
+    perturb(&config, &events);
+    if (write_path && !save_binary(write_path, events))
+        return 1;
+    if (events.empty())
+    {
+        fprintf(stderr, "empty trace\n");
+        return 1;
+    }
+
+    FILE* csv = NULL;
+    if (csv_path && !(csv = fopen(csv_path, "w")))
+    {
+        perror(csv_path);
+        return 1;
+    }
+
+    // GPS::process() labels seconds with mktime()
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    // created here and left for process exit: GPS::~GPS() would detach PPS
+    // through gps.cpp statics that may already be gone
+    gps = new GPS();
+    gps->begin();
+
+    // the state machine is started when PPS is attached, well before the first edge
+    PpsCapture capture;
+    capture.start(events.front().timestamp_us * 1000 - 1000000000ULL, CAPTURE_HZ);
+
+    std::vector<int64_t> errors_ns;
+    uint64_t samples = 0;
+    uint64_t unserved = 0;
+    uint64_t holdover = 0;
+    uint64_t nosync = 0;
+    uint64_t holdover_max_ns = 0;
+    uint64_t over_dispersion = 0;
+    size_t   next_event = 0;
+    uint64_t interval_us = (uint64_t)config.interval_ms * 1000;
+    uint64_t end_us = events.back().timestamp_us;
+
+    for (uint64_t now_us = events.front().timestamp_us; now_us <= end_us; now_us += interval_us)
+    {
+        for (; next_event < events.size() && events[next_event].timestamp_us <= now_us; ++next_event)
+        {
+            const TraceEvent& event = events[next_event];
+            hal_host_set_time_us(event.timestamp_us);
+            if (event.type == GPS_TRACE_PPS)
+            {
+                uint64_t latency_us = config.latency_us ? rng_next() % (config.latency_us + 1) : 0;
+                uint64_t edge_ns    = event.timestamp_us * 1000 + llround(event.qerr_ps / 1000.0);
+                hal_host_set_time_ns(edge_ns + latency_us * 1000);
+                if (config.capture)
+                {
+                    uint32_t value   = capture.simulate(edge_ns, capture.captures());
+                    if (capture.convert(value, hal_time_us_64() * 1000, &edge_ns) != PPS_CAPTURE_GLITCH)
+                        hal_host_pps_at(edge_ns);
+                }
+                else
+                {
+                    hal_host_pps();
+                }
+            }
+            else
+            {
+                std::string line = event.type == GPS_TRACE_NMEA ? event.line + "\r\n" : event.line;
+                hal_host_uart_feed((const uint8_t*)line.data(), line.size());
+                gps->process();
+            }
+        }
+
+        hal_host_set_time_us(now_us);
+        gps->process();
+
+        int64_t reference;
+        if (!reference_time(anchors, now_us, &reference))
+            continue;
+
+        ++samples;
+        NTPTime   served;
+        TimeState state;
+        bool      valid = gps->getNTPTime(&served);
+        int64_t   error_ns = 0;
+        gps->getState(&state);
+        if (valid && state.leap == LI_NOSYNC)
+        {
+            // answered, but clients are told not to use it
+            ++nosync;
+            valid = false;
+        }
+        else if (valid)
+        {
+            int64_t served_ntp = ((int64_t)served.seconds << 32) | served.fraction;
+            error_ns = (int64_t)llround((double)(served_ntp - reference) * 1e9 / 4294967296.0);
+            errors_ns.push_back(error_ns);
+            // root dispersion is the error bound clients are promised
+            uint64_t dispersion_ns = (uint64_t)state.root_dispersion * 1000000000ULL / 65536;
+            if ((uint64_t)(error_ns < 0 ? -error_ns : error_ns) > dispersion_ns)
+                ++over_dispersion;
+            if (state.sync_state == GPS_SYNC_HOLDOVER)
+            {
+                ++holdover;
+                holdover_max_ns = std::max(holdover_max_ns, (uint64_t)(error_ns < 0 ? -error_ns : error_ns));
+            }
+        }
+        else
+        {
+            ++unserved;
+        }
+        if (csv)
+            fprintf(csv, "%" PRIu64 ",%" PRId64 ",%d\n", now_us, error_ns, valid);
+    }
+    if (csv)
+        fclose(csv);
+
+    double   sum = 0.0, sum_sq = 0.0;
+    uint64_t max_abs = 0;
+    std::vector<uint64_t> abs_ns;
+    for (int64_t e : errors_ns)
+    {
+        sum    += e;
+        sum_sq += (double)e * e;
+        abs_ns.push_back(e < 0 ? -e : e);
+        max_abs = std::max(max_abs, abs_ns.back());
+    }
+    std::sort(abs_ns.begin(), abs_ns.end());
+    size_t served_count = errors_ns.size();
+    double mean = served_count ? sum / served_count : 0.0;
+    double rms  = served_count ? sqrt(sum_sq / served_count) : 0.0;
+    uint64_t p50 = served_count ? abs_ns[(size_t)(0.50 * (served_count - 1))] : 0;
+    uint64_t p99 = served_count ? abs_ns[(size_t)(0.99 * (served_count - 1))] : 0;
+
+    printf("replay: events=%zu samples=%" PRIu64 " served=%zu unserved=%" PRIu64
+           " mean=%.0fns rms=%.0fns |err| p50=%" PRIu64 "ns p99=%" PRIu64 "ns max=%" PRIu64 "ns\n",
+        events.size(), samples, served_count, unserved, mean, rms, p50, p99, max_abs);
+    printf("replay: holdover=%" PRIu64 " (max |err| %" PRIu64 "ns, bound %luus) nosync=%" PRIu64 " over_dispersion=%" PRIu64 "\n",
+        holdover, holdover_max_ns, (unsigned long)gps->getHoldoverErrorUs(), nosync, over_dispersion);
+    printf("replay: servo %s freq=%ldppb phase=%ldns jitter=%luns\n", gps->isServoLocked() ? "locked" : "unlocked",
+        (long)gps->getFrequencyPPB(), (long)gps->getPhaseErrorNs(), (unsigned long)gps->getJitter());
+    const NmeaFramer& framer = gps->getFramer();
+    printf("replay: nmea sentences=%lu checksum_errors=%lu framing_errors=%lu\n", (unsigned long)framer.sentences(),
+        (unsigned long)framer.checksumErrors(), (unsigned long)framer.framingErrors());
+    const UbxParser& ubx = gps->getUbx();
+    if (ubx.frames() || ubx.checksumErrors())
+        printf("replay: ubx frames=%lu checksum_errors=%lu labels=%lu\n", (unsigned long)ubx.frames(),
+            (unsigned long)ubx.checksumErrors(), (unsigned long)gps->getUbxLabels());
+    if (config.capture)
+        printf("replay: capture captures=%lu glitches=%lu\n", (unsigned long)capture.captures(), (unsigned long)capture.glitches());
+
+    return 0;
+}
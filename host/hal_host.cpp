@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <deque>
+#include "hal_host.h"
+
+// Host implementation of hal.h, see hal_host.h.  Single-threaded.
+
+#define HOST_SYS_CLOCK_HZ   250000000   // what the firmware runs the core at
+
+typedef struct host_udp_service
+{
+    uint16_t          port;
+    hal_udp_handler   handler;
+    void*             arg;
+    hal_late_stamp_fn late_stamp;
+    uint16_t          stamp_offset;
+} HostUdpService;
+
+static uint64_t            _time_ns = 0;
+static std::deque<uint8_t> _uart_rx;
+static void              (*_pps_handler)(uint64_t edge_ns) = NULL;
+static HostUdpService      _udp_service = {};
+
+uint64_t hal_time_us_64(void)
+{
+    return _time_ns / 1000;
+}
+
+uint64_t hal_time_ns_64(void)
+{
+    return _time_ns;
+}
+
+uint32_t hal_time_resolution_ns(void)
+{
+    return 1;
+}
+
+int32_t hal_timebase_calibrate(void)
+{
+    return 0;
+}
+
+uint32_t hal_sys_clock_hz(void)
+{
+    return HOST_SYS_CLOCK_HZ;
+}
+
+// Repeatable rather than random, so bench runs can be compared
+void hal_random(uint8_t* dst, size_t len)
+{
+    static uint64_t state = 0x2545f4914f6cdd1dULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        dst[i] = (uint8_t)((state * 2685821657736338717ULL) >> 56);
+    }
+}
+
+void hal_sleep_ms(uint32_t ms)
+{
+    _time_ns += (uint64_t)ms * 1000000;
+}
+
+uint32_t hal_irq_save(void)
+{
+    // the PPS handler only runs from hal_host_pps(), never preemptively
+    return 0;
+}
+
+void hal_irq_restore(uint32_t state)
+{
+    (void)state;
+}
+
+void hal_uart_init(uint32_t baud)
+{
+    (void)baud;
+}
+
+void hal_uart_set_baud(uint32_t baud)
+{
+    (void)baud;
+}
+
+void hal_uart_write(const uint8_t* src, size_t len)
+{
+    // configuration commands to the receiver go nowhere
+    (void)src;
+    (void)len;
+}
+
+size_t hal_uart_read(uint8_t* dst, size_t max)
+{
+    size_t n = std::min(max, _uart_rx.size());
+    std::copy(_uart_rx.begin(), _uart_rx.begin() + n, dst);
+    _uart_rx.erase(_uart_rx.begin(), _uart_rx.begin() + n);
+    return n;
+}
+
+uint32_t hal_uart_overruns(void)
+{
+    return 0;
+}
+
+void hal_pps_attach(void (*handler)(uint64_t edge_ns))
+{
+    _pps_handler = handler;
+}
+
+void hal_pps_detach(void)
+{
+    _pps_handler = NULL;
+}
+
+bool hal_udp_bind(uint16_t port, hal_udp_handler handler, void* arg,
+                  hal_late_stamp_fn late_stamp, uint16_t stamp_offset)
+{
+    if (_udp_service.handler)
+        return false;
+
+    _udp_service.port         = port;
+    _udp_service.handler      = handler;
+    _udp_service.arg          = arg;
+    _udp_service.late_stamp   = late_stamp;
+    _udp_service.stamp_offset = stamp_offset;
+    return true;
+}
+
+void hal_host_set_time_us(uint64_t timestamp_us)
+{
+    _time_ns = timestamp_us * 1000;
+}
+
+void hal_host_set_time_ns(uint64_t timestamp_ns)
+{
+    _time_ns = timestamp_ns;
+}
+
+void hal_host_advance_us(uint64_t us)
+{
+    _time_ns += us * 1000;
+}
+
+void hal_host_uart_feed(const uint8_t* src, size_t len)
+{
+    _uart_rx.insert(_uart_rx.end(), src, src + len);
+}
+
+size_t hal_host_uart_pending(void)
+{
+    return _uart_rx.size();
+}
+
+void hal_host_pps(void)
+{
+    hal_host_pps_at(_time_ns);
+}
+
+void hal_host_pps_at(uint64_t edge_ns)
+{
+    if (_pps_handler)
+        _pps_handler(edge_ns);
+}
+
+uint16_t hal_host_udp_deliver(uint16_t port, uint8_t* payload, uint16_t len, uint16_t max_len,
+                              uint64_t arrival_ns, const HalPeer* peer)
+{
+    if (!_udp_service.handler || _udp_service.port != port)
+        return 0;
+
+    uint16_t rsp_len = _udp_service.handler(_udp_service.arg, payload, len, max_len, arrival_ns, peer);
+    if (rsp_len && _udp_service.late_stamp && rsp_len >= _udp_service.stamp_offset + 8)
+        _udp_service.late_stamp(_udp_service.arg, payload + _udp_service.stamp_offset, rsp_len, peer);
+
+    return rsp_len;
+}
@@ -0,0 +1,33 @@
+#ifndef HAL_HOST_H_
+#define HAL_HOST_H_
+
+#include "hal.h"
+
+/*
+ * Controls for the host implementation of hal.h.
+ *
+ * Time is simulated, in nanoseconds: the hal clocks only move when the
+ * caller sets or advances them, so tests and replays are deterministic.  The PPS "interrupt"
+ * and UART input are driven explicitly from the same thread.
+ */
+
+void     hal_host_set_time_us(uint64_t timestamp_us);
+void     hal_host_set_time_ns(uint64_t timestamp_ns);
+void     hal_host_advance_us(uint64_t us);
+
+// Bytes hal_uart_read() will return, in order
+void     hal_host_uart_feed(const uint8_t* src, size_t len);
+size_t   hal_host_uart_pending(void);
+
+// Run the attached PPS handler now, as if an edge had just arrived
+void     hal_host_pps(void);
+// ... or as if a captured edge at edge_ns had just been read
+void     hal_host_pps_at(uint64_t edge_ns);
+
+// In-process transport: deliver one request to the service bound on port,
+// as the firmware's lwIP glue would, and return the response length (0 for
+// no response).  The late stamp, if any, is applied before returning.
+uint16_t hal_host_udp_deliver(uint16_t port, uint8_t* payload, uint16_t len, uint16_t max_len,
+                              uint64_t arrival_ns, const HalPeer* peer);
+
+#endif /* HAL_HOST_H_ */
@@ -0,0 +1,304 @@
+/*
+ * NMEA time parser benchmark for the host build.
+ *
+ * Runs a corpus of NMEA sentences through the firmware's parser
+ * (nmea_parse_time(), src/nmea_time.h) and through minmea the way
+ * GPS::handleSentence() used it (sentence id, then parse_rmc / parse_gga /
+ * parse_gsv, then minmea_getdatetime() and mktime() for a valid RMC), and
+ * reports the time per sentence of each and whether they agree on every
+ * RMC.  The corpus is a console capture from a GPS_TRACE firmware (-c), a
+ * file of raw NMEA lines (-f), or a synthetic receiver output (-s seconds).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+#include "minmea.h"
+#include "nmea_time.h"
+#include "gps_trace.h"
+
+#define NS_PER_S            1000000000ULL
+
+// UTC second of the first synthetic sentence
+#define BENCH_EPOCH         1704067200 // 2024-01-01 00:00:00
+
+typedef struct result
+{
+    int     type;       // NMEA_TIME_*
+    bool    valid;
+    int64_t seconds;    // RMC / ZDA, -1 if not valid
+} Result;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+// '$', body, '*' and checksum, CR/LF as the framer hands sentences out
+static std::string nmea_sentence(const char* body)
+{
+    uint8_t checksum = 0;
+    for (const char* p = body; *p; ++p)
+        checksum ^= (uint8_t)*p;
+    char tail[8];
+    snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+    return std::string("$") + body + tail;
+}
+
+static void add_line(std::string line, std::vector<std::string>* corpus)
+{
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+        line.pop_back();
+    if (line.empty() || line[0] != '$')
+        return;
+    corpus->push_back(line + "\r\n");
+}
+
+// Raw NMEA, one sentence per line, anything else is skipped
+static bool load_nmea(const char* path, std::vector<std::string>* corpus)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+    char text[1024];
+    while (fgets(text, sizeof(text), f))
+        add_line(text, corpus);
+    fclose(f);
+    return true;
+}
+
+// The NMEA records of "GPSTRACE <hex>" lines, see src/gps_trace.h
+static bool load_console(const char* path, std::vector<std::string>* corpus)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return false;
+    }
+    char text[1024];
+    while (fgets(text, sizeof(text), f))
+    {
+        const char* hex = strstr(text, "GPSTRACE ");
+        if (!hex)
+            continue;
+        hex += strlen("GPSTRACE ");
+
+        uint8_t  record[GPS_TRACE_RECORD_MAX];
+        size_t   len = 0;
+        unsigned value;
+        while (len < sizeof(record) && sscanf(hex, "%2x", &value) == 1)
+        {
+            record[len++] = (uint8_t)value;
+            hex += 2;
+        }
+        if (len > GPS_TRACE_HEADER_SIZE && record[0] == GPS_TRACE_NMEA &&
+            len >= GPS_TRACE_HEADER_SIZE + 1u + record[GPS_TRACE_HEADER_SIZE])
+            add_line(std::string((const char*)record + GPS_TRACE_HEADER_SIZE + 1, record[GPS_TRACE_HEADER_SIZE]), corpus);
+    }
+    fclose(f);
+    return true;
+}
+
+// One second of a typical receiver: RMC, VTG, GGA, GSA, three GSV, GLL and ZDA
+static void synthesize(uint32_t seconds, std::vector<std::string>* corpus)
+{
+    for (uint32_t i = 0; i < seconds; ++i)
+    {
+        time_t    t = BENCH_EPOCH + i;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char hms[16], body[128];
+        snprintf(hms, sizeof(hms), "%02d%02d%02d.00", tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+        snprintf(body, sizeof(body), "GPRMC,%s,A,4807.038,N,01131.000,E,0.0,0.0,%02d%02d%02d,,,A",
+            hms, tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100);
+        corpus->push_back(nmea_sentence(body));
+        corpus->push_back(nmea_sentence("GPVTG,,T,,M,0.004,N,0.008,K,A"));
+        snprintf(body, sizeof(body), "GPGGA,%s,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,", hms);
+        corpus->push_back(nmea_sentence(body));
+        corpus->push_back(nmea_sentence("GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1"));
+        corpus->push_back(nmea_sentence("GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00"));
+        corpus->push_back(nmea_sentence("GPGSV,3,2,11,14,25,170,00,16,57,208,39,18,67,296,40,19,40,246,00"));
+        corpus->push_back(nmea_sentence("GPGSV,3,3,11,22,42,067,42,24,14,311,43,27,05,244,00,,,,"));
+        snprintf(body, sizeof(body), "GPGLL,4807.038,N,01131.000,E,%s,A,A", hms);
+        corpus->push_back(nmea_sentence(body));
+        snprintf(body, sizeof(body), "GPZDA,%s,%02d,%02d,%04d,00,00",
+            hms, tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900);
+        corpus->push_back(nmea_sentence(body));
+    }
+}
+
+// What GPS::handleSentence() did per sentence before nmea_parse_time()
+static Result parse_minmea(const char* sentence)
+{
+    Result result = { NMEA_TIME_NONE, false, -1 };
+    switch (minmea_sentence_id(sentence, false)) {
+        case MINMEA_SENTENCE_RMC: {
+            struct minmea_sentence_rmc frame;
+            if (minmea_parse_rmc(&frame, sentence)) {
+                result.type = NMEA_TIME_RMC;
+                if (frame.valid) {
+                    struct tm tm;
+                    if (minmea_getdatetime(&tm, &frame.date, &frame.time) == 0) {
+                        result.valid   = true;
+                        result.seconds = mktime(&tm);
+                    }
+                }
+            }
+        } break;
+
+        case MINMEA_SENTENCE_GGA: {
+            struct minmea_sentence_gga frame;
+            if (minmea_parse_gga(&frame, sentence)) {
+                result.type  = NMEA_TIME_GGA;
+                result.valid = frame.fix_quality > 0;
+            }
+        } break;
+
+        case MINMEA_SENTENCE_GSV: {
+            struct minmea_sentence_gsv frame;
+            minmea_parse_gsv(&frame, sentence);
+        } break;
+
+        default:
+            break;
+    }
+    return result;
+}
+
+static Result parse_fast(const std::string& sentence)
+{
+    NmeaTime time;
+    Result   result = { nmea_parse_time(sentence.data(), sentence.size(), &time), false, -1 };
+    if (result.type != NMEA_TIME_NONE)
+    {
+        result.valid   = time.valid;
+        result.seconds = time.valid && result.type != NMEA_TIME_GGA ? time.utc_seconds : -1;
+    }
+    return result;
+}
+
+// Flips one bit in a byte between '$' and '*' of pct% of the sentences
+static uint32_t corrupt(std::vector<std::string>* corpus, double pct)
+{
+    uint32_t damaged = 0;
+    for (std::string& sentence : *corpus)
+    {
+        size_t star = sentence.find('*');
+        if (star == std::string::npos || star < 2 || drand48() * 100.0 >= pct)
+            continue;
+        sentence[1 + lrand48() % (star - 1)] ^= 1 << (lrand48() % 6);
+        ++damaged;
+    }
+    return damaged;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+           "usage: %s [options]\n"
+           "  -c  console capture with GPSTRACE lines to take the NMEA from\n"
+           "  -f  file of raw NMEA sentences\n"
+           "  -s  seconds of synthetic receiver output, if neither is given (default 3600)\n"
+           "  -n  passes over the corpus per parser (default 20)\n"
+           "  -B  percentage of sentences with a damaged byte\n"
+           "  -S  random seed\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    const char* console_path = NULL;
+    const char* nmea_path    = NULL;
+    uint32_t    seconds      = 3600;
+    uint32_t    passes       = 20;
+    double      corrupt_pct  = 0.0;
+    long        seed         = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:f:s:n:B:S:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': console_path = optarg; break;
+            case 'f': nmea_path    = optarg; break;
+            case 's': seconds      = strtoul(optarg, NULL, 0); break;
+            case 'n': passes       = strtoul(optarg, NULL, 0); break;
+            case 'B': corrupt_pct  = atof(optarg); break;
+            case 'S': seed         = atol(optarg); break;
+            default:  usage(argv[0]); return 1;
+        }
+    }
+    srand48(seed);
+    // mktime() in the minmea path, as on the firmware, takes local time
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    std::vector<std::string> corpus;
+    if (console_path && !load_console(console_path, &corpus))
+        return 1;
+    if (nmea_path && !load_nmea(nmea_path, &corpus))
+        return 1;
+    if (!console_path && !nmea_path)
+        synthesize(seconds, &corpus);
+    if (corpus.empty())
+    {
+        fprintf(stderr, "no NMEA sentences\n");
+        return 1;
+    }
+    uint32_t damaged = corrupt_pct > 0.0 ? corrupt(&corpus, corrupt_pct) : 0;
+
+    // correctness: every RMC has to come out the same from both
+    uint32_t rmc = 0, rmc_valid = 0, mismatches = 0, rejected_minmea = 0, rejected_fast = 0;
+    for (const std::string& sentence : corpus)
+    {
+        Result slow = parse_minmea(sentence.c_str());
+        Result fast = parse_fast(sentence);
+        rejected_minmea += slow.type == NMEA_TIME_NONE;
+        rejected_fast   += fast.type == NMEA_TIME_NONE;
+        if (slow.type != NMEA_TIME_RMC && fast.type != NMEA_TIME_RMC)
+            continue;
+        ++rmc;
+        rmc_valid += fast.valid;
+        if (slow.type != fast.type || slow.valid != fast.valid || slow.seconds != fast.seconds)
+        {
+            if (++mismatches <= 5)
+                printf("mismatch: minmea %d/%d/%" PRId64 ", nmea_time %d/%d/%" PRId64 ": %s",
+                    slow.type, slow.valid, slow.seconds, fast.type, fast.valid, fast.seconds, sentence.c_str());
+        }
+    }
+
+    volatile int64_t sink = 0;
+    uint64_t start = now_ns();
+    for (uint32_t pass = 0; pass < passes; ++pass)
+        for (const std::string& sentence : corpus)
+            sink += parse_minmea(sentence.c_str()).seconds;
+    uint64_t minmea_ns = now_ns() - start;
+
+    start = now_ns();
+    for (uint32_t pass = 0; pass < passes; ++pass)
+        for (const std::string& sentence : corpus)
+            sink += parse_fast(sentence).seconds;
+    uint64_t fast_ns = now_ns() - start;
+    (void)sink;
+
+    double runs = (double)corpus.size() * passes;
+    printf("corpus: sentences=%zu rmc=%u valid=%u damaged=%u\n", corpus.size(), rmc, rmc_valid, damaged);
+    printf("rejected: minmea=%u nmea_time=%u (not a time sentence, malformed or bad checksum)\n",
+        rejected_minmea, rejected_fast);
+    printf("minmea:    %8.1f ns/sentence\n", minmea_ns / runs);
+    printf("nmea_time: %8.1f ns/sentence (%.1fx)\n", fast_ns / runs, fast_ns ? (double)minmea_ns / fast_ns : 0.0);
+    printf("rmc mismatches: %u\n", mismatches);
+    return mismatches ? 2 : 0;
+}
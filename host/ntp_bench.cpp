@@ -0,0 +1,842 @@
+/*
+ * NTP load generator for the host build.
+ *
+ * Drives ntp_udp_recv_cb() through hal_host_udp_deliver() with open-loop
+ * arrivals at a given rate and burst size, on the simulated clock, and
+ * reports throughput, drop rate, turnaround percentiles and timestamp
+ * errors.  The responder is modelled as the firmware's main loop: one
+ * server in front of a fixed-depth receive queue (NET_RX_RING_SIZE by
+ * default), frames arriving while it is full are dropped.
+ *
+ * Service time per request is either what the handler actually took on this
+ * machine (default) or a fixed cost given with -n, e.g. one taken from the
+ * device's latency histograms.  Output is one line per rate so results can
+ * be compared across commits.
+ *
+ * Requests come from a new client address each (default), a pool of -c
+ * addresses, and -a percent of them from one client polling as fast as the
+ * load allows, so the per-client rate limit (NTP_RATE_LIMIT) sees both its
+ * table churning and an abusive client.  Its lookup cost is measured on its
+ * own as well.
+ *
+ * With -i the clients follow NTPv4 interleaved mode (NTP_INTERLEAVED) the way
+ * chrony does, echoing the receive timestamp of their previous response, and
+ * responses that come back interleaved are checked to carry the departure
+ * time of that previous response.  -s sends symmetric active requests.
+ *
+ * With -k the requests carry a MAC (NTP_AUTH), AES-CMAC or legacy SHA1,
+ * which the bench makes and checks on the responses without the responder's
+ * precomputed key layout.  The handler cost is measured with and without
+ * each kind of MAC, for authenticated against unauthenticated responses per
+ * second.
+ *
+ * With -N the clients use NTS (RFC 8915): each goes through NTS-KE with the
+ * responder's own NtsServer (keys from a stand-in for the TLS exporter, the
+ * TLS handshake itself is not modelled), keeps a jar of cookies, and asks for
+ * enough new ones with placeholders to keep it full, or -P placeholders on
+ * every request.  Responses are decrypted and their cookies go back in the
+ * jar.  The handler cost of an NTS request is measured with one cookie and
+ * with a response full of them, as requests per second and the clients that
+ * polling every 64 s comes to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "hal_host.h"
+#include "gps.h"
+#include "ntp.h"
+#include "rate_limit.h"
+#include "interleave.h"
+#include "ntp_auth.h"
+#include "nts.h"
+#include "nts_ke.h"
+
+#define NTP_PORT            123
+#define NTP_PACKET_SIZE     48
+// an NTS request with a cookie and every placeholder: unique identifier, cookies, authenticator
+#define NTS_COOKIE_FIELD    (NTS_EF_HEADER_LEN + NTS_COOKIE_LEN)
+#define NTP_MAX_PACKET_SIZE (NTP_PACKET_SIZE + NTS_EF_HEADER_LEN + NTS_UNIQUE_ID_MIN_LEN + \
+                             NTS_MAX_COOKIES * NTS_COOKIE_FIELD + 8 + NTS_NONCE_LEN + AES_SIV_TAG_LEN)
+
+// the same secret as an AES-CMAC key (its first 16 bytes) and a SHA1 key
+#define BENCH_CMAC_KEY_ID   1
+#define BENCH_SHA1_KEY_ID   2
+#define bench_key_id(type)  ((type) == NTP_KEY_AES128_CMAC ? BENCH_CMAC_KEY_ID : BENCH_SHA1_KEY_ID)
+static const uint8_t bench_key[SHA1_DIGEST_LEN] = {
+    0x42, 0x65, 0x6e, 0x63, 0x68, 0x20, 0x6b, 0x65, 0x79, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x73, 0x65,
+    0x63, 0x72, 0x65, 0x74 };
+static AesCmacKey bench_cmac;
+
+// UTC second labelled by the first simulated PPS edge
+#define BENCH_EPOCH         1704067200 // 2024-01-01 00:00:00
+
+typedef struct bench_config
+{
+    uint32_t rate;          // requests per second
+    uint32_t burst;         // requests arriving together
+    uint32_t duration_s;    // simulated seconds per run
+    uint32_t queue_depth;   // requests waiting for the server
+    uint32_t service_ns;    // fixed cost per request, 0 to measure it
+    bool     poisson;       // exponential gaps between bursts instead of fixed
+    uint32_t clients;       // client addresses to draw from, 0 for a new one per request
+    double   abusive_pct;   // requests from the one abusive client
+    bool     interleaved;   // clients ask for interleaved responses
+    bool     symmetric;     // symmetric active requests instead of client
+    uint8_t  auth;          // NTP_KEY_AES128_CMAC or NTP_KEY_SHA1 to sign requests, 0 not to
+    bool     nts;           // clients use NTS
+    int      placeholders;  // cookie placeholders per NTS request, -1 to keep the jar full
+} BenchConfig;
+
+typedef struct bench_request
+{
+    uint64_t arrival_ns;
+    uint32_t seq;
+    HalPeer  peer;
+} BenchRequest;
+
+typedef struct bench_result
+{
+    uint64_t offered;
+    uint64_t answered;
+    uint64_t dropped;       // queue full
+    uint64_t unanswered;    // handler returned 0
+    uint64_t kod;           // answered with a Kiss-o'-Death
+    uint64_t interleaved;   // answered in interleaved mode
+    uint64_t ts_errors;
+    uint64_t key_exchanges; // NTS-KE sessions the clients needed
+    uint64_t busy_ns;
+    std::vector<uint64_t> turnaround_ns;
+} BenchResult;
+
+// What a client kept from its last response, for an interleaved request
+typedef struct bench_client
+{
+    uint8_t  server_rx[8];  // the response's receive timestamp
+    uint64_t arrival_ns;    // its request reached the server
+    uint64_t done_ns;       // the response was back
+} BenchClient;
+
+// An NTS client: the keys NTS-KE gave it and its cookie jar
+typedef struct bench_nts_client
+{
+    uint8_t uid[NTS_UNIQUE_ID_MIN_LEN];
+    uint8_t c2s[NTS_KEY_LEN];
+    uint8_t s2c[NTS_KEY_LEN];
+    uint8_t jar[NTS_MAX_COOKIES][NTS_COOKIE_LEN];
+    uint8_t cookies;
+} BenchNtsClient;
+
+// created in main() and left for process exit: GPS::~GPS() would detach
+// PPS through gps.cpp statics that may already be gone
+static GPS*     gps;
+static NTP*     ntp;
+static uint64_t now_ns;
+static uint64_t next_pps_ns;
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next()
+{
+    // xorshift64*, fixed seed so runs are repeatable
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+#define ABUSIVE_CLIENT      0x6300000a // 10.0.0.99, network byte order
+
+// Source of the next request: 10.x.y.z, network byte order
+static HalPeer next_peer(const BenchConfig* config)
+{
+    HalPeer peer;
+    double  u = (double)(rng_next() >> 11) / (double)(1ULL << 53);
+    if (u * 100.0 < config->abusive_pct)
+        peer.addr = ABUSIVE_CLIENT;
+    else if (config->clients)
+        peer.addr = 0x0a | (uint32_t)(rng_next() % config->clients + 1) << 8;
+    else
+        peer.addr = 0x0a | (uint32_t)(rng_next() & 0xffffff00);
+    peer.port = 0x7b00;
+    return peer;
+}
+
+static void put32(uint8_t* dst, uint32_t value)
+{
+    dst[0] = (uint8_t)(value >> 24);
+    dst[1] = (uint8_t)(value >> 16);
+    dst[2] = (uint8_t)(value >> 8);
+    dst[3] = (uint8_t)(value);
+}
+
+static uint32_t get32(const uint8_t* src)
+{
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+// NTP time of a simulated-clock instant, as the GPS labels it
+static NTPTime true_ntp_time(uint64_t timestamp_ns)
+{
+    NTPTime t;
+    t.seconds  = toNTP(BENCH_EPOCH - 1 + timestamp_ns / NS_PER_SEC);
+    t.fraction = ns_to_ntp_fraction((uint32_t)(timestamp_ns % NS_PER_SEC));
+    return t;
+}
+
+static void feed_rmc(time_t seconds)
+{
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+
+    char body[96];
+    snprintf(body, sizeof(body), "GPRMC,%02d%02d%02d.00,A,4807.038,N,01131.000,E,0.0,0.0,%02d%02d%02d,,,A",
+        tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100);
+
+    uint8_t checksum = 0;
+    for (const char* p = body; *p; ++p)
+        checksum ^= (uint8_t)*p;
+
+    char sentence[112];
+    int len = snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+    hal_host_uart_feed((const uint8_t*)sentence, len);
+}
+
+// Fire every PPS edge due by now_ns, each followed by its RMC sentence
+static void run_pps()
+{
+    while (next_pps_ns <= now_ns)
+    {
+        hal_host_set_time_ns(next_pps_ns);
+        hal_host_pps();
+        feed_rmc(BENCH_EPOCH - 1 + next_pps_ns / NS_PER_SEC);
+        gps->process();
+        next_pps_ns += NS_PER_SEC;
+    }
+    hal_host_set_time_ns(now_ns);
+}
+
+// The MAC of a header as a client makes it: AES-CMAC, or SHA1 of key and header
+static uint8_t client_mac(uint8_t type, const uint8_t* header, uint8_t* mac)
+{
+    if (type == NTP_KEY_AES128_CMAC)
+    {
+        aes_cmac(&bench_cmac, header, NTP_PACKET_SIZE, mac);
+        return AES_CMAC_LEN;
+    }
+    uint8_t msg[sizeof(bench_key) + NTP_PACKET_SIZE];
+    memcpy(msg, bench_key, sizeof(bench_key));
+    memcpy(msg + sizeof(bench_key), header, NTP_PACKET_SIZE);
+    sha1(msg, sizeof(msg), mac);
+    return SHA1_DIGEST_LEN;
+}
+
+// Stand-in for the TLS keying material exporter: both ends of a session get
+// the same keys, so the client keeps what the server is given
+static bool bench_exporter(void* tls, const char* label, const uint8_t* context, size_t context_len,
+                           uint8_t* out, size_t len)
+{
+    BenchNtsClient* client = (BenchNtsClient*)tls;
+    for (size_t i = 0; i < len; ++i)
+        out[i] = (uint8_t)(rng_next() >> 56);
+    memcpy(context[4] == NTS_KE_C2S ? client->c2s : client->s2c, out, len);
+    return strcmp(label, NTS_KE_EXPORTER_LABEL) == 0 && context_len == NTS_KE_CONTEXT_LEN;
+}
+
+// NTS-KE as a client does it: NTPv4 and AES-SIV offered, the cookies kept
+static bool key_exchange(BenchNtsClient* client)
+{
+#ifdef NTS
+    static const uint8_t request[] = {
+        0x80, NTS_KE_NEXT_PROTOCOL, 0, 2, 0, NTS_KE_PROTOCOL_NTPV4,
+        0x80, NTS_KE_AEAD, 0, 2, 0, NTS_AEAD_AES_SIV_CMAC_256,
+        0x80, NTS_KE_END, 0, 0 };
+    uint8_t      response[NTS_KE_MAX_RESPONSE];
+    NtsKeRequest req;
+    if (nts_ke_parse(request, sizeof(request), &req) != NTS_KE_COMPLETE)
+        return false;
+    size_t len = nts_ke_respond(&ntp->_nts, &req, bench_exporter, client, response);
+
+    client->cookies = 0;
+    for (size_t offset = 0; offset + 4 <= len; offset += 4 + ((response[offset + 2] << 8) | response[offset + 3]))
+    {
+        if (response[offset + 1] == NTS_KE_NEW_COOKIE && client->cookies < NTS_MAX_COOKIES)
+            memcpy(client->jar[client->cookies++], response + offset + 4, NTS_COOKIE_LEN);
+    }
+    for (size_t i = 0; i < sizeof(client->uid); ++i)
+        client->uid[i] = (uint8_t)rng_next();
+    return client->cookies == NTS_MAX_COOKIES;
+#else
+    return false;
+#endif
+}
+
+// Returns the request's length
+static uint16_t build_request(uint8_t* pkt, const BenchRequest* req, const BenchConfig* config, const BenchClient* client,
+                              BenchNtsClient* nts)
+{
+    memset(pkt, 0x0, NTP_PACKET_SIZE);
+    pkt[0] = (0 << 6) | (4 << 3) | (config->symmetric ? 1 : 3); // LI none, v4, client or symmetric active
+    pkt[2] = 6;                       // poll
+    // the client's transmit time, with the sequence in the low bits so every origin is unique
+    NTPTime xmit = true_ntp_time(req->arrival_ns);
+    put32(pkt + 40, xmit.seconds);
+    put32(pkt + 44, (xmit.fraction & 0xfff00000) | (req->seq & 0x000fffff));
+    if (client)
+    {
+        // interleaved: origin is the server's receive timestamp of our last
+        // request, receive when its response got back to us
+        memcpy(pkt + 24, client->server_rx, 8);
+        NTPTime rx = true_ntp_time(client->done_ns);
+        put32(pkt + 32, rx.seconds);
+        put32(pkt + 36, rx.fraction);
+    }
+    if (nts)
+    {
+        // the last cookie, and placeholders for enough to fill the jar again
+        uint8_t cookie = --nts->cookies;
+        uint8_t placeholders = config->placeholders >= 0 ? (uint8_t)config->placeholders :
+                                                           (uint8_t)(NTS_MAX_COOKIES - 1 - nts->cookies);
+        return nts_client_request(pkt, NTP_PACKET_SIZE, nts->uid, nts->jar[cookie], placeholders, nts->c2s);
+    }
+    if (!config->auth)
+        return NTP_PACKET_SIZE;
+    put32(pkt + NTP_PACKET_SIZE, bench_key_id(config->auth));
+    return NTP_PACKET_SIZE + NTP_AUTH_KEY_ID_LEN + client_mac(config->auth, pkt, pkt + NTP_PACKET_SIZE + NTP_AUTH_KEY_ID_LEN);
+}
+
+static inline uint64_t ntp64(const uint8_t* p)
+{
+    return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+static inline uint64_t ntp64(uint64_t timestamp_ns)
+{
+    NTPTime t = true_ntp_time(timestamp_ns);
+    return ((uint64_t)t.seconds << 32) | t.fraction;
+}
+
+// Checks a response against the request it answers, returns the number of
+// problems.  client is what the client kept from its previous response if it
+// asked for an interleaved one, and interleaved is set if it got one.  An
+// NTS client's new cookies go into its jar.
+static uint32_t check_response(const uint8_t* rsp, uint16_t len, const uint8_t* request, uint16_t request_len,
+                               uint64_t arrival_ns, uint64_t done_ns, const BenchClient* client, bool* interleaved,
+                               BenchNtsClient* nts)
+{
+    uint32_t errors = 0;
+
+    if (rsp[1] == 0)
+    {
+        if (len != NTP_PACKET_SIZE)
+            return 1;
+        // Kiss-o'-Death: alarm, stratum 0, the code as reference id, the origin still echoed
+        if (rsp[0] != ((3 << 6) | (4 << 3) | 4) || memcmp(rsp + 12, "RATE", 4) != 0 || memcmp(rsp + 24, request + 40, 8) != 0)
+            ++errors;
+        return errors;
+    }
+    // an authenticated response is signed with the request's key, a crypto-NAK is an error here
+    if (len != request_len)
+        return 1;
+    if (nts)
+    {
+        int cookies = nts_client_response(rsp, len, nts->uid, nts->s2c, nts->jar[nts->cookies],
+                                          (uint8_t)(NTS_MAX_COOKIES - nts->cookies));
+        if (cookies < 0)
+            ++errors;
+        else
+            nts->cookies = (uint8_t)std::min(nts->cookies + cookies, NTS_MAX_COOKIES);
+    }
+    else if (len > NTP_PACKET_SIZE)
+    {
+        uint8_t mac[NTP_AUTH_MAX_MAC_LEN];
+        uint8_t type = len == NTP_PACKET_SIZE + NTP_AUTH_KEY_ID_LEN + AES_CMAC_LEN ? NTP_KEY_AES128_CMAC : NTP_KEY_SHA1;
+        uint8_t mac_len = client_mac(type, rsp, mac);
+        if (get32(rsp + NTP_PACKET_SIZE) != bench_key_id(type) || memcmp(rsp + NTP_PACKET_SIZE + NTP_AUTH_KEY_ID_LEN, mac, mac_len) != 0)
+            ++errors;
+    }
+
+    uint8_t mode = (request[0] & 0x07) == 1 ? 2 : 4; // passive to symmetric active, else server
+    if (rsp[0] != ((0 << 6) | (4 << 3) | mode) || rsp[1] != 1 || rsp[2] != request[2])
+        ++errors;
+
+    // Interleaved, origin is the client's receive time of the previous
+    // response and transmit when that response left: after the server had its
+    // request and before the client had the response.  Otherwise origin is
+    // the client's transmit time, byte for byte.
+    *interleaved = client && memcmp(rsp + 24, request + 32, 8) == 0;
+    if (*interleaved)
+    {
+        uint64_t prev_xmit_ts = ntp64(rsp + 40);
+        if (prev_xmit_ts < ntp64(client->arrival_ns) || prev_xmit_ts > ntp64(client->done_ns))
+            ++errors;
+    }
+    else if (memcmp(rsp + 24, request + 40, 8) != 0)
+        ++errors;
+
+    // receive is the arrival time on the GPS timescale
+    NTPTime recv = true_ntp_time(arrival_ns);
+    if (get32(rsp + 32) != recv.seconds || get32(rsp + 36) != recv.fraction)
+        ++errors;
+
+    // transmit is no earlier than receive and no later than the response was done
+    uint64_t recv_ts = ntp64(rsp + 32);
+    uint64_t xmit_ts = ntp64(rsp + 40);
+    if (!*interleaved && (xmit_ts < recv_ts || xmit_ts > ntp64(done_ns)))
+        ++errors;
+
+    return errors;
+}
+
+// Start of burst n of a run that started at start_ns
+static uint64_t burst_time_ns(const BenchConfig* config, uint64_t start_ns, uint64_t prev_ns, uint64_t n)
+{
+    double mean = (double)NS_PER_SEC * config->burst / config->rate;
+    if (!config->poisson)
+        return start_ns + (uint64_t)(mean * n);
+    double u = (double)(rng_next() >> 11) / (double)(1ULL << 53);
+    return prev_ns + (uint64_t)(-mean * log(1.0 - u));
+}
+
+static void run(const BenchConfig* config, BenchResult* result)
+{
+    std::deque<BenchRequest> queue;
+    std::unordered_map<uint32_t, BenchClient> clients;
+    std::unordered_map<uint32_t, BenchNtsClient> nts_clients;
+    uint64_t end_ns       = now_ns + (uint64_t)config->duration_s * NS_PER_SEC;
+    uint64_t start_ns     = now_ns;
+    uint64_t next_arrival = now_ns;
+    uint64_t bursts       = 0;
+    uint32_t seq          = 0;
+    uint8_t  pkt[NTP_MAX_PACKET_SIZE];
+    uint8_t  request[NTP_MAX_PACKET_SIZE];
+
+    while (next_arrival < end_ns || !queue.empty())
+    {
+        // everything that has arrived by now joins the queue, or is dropped
+        while (next_arrival < end_ns && next_arrival <= now_ns)
+        {
+            for (uint32_t i = 0; i < config->burst; ++i)
+            {
+                ++result->offered;
+                if (queue.size() >= config->queue_depth)
+                {
+                    ++result->dropped;
+                    continue;
+                }
+                BenchRequest req = { next_arrival, seq++, next_peer(config) };
+                queue.push_back(req);
+            }
+            next_arrival = burst_time_ns(config, start_ns, next_arrival, ++bursts);
+        }
+
+        if (queue.empty())
+        {
+            now_ns = next_arrival;
+            run_pps();
+            continue;
+        }
+
+        BenchRequest req = queue.front();
+        queue.pop_front();
+        run_pps();
+
+        const BenchClient* client = NULL;
+        if (config->interleaved)
+        {
+            auto found = clients.find(req.peer.addr);
+            if (found != clients.end())
+                client = &found->second;
+        }
+        // an NTS client with no cookies left goes back to NTS-KE first; with a
+        // new address per request every client is new
+        BenchNtsClient  fresh;
+        BenchNtsClient* nts = NULL;
+        if (config->nts)
+        {
+            fresh.cookies = 0;
+            nts = config->clients ? &nts_clients[req.peer.addr] : &fresh;
+            if (!nts->cookies)
+            {
+                ++result->key_exchanges;
+                if (!key_exchange(nts))
+                    ++result->ts_errors;
+            }
+        }
+        uint16_t request_len = build_request(pkt, &req, config, client, nts);
+        memcpy(request, pkt, sizeof(request));
+
+        auto start = std::chrono::steady_clock::now();
+        uint16_t len = hal_host_udp_deliver(NTP_PORT, pkt, request_len, request_len,
+                                            req.arrival_ns, &req.peer);
+        uint64_t took_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start).count();
+
+        uint64_t service_ns = config->service_ns ? config->service_ns : took_ns;
+        now_ns += service_ns;
+        result->busy_ns += service_ns;
+
+        if (!len)
+        {
+            ++result->unanswered;
+            continue;
+        }
+
+        ++result->answered;
+        result->kod += pkt[1] == 0;
+        result->turnaround_ns.push_back(now_ns - req.arrival_ns);
+        bool interleaved = false;
+        result->ts_errors += check_response(pkt, len, request, request_len, req.arrival_ns, now_ns, client, &interleaved,
+                                            nts && pkt[1] != 0 ? nts : NULL);
+        result->interleaved += interleaved;
+
+        if (config->interleaved && pkt[1] != 0)
+        {
+            BenchClient& next = clients[req.peer.addr];
+            memcpy(next.server_rx, pkt + 32, sizeof(next.server_rx));
+            next.arrival_ns = req.arrival_ns;
+            next.done_ns    = now_ns;
+        }
+    }
+}
+
+static double percentile_us(std::vector<uint64_t>& samples, double p)
+{
+    if (samples.empty())
+        return 0.0;
+    size_t index = (size_t)(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index] / 1000.0;
+}
+
+static void report(const BenchConfig* config, BenchResult* result)
+{
+    double drop_pct = result->offered ? 100.0 * result->dropped / result->offered : 0.0;
+    double p50  = percentile_us(result->turnaround_ns, 0.50);
+    double p99  = percentile_us(result->turnaround_ns, 0.99);
+    double p999 = percentile_us(result->turnaround_ns, 0.999);
+    double max  = result->turnaround_ns.empty() ? 0.0 :
+                  *std::max_element(result->turnaround_ns.begin(), result->turnaround_ns.end()) / 1000.0;
+
+    printf("rate=%" PRIu32 " burst=%" PRIu32 " offered=%" PRIu64 " answered=%" PRIu64 " dropped=%" PRIu64 " (%.3f%%)"
+           " unanswered=%" PRIu64 " kod=%" PRIu64 " interleaved=%" PRIu64 " throughput=%.0f/s busy=%.1f%% p50=%.2fus p99=%.2fus p999=%.2fus max=%.2fus ts_errors=%" PRIu64,
+        config->rate, config->burst, result->offered, result->answered, result->dropped, drop_pct,
+        result->unanswered, result->kod, result->interleaved, (double)result->answered / config->duration_s,
+        100.0 * result->busy_ns / ((double)config->duration_s * NS_PER_SEC),
+        p50, p99, p999, max, result->ts_errors);
+    if (config->nts)
+        printf(" nts_ke=%" PRIu64, result->key_exchanges);
+    printf("\n");
+}
+
+// Back-to-back handler calls with no queueing model: the raw cost on this
+// machine, for requests signed with auth (0 for none).  Returns ns/request.
+static double measure_handler(uint8_t auth, double plain_ns)
+{
+    const uint32_t count = 1000000;
+    uint8_t  request[NTP_MAX_PACKET_SIZE];
+    uint8_t  pkt[NTP_MAX_PACKET_SIZE];
+    HalPeer  peer = { 0x0100000a, 0x7b00 };
+    BenchRequest req = { now_ns, 0, peer };
+
+    BenchConfig config = {};
+    config.auth = auth;
+    uint16_t len = build_request(request, &req, &config, NULL, NULL);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        memcpy(pkt, request, len); // the reply overwrote it
+        peer.addr = 0x0a | (i + 1) << 8; // a different client each time, so none is rate limited
+        hal_host_udp_deliver(NTP_PORT, pkt, len, len, now_ns, &peer);
+    }
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count() / (double)count;
+
+    if (!auth)
+        printf("handler: %.1f ns/request, %.2f Mrequests/s on this host\n", ns, 1000.0 / ns);
+    else
+        printf("handler (%s): %.1f ns/request, %.2f Mrequests/s on this host, %.2fx unauthenticated\n",
+            auth == NTP_KEY_AES128_CMAC ? "AES-CMAC" : "SHA1", ns, 1000.0 / ns, ns / plain_ns);
+    return ns;
+}
+
+#ifdef NTS
+// NTS requests back to back: a cookie in and one out, as a client with a full
+// jar sends, and one with a placeholder for every other cookie a jar holds.
+// Then NTS-KE's part of a key exchange, which is cookies, not TLS.
+static void measure_nts(double plain_ns)
+{
+    const uint32_t count = 100000;
+    uint8_t        request[NTP_MAX_PACKET_SIZE];
+    uint8_t        pkt[NTP_MAX_PACKET_SIZE];
+    uint8_t        cookies[NTS_MAX_COOKIES][NTS_COOKIE_LEN];
+    HalPeer        peer = { 0x0100000a, 0x7b00 };
+    BenchRequest   req = { now_ns, 0, peer };
+    BenchNtsClient client;
+
+    BenchConfig config = {};
+    config.nts = true;
+    key_exchange(&client);
+    for (int placeholders = 0; placeholders < NTS_MAX_COOKIES; placeholders += NTS_MAX_COOKIES - 1)
+    {
+        config.placeholders = placeholders;
+        client.cookies = NTS_MAX_COOKIES;
+        uint16_t len = build_request(request, &req, &config, NULL, &client);
+        uint16_t rsp_len = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            memcpy(pkt, request, len);
+            peer.addr = 0x0a | (i + 1) << 8;
+            rsp_len = hal_host_udp_deliver(NTP_PORT, pkt, len, len, now_ns, &peer);
+        }
+        double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count() / (double)count;
+
+        int got = nts_client_response(pkt, rsp_len, client.uid, client.s2c, cookies[0], NTS_MAX_COOKIES);
+        printf("handler (NTS, %d cookie%s): %.1f ns/request, %.2f Mrequests/s on this host, %.2fx unauthenticated, "
+               "%.0f clients at 64 s polling%s\n", placeholders + 1, placeholders ? "s" : "", ns, 1000.0 / ns,
+            ns / plain_ns, 64e9 / ns, got == placeholders + 1 ? "" : " (BAD RESPONSE)");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count / 10; ++i)
+        key_exchange(&client);
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count() / (count / 10.0);
+    printf("NTS-KE: %.1f us/exchange for %d cookies on this host, TLS not included\n", ns / 1000.0, NTS_MAX_COOKIES);
+}
+#endif
+
+#ifdef NTP_RATE_LIMIT
+// RateLimiter::check() on its own: clients already in the table, and new
+// ones, each of which has to evict the least recently seen in its probe window
+static void measure_rate_limit()
+{
+    const uint32_t count = 1000000;
+    const uint32_t resident = RATE_LIMIT_SLOTS / 2;
+    RateLimiter* limiter = new RateLimiter();
+    uint64_t     t_ns = 0;
+
+    for (uint32_t i = 0; i < RATE_LIMIT_SLOTS * 4; ++i)
+        limiter->check(0x0a | (uint32_t)(rng_next() & 0xffffff00), t_ns += 1000);
+
+    std::vector<uint32_t> known;
+    for (uint32_t i = 0; i < resident; ++i)
+    {
+        uint32_t addr = 0x0b | (i + 1) << 8;
+        limiter->check(addr, t_ns += 1000);
+        known.push_back(addr);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; ++i)
+        limiter->check(known[i % resident], t_ns += 1000);
+    double hit_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; ++i)
+        limiter->check(0x0c | (i + 1) << 8, t_ns += 1000);
+    double miss_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start).count();
+
+    printf("rate limit: %u slots, %zu bytes, at most %d probes: %.1f ns/lookup (known), %.1f ns/lookup (new, evicting) on this host\n",
+        RATE_LIMIT_SLOTS, sizeof(RateLimiter), NTP_RATE_PROBES, hit_ns / count, miss_ns / count);
+    delete limiter;
+}
+
+// One client polling faster than the limit, from just above it to far above
+// it: once its burst is spent it must be answered at the limit, neither more
+// often nor starved.  Returns false if any poll interval isn't.
+static bool check_rate_limit()
+{
+    static const double  fractions[] = { 0.9, 0.5, 0.1, 0.0025 };   // of NTP_RATE_INTERVAL_MS
+    const uint32_t       intervals   = 1000;
+    bool                 ok          = true;
+
+    for (double fraction : fractions)
+    {
+        RateLimiter* limiter  = new RateLimiter();
+        uint64_t     poll_ns  = (uint64_t)(NTP_RATE_INTERVAL_MS * 1000000.0 * fraction);
+        uint64_t     end_ns   = (uint64_t)intervals * NTP_RATE_INTERVAL_MS * 1000000ULL;
+        uint64_t     allowed  = 0;
+        for (uint64_t t_ns = NS_PER_SEC; t_ns < NS_PER_SEC + end_ns; t_ns += poll_ns)
+        {
+            // the burst and the bucket refilling behind it are over by halfway
+            bool counted = t_ns >= NS_PER_SEC + end_ns / 2;
+            if (limiter->check(0x0a000001, t_ns) == RATE_LIMIT_ALLOW && counted)
+                ++allowed;
+        }
+        double rate  = allowed / (end_ns / 2 / 1e9);
+        double limit = 1000.0 / NTP_RATE_INTERVAL_MS;
+        bool   held  = fabs(rate / limit - 1.0) < 0.01;
+        ok = ok && held;
+        printf("rate limit: a client polling every %.1f ms is answered %.4f/s, the limit is %.4f/s%s\n",
+            poll_ns / 1e6, rate, limit, held ? "" : " WRONG");
+        delete limiter;
+    }
+    return ok;
+}
+#endif
+
+#ifdef NTP_INTERLEAVED
+// What interleaved mode adds to a response: a lookup for the request, a save
+// for the response and a departure as it leaves
+static void measure_interleave()
+{
+    const uint32_t count = 1000000;
+    InterleaveCache* cache = new InterleaveCache();
+    uint8_t rx[8] = { 0xe9, 0x3c, 0x3a, 0x00 };
+    uint8_t tx[8] = { 0xe9, 0x3c, 0x3a, 0x00 };
+    uint8_t departure[8];
+    uint32_t addr = 0;
+    uint32_t hits = 0;
+
+    // the client of the previous response asks again: every lookup hits
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        bool interleaved = cache->lookup(addr, rx, departure);
+        hits += interleaved;
+        addr = 0x0a | (i / 1000 + 1) << 8;
+        put32(rx + 4, i * 4295u);
+        cache->save(addr, rx, interleaved);
+        put32(tx + 4, i * 4295u + 100000);
+        cache->departed(addr, rx, tx);
+    }
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+    printf("interleave: %u slots, %zu bytes: %.1f ns/response on this host (%u hits)\n",
+        INTERLEAVE_SLOTS, sizeof(InterleaveCache), ns / count, hits);
+    delete cache;
+}
+#endif
+
+static void usage(const char* name)
+{
+    printf("usage: %s [-r rate] [-R max_rate] [-b burst] [-d seconds] [-q depth] [-n service_ns] [-p] [-c clients] [-a pct] [-i] [-s] [-k cmac|sha1] [-N] [-P placeholders]\n"
+           "  -r  requests per second (default 1000)\n"
+           "  -R  sweep: double the rate up to max_rate, one line per rate\n"
+           "  -b  requests per burst (default 1)\n"
+           "  -d  simulated seconds per rate (default 10)\n"
+           "  -q  receive queue depth (default %d, NET_RX_RING_SIZE)\n"
+           "  -n  fixed service time in ns instead of the measured handler time\n"
+           "  -p  Poisson arrivals instead of evenly spaced bursts\n"
+           "  -c  client addresses to spread requests over (default: a new one per request)\n"
+           "  -a  percentage of requests from one abusive client\n"
+           "  -i  clients ask for interleaved responses (use with -c)\n"
+           "  -s  symmetric active requests instead of client requests\n"
+           "  -k  sign requests with an AES-CMAC or SHA1 key\n"
+           "  -N  NTS clients, each with its own cookie jar (use with -c)\n"
+           "  -P  cookie placeholders on every NTS request (default: enough to keep the jar full)\n",
+        name, NET_RX_RING_SIZE);
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config = { 1000, 1, 10, NET_RX_RING_SIZE, 0, false, 0, 0.0, false, false, 0, false, -1 };
+    uint32_t    max_rate = 0;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "r:R:b:d:q:n:pc:a:isk:NP:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': config.rate        = strtoul(optarg, NULL, 0); break;
+            case 'R': max_rate           = strtoul(optarg, NULL, 0); break;
+            case 'b': config.burst       = strtoul(optarg, NULL, 0); break;
+            case 'd': config.duration_s  = strtoul(optarg, NULL, 0); break;
+            case 'q': config.queue_depth = strtoul(optarg, NULL, 0); break;
+            case 'n': config.service_ns  = strtoul(optarg, NULL, 0); break;
+            case 'p': config.poisson     = true; break;
+            case 'c': config.clients     = strtoul(optarg, NULL, 0); break;
+            case 'a': config.abusive_pct = atof(optarg); break;
+            case 'i': config.interleaved = true; break;
+            case 's': config.symmetric   = true; break;
+            case 'k':
+                config.auth = strcmp(optarg, "cmac") == 0 ? NTP_KEY_AES128_CMAC :
+                              strcmp(optarg, "sha1") == 0 ? NTP_KEY_SHA1 : 0;
+                if (!config.auth)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'N': config.nts         = true; break;
+            case 'P': config.placeholders = (int)strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!config.rate || !config.burst || !config.duration_s || !config.queue_depth ||
+        (config.nts && config.auth) || config.placeholders >= NTS_MAX_COOKIES)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // GPS::process() labels seconds with mktime()
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    gps = new GPS();
+    ntp = new NTP(*gps);
+    gps->begin();
+    ntp->begin();
+    aes_cmac_init(&bench_cmac, bench_key);
+#ifdef NTP_AUTH
+    if (!ntp_auth_self_test())
+    {
+        printf("MAC self test failed\n");
+        return 1;
+    }
+    ntp->_auth.addKey(BENCH_CMAC_KEY_ID, NTP_KEY_AES128_CMAC, bench_key, AES128_KEY_LEN);
+    ntp->_auth.addKey(BENCH_SHA1_KEY_ID, NTP_KEY_SHA1, bench_key, sizeof(bench_key));
+#endif
+
+    // lock to the first PPS edge before any requests
+    now_ns      = (hal_time_us_64() / 1000000 + 1) * NS_PER_SEC;
+    next_pps_ns = now_ns;
+    run_pps();
+
+    double plain_ns = measure_handler(0, 0.0);
+#ifdef NTP_AUTH
+    measure_handler(NTP_KEY_AES128_CMAC, plain_ns);
+    measure_handler(NTP_KEY_SHA1, plain_ns);
+#endif
+#ifdef NTS
+    measure_nts(plain_ns);
+#endif
+#ifdef NTP_RATE_LIMIT
+    measure_rate_limit();
+    bool rate_limit_ok = check_rate_limit();
+#endif
+#ifdef NTP_INTERLEAVED
+    measure_interleave();
+#endif
+
+    do {
+        BenchResult result = {};
+        run(&config, &result);
+        report(&config, &result);
+        config.rate *= 2;
+    } while (max_rate && config.rate <= max_rate);
+
+#ifdef NTP_RATE_LIMIT
+    if (!rate_limit_ok)
+        return 1;
+#endif
+    return 0;
+}
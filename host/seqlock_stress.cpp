@@ -0,0 +1,111 @@
+/*
+ * TimeStateSeqlock stress test for the host build.
+ *
+ * A writer thread publishes TimeState records as fast as it can while a
+ * reader thread on another core reads them back, the way core1 and core0
+ * share the GPS time state on the RP2040.  Every field of the n-th record
+ * is derived from n, and the n-th publish leaves the sequence at n, so a
+ * snapshot mixing two records, or not the one its sequence names, is torn.
+ * Exits non-zero if any snapshot was.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "time_state.h"
+
+static TimeStateSeqlock  seqlock;
+static std::atomic<bool> stop(false);
+
+static void fill(uint64_t n, TimeState* state)
+{
+    memset(state, 0x0, sizeof(*state));
+    state->pps_timestamp_ns      = n;
+    state->pps_timestamp_ns_prev = n * 3;
+    state->nmea_timestamp_us     = ~n;
+    state->pps_seconds           = -(int64_t)n;
+    state->pps_ntp_seconds       = (uint32_t)(n * 7);
+    state->valid                 = (uint32_t)n ^ 0x5a5a5a5a;
+    state->freq_corr_q32         = (int32_t)(n * 11);
+    state->root_dispersion       = (uint32_t)(n >> 3);
+    state->stratum               = (uint8_t)n;
+    state->leap                  = (uint8_t)(n >> 8);
+    state->sync_state            = (uint8_t)(n >> 16);
+}
+
+static void writer(uint64_t* publishes)
+{
+    TimeState state;
+    uint64_t  n = 0;
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        fill(++n, &state);
+        seqlock.publish(&state);
+    }
+    *publishes = n;
+}
+
+static void reader(uint64_t* reads, uint64_t* torn, uint64_t* changes)
+{
+    TimeState state, expected;
+    uint32_t  last_seq = 0;
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        uint32_t seq = seqlock.read(&state);
+        if (seq == 0)
+            continue;   // nothing published yet
+        // the sequence is 32 bits, the record counter is not
+        fill(state.pps_timestamp_ns, &expected);
+        if ((uint32_t)state.pps_timestamp_ns != seq || memcmp(&state, &expected, sizeof(state)) != 0)
+        {
+            if (++*torn <= 10)
+                printf("torn: seq=%" PRIu32 " pps_timestamp_ns=%" PRIu64 " prev=%" PRIu64 " pps_seconds=%" PRId64 "\n",
+                    seq, state.pps_timestamp_ns, state.pps_timestamp_ns_prev, state.pps_seconds);
+        }
+        if (seq != last_seq)
+            ++*changes;
+        last_seq = seq;
+        ++*reads;
+    }
+}
+
+static void usage(const char* name)
+{
+    printf("usage: %s [options]\n"
+           "  -d  seconds to run (default 2)\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t duration_s = 2;
+    int      opt;
+
+    while ((opt = getopt(argc, argv, "d:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': duration_s = strtoul(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    uint64_t    publishes = 0, reads = 0, torn = 0, changes = 0;
+    std::thread w(writer, &publishes);
+    std::thread r(reader, &reads, &torn, &changes);
+    std::this_thread::sleep_for(std::chrono::seconds(duration_s));
+    stop = true;
+    w.join();
+    r.join();
+
+    printf("seqlock: publishes=%" PRIu64 " reads=%" PRIu64 " (%" PRIu64 " new) torn=%" PRIu64 "\n",
+        publishes, reads, changes, torn);
+    return torn ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+#include "aes128.h"
+
+static uint8_t  sbox[256];
+static uint32_t te0[256];   // 2.S, S, S, 3.S: one column of MixColumns(SubBytes())
+static bool     tables_built = false;
+
+static inline uint8_t xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+static inline uint32_t ror(uint32_t x, unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t get_be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// The S-box from its definition: the inverse in GF(2^8), then the affine map.
+// p walks the field by multiplying by 3 and q by its inverse, so q = 1/p.
+static void build_tables()
+{
+    uint8_t p = 1, q = 1;
+    do
+    {
+        p = p ^ xtime(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80)
+            q ^= 0x09;
+        uint8_t x = q ^ (uint8_t)((q << 1) | (q >> 7)) ^ (uint8_t)((q << 2) | (q >> 6)) ^
+                    (uint8_t)((q << 3) | (q >> 5)) ^ (uint8_t)((q << 4) | (q >> 4));
+        sbox[p] = x ^ 0x63;
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; ++i)
+    {
+        uint8_t s  = sbox[i];
+        uint8_t s2 = xtime(s);
+        te0[i] = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint8_t)(s2 ^ s);
+    }
+    tables_built = true;
+}
+
+static inline uint32_t sub_word(uint32_t w)
+{
+    return ((uint32_t)sbox[w >> 24] << 24) | ((uint32_t)sbox[(w >> 16) & 0xff] << 16) |
+           ((uint32_t)sbox[(w >> 8) & 0xff] << 8) | sbox[w & 0xff];
+}
+
+void aes128_expand_key(Aes128Key* schedule, const uint8_t* key)
+{
+    if (!tables_built)
+        build_tables();
+
+    uint32_t* rk = schedule->rk;
+    for (int i = 0; i < 4; ++i)
+        rk[i] = get_be32(key + 4 * i);
+
+    uint8_t rcon = 0x01;
+    for (int i = 4; i < 4 * (AES128_ROUNDS + 1); ++i)
+    {
+        uint32_t temp = rk[i - 1];
+        if ((i & 3) == 0)
+        {
+            temp = sub_word((temp << 8) | (temp >> 24)) ^ ((uint32_t)rcon << 24);
+            rcon = xtime(rcon);
+        }
+        rk[i] = rk[i - 4] ^ temp;
+    }
+}
+
+void __time_critical_func(aes128_encrypt)(const Aes128Key* schedule, const uint8_t* in, uint8_t* out)
+{
+    const uint32_t* rk = schedule->rk;
+    uint32_t s0 = get_be32(in)      ^ rk[0];
+    uint32_t s1 = get_be32(in + 4)  ^ rk[1];
+    uint32_t s2 = get_be32(in + 8)  ^ rk[2];
+    uint32_t s3 = get_be32(in + 12) ^ rk[3];
+
+    for (int round = 1; round < AES128_ROUNDS; ++round)
+    {
+        rk += 4;
+        uint32_t t0 = te0[s0 >> 24] ^ ror(te0[(s1 >> 16) & 0xff], 8) ^ ror(te0[(s2 >> 8) & 0xff], 16) ^ ror(te0[s3 & 0xff], 24) ^ rk[0];
+        uint32_t t1 = te0[s1 >> 24] ^ ror(te0[(s2 >> 16) & 0xff], 8) ^ ror(te0[(s3 >> 8) & 0xff], 16) ^ ror(te0[s0 & 0xff], 24) ^ rk[1];
+        uint32_t t2 = te0[s2 >> 24] ^ ror(te0[(s3 >> 16) & 0xff], 8) ^ ror(te0[(s0 >> 8) & 0xff], 16) ^ ror(te0[s1 & 0xff], 24) ^ rk[2];
+        uint32_t t3 = te0[s3 >> 24] ^ ror(te0[(s0 >> 16) & 0xff], 8) ^ ror(te0[(s1 >> 8) & 0xff], 16) ^ ror(te0[s2 & 0xff], 24) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // last round: no MixColumns
+    rk += 4;
+    put_be32(out,      (((uint32_t)sbox[s0 >> 24] << 24) | ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) |
+                        ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) | sbox[s3 & 0xff]) ^ rk[0]);
+    put_be32(out + 4,  (((uint32_t)sbox[s1 >> 24] << 24) | ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) |
+                        ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) | sbox[s0 & 0xff]) ^ rk[1]);
+    put_be32(out + 8,  (((uint32_t)sbox[s2 >> 24] << 24) | ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) |
+                        ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) | sbox[s1 & 0xff]) ^ rk[2]);
+    put_be32(out + 12, (((uint32_t)sbox[s3 >> 24] << 24) | ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) |
+                        ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) | sbox[s2 & 0xff]) ^ rk[3]);
+}
@@ -0,0 +1,32 @@
+#ifndef AES128_H_
+#define AES128_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+/*
+ * AES-128 encryption, for the MACs of NTP authentication.
+ *
+ * The key schedule is expanded once, when a key is configured, and a block
+ * is then 10 rounds of table lookups on 32-bit columns: one 1 KB round table,
+ * rotated for the other three byte positions, and the S-box for the last
+ * round.  Both are built on first use into RAM, which on the RP2040 has no
+ * cache, so lookups take the same time whatever the index.  Nothing is
+ * allocated per block.
+ */
+
+#define AES128_KEY_LEN      16
+#define AES128_BLOCK_LEN    16
+#define AES128_ROUNDS       10
+
+typedef struct aes128_key
+{
+    uint32_t rk[4 * (AES128_ROUNDS + 1)];  // round keys, big-endian columns
+} Aes128Key;
+
+void aes128_expand_key(Aes128Key* schedule, const uint8_t* key);
+// in and out may be the same block
+void aes128_encrypt(const Aes128Key* schedule, const uint8_t* in, uint8_t* out);
+
+#endif /* AES128_H_ */
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "aes_cmac.h"
+
+// Doubling in GF(2^128), as RFC 4493 derives the subkeys
+static void double_block(const uint8_t* in, uint8_t* out)
+{
+    uint8_t carry = in[0] & 0x80;
+    for (int i = 0; i < AES128_BLOCK_LEN - 1; ++i)
+        out[i] = (uint8_t)((in[i] << 1) | (in[i + 1] >> 7));
+    out[AES128_BLOCK_LEN - 1] = (uint8_t)(in[AES128_BLOCK_LEN - 1] << 1);
+    if (carry)
+        out[AES128_BLOCK_LEN - 1] ^= 0x87;
+}
+
+void aes_cmac_init(AesCmacKey* key, const uint8_t* secret)
+{
+    uint8_t l[AES128_BLOCK_LEN] = { 0 };
+    aes128_expand_key(&key->aes, secret);
+    aes128_encrypt(&key->aes, l, l);
+    double_block(l, key->k1);
+    double_block(key->k1, key->k2);
+    memset(l, 0x0, sizeof(l));
+}
+
+void __time_critical_func(aes_cmac)(const AesCmacKey* key, const uint8_t* msg, size_t len, uint8_t* mac)
+{
+    uint8_t x[AES128_BLOCK_LEN] = { 0 };
+
+    // every block but the last goes straight through
+    while (len > AES128_BLOCK_LEN)
+    {
+        for (int i = 0; i < AES128_BLOCK_LEN; ++i)
+            x[i] ^= msg[i];
+        aes128_encrypt(&key->aes, x, x);
+        msg += AES128_BLOCK_LEN;
+        len -= AES128_BLOCK_LEN;
+    }
+
+    // the last is masked with K1 if whole, else padded with 10* and masked with K2
+    if (len == AES128_BLOCK_LEN)
+    {
+        for (int i = 0; i < AES128_BLOCK_LEN; ++i)
+            x[i] ^= msg[i] ^ key->k1[i];
+    }
+    else
+    {
+        for (size_t i = 0; i < len; ++i)
+            x[i] ^= msg[i];
+        x[len] ^= 0x80;
+        for (int i = 0; i < AES128_BLOCK_LEN; ++i)
+            x[i] ^= key->k2[i];
+    }
+    aes128_encrypt(&key->aes, x, mac);
+}
+
+void aes_cmac_begin(AesCmacState* state)
+{
+    memset(state, 0x0, sizeof(*state));
+}
+
+void __time_critical_func(aes_cmac_update)(const AesCmacKey* key, AesCmacState* state, const uint8_t* msg, size_t len)
+{
+    while (len)
+    {
+        if (state->used == AES128_BLOCK_LEN)
+        {
+            for (int i = 0; i < AES128_BLOCK_LEN; ++i)
+                state->x[i] ^= state->block[i];
+            aes128_encrypt(&key->aes, state->x, state->x);
+            state->used = 0;
+        }
+        size_t n = AES128_BLOCK_LEN - state->used;
+        if (n > len)
+            n = len;
+        memcpy(state->block + state->used, msg, n);
+        state->used += (uint8_t)n;
+        msg += n;
+        len -= n;
+    }
+}
+
+void __time_critical_func(aes_cmac_final)(const AesCmacKey* key, AesCmacState* state, uint8_t* mac)
+{
+    const uint8_t* mask = key->k1;
+    if (state->used < AES128_BLOCK_LEN)
+    {
+        memset(state->block + state->used, 0x0, AES128_BLOCK_LEN - state->used);
+        state->block[state->used] = 0x80;
+        mask = key->k2;
+    }
+    for (int i = 0; i < AES128_BLOCK_LEN; ++i)
+        state->x[i] ^= state->block[i] ^ mask[i];
+    aes128_encrypt(&key->aes, state->x, mac);
+}
@@ -0,0 +1,38 @@
+#ifndef AES_CMAC_H_
+#define AES_CMAC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "aes128.h"
+
+/*
+ * AES-CMAC (RFC 4493) with AES-128.  aes_cmac_init() expands the key
+ * schedule and derives the two subkeys once per key, so a MAC costs one
+ * block encryption per 16 bytes of message.  The begin/update/final form is
+ * for messages that are not in one piece, such as AES-SIV's S2V.
+ */
+
+#define AES_CMAC_LEN    16
+
+typedef struct aes_cmac_key
+{
+    Aes128Key aes;
+    uint8_t   k1[AES128_BLOCK_LEN];    // for a whole last block
+    uint8_t   k2[AES128_BLOCK_LEN];    // for a padded one
+} AesCmacKey;
+
+typedef struct aes_cmac_state
+{
+    uint8_t x[AES128_BLOCK_LEN];       // chaining value
+    uint8_t block[AES128_BLOCK_LEN];   // held back until it is known not to be the last
+    uint8_t used;
+} AesCmacState;
+
+void aes_cmac_init(AesCmacKey* key, const uint8_t* secret);
+void aes_cmac(const AesCmacKey* key, const uint8_t* msg, size_t len, uint8_t* mac);
+
+void aes_cmac_begin(AesCmacState* state);
+void aes_cmac_update(const AesCmacKey* key, AesCmacState* state, const uint8_t* msg, size_t len);
+void aes_cmac_final(const AesCmacKey* key, AesCmacState* state, uint8_t* mac);
+
+#endif /* AES_CMAC_H_ */
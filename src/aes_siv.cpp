@@ -0,0 +1,117 @@
+#include <string.h>
+#include "aes_siv.h"
+
+// dbl() of RFC 5297: doubling in GF(2^128), in place
+static void dbl(uint8_t* block)
+{
+    uint8_t carry = block[0] & 0x80;
+    for (int i = 0; i < AES128_BLOCK_LEN - 1; ++i)
+        block[i] = (uint8_t)((block[i] << 1) | (block[i + 1] >> 7));
+    block[AES128_BLOCK_LEN - 1] = (uint8_t)(block[AES128_BLOCK_LEN - 1] << 1);
+    if (carry)
+        block[AES128_BLOCK_LEN - 1] ^= 0x87;
+}
+
+static inline void xor_block(uint8_t* dst, const uint8_t* src)
+{
+    for (int i = 0; i < AES128_BLOCK_LEN; ++i)
+        dst[i] ^= src[i];
+}
+
+void aes_siv_init(AesSivKey* key, const uint8_t* secret)
+{
+    static const uint8_t zero[AES128_BLOCK_LEN] = { 0 };
+    aes_cmac_init(&key->mac, secret);
+    aes128_expand_key(&key->ctr, secret + AES128_KEY_LEN);
+    aes_cmac(&key->mac, zero, sizeof(zero), key->d0);
+}
+
+static void s2v(const AesSivKey* key, const uint8_t* ad, size_t ad_len, const uint8_t* nonce, size_t nonce_len,
+                const uint8_t* plaintext, size_t len, uint8_t* v)
+{
+    uint8_t d[AES128_BLOCK_LEN];
+    uint8_t mac[AES128_BLOCK_LEN];
+    memcpy(d, key->d0, sizeof(d));
+
+    if (ad)
+    {
+        dbl(d);
+        aes_cmac(&key->mac, ad, ad_len, mac);
+        xor_block(d, mac);
+    }
+    if (nonce)
+    {
+        dbl(d);
+        aes_cmac(&key->mac, nonce, nonce_len, mac);
+        xor_block(d, mac);
+    }
+
+    if (len >= AES128_BLOCK_LEN)
+    {
+        // the plaintext with D xored onto its last block
+        AesCmacState state;
+        uint8_t      last[AES128_BLOCK_LEN];
+        memcpy(last, plaintext + len - AES128_BLOCK_LEN, sizeof(last));
+        xor_block(last, d);
+        aes_cmac_begin(&state);
+        aes_cmac_update(&key->mac, &state, plaintext, len - AES128_BLOCK_LEN);
+        aes_cmac_update(&key->mac, &state, last, sizeof(last));
+        aes_cmac_final(&key->mac, &state, v);
+    }
+    else
+    {
+        dbl(d);
+        for (size_t i = 0; i < len; ++i)
+            d[i] ^= plaintext[i];
+        d[len] ^= 0x80;
+        aes_cmac(&key->mac, d, sizeof(d), v);
+    }
+}
+
+static void ctr(const AesSivKey* key, const uint8_t* v, const uint8_t* in, size_t len, uint8_t* out)
+{
+    uint8_t q[AES128_BLOCK_LEN];
+    uint8_t stream[AES128_BLOCK_LEN];
+    memcpy(q, v, sizeof(q));
+    q[8]  &= 0x7f;
+    q[12] &= 0x7f;
+
+    while (len)
+    {
+        aes128_encrypt(&key->ctr, q, stream);
+        size_t n = len < AES128_BLOCK_LEN ? len : AES128_BLOCK_LEN;
+        for (size_t i = 0; i < n; ++i)
+            out[i] = in[i] ^ stream[i];
+        in  += n;
+        out += n;
+        len -= n;
+        for (int i = AES128_BLOCK_LEN - 1; i >= 0 && ++q[i] == 0; --i)
+            ;
+    }
+}
+
+void __time_critical_func(aes_siv_encrypt)(const AesSivKey* key, const uint8_t* ad, size_t ad_len,
+                                           const uint8_t* nonce, size_t nonce_len,
+                                           const uint8_t* plaintext, size_t len, uint8_t* out)
+{
+    uint8_t v[AES_SIV_TAG_LEN];
+    s2v(key, ad, ad_len, nonce, nonce_len, plaintext, len, v);
+    ctr(key, v, plaintext, len, out + AES_SIV_TAG_LEN);
+    memcpy(out, v, sizeof(v));
+}
+
+bool __time_critical_func(aes_siv_decrypt)(const AesSivKey* key, const uint8_t* ad, size_t ad_len,
+                                           const uint8_t* nonce, size_t nonce_len,
+                                           const uint8_t* in, size_t len, uint8_t* plaintext)
+{
+    uint8_t tag[AES_SIV_TAG_LEN];
+    uint8_t v[AES_SIV_TAG_LEN];
+    memcpy(tag, in, sizeof(tag));
+    ctr(key, tag, in + AES_SIV_TAG_LEN, len, plaintext);
+    s2v(key, ad, ad_len, nonce, nonce_len, plaintext, len, v);
+
+    uint8_t diff = 0;
+    for (int i = 0; i < AES_SIV_TAG_LEN; ++i)
+        diff |= tag[i] ^ v[i];
+    return diff == 0;
+}
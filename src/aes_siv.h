@@ -0,0 +1,38 @@
+#ifndef AES_SIV_H_
+#define AES_SIV_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "aes_cmac.h"
+
+/*
+ * AES-SIV-CMAC-256 (RFC 5297), the AEAD NTS uses: the synthetic IV is S2V,
+ * an AES-CMAC chain over the associated data, nonce and plaintext, and
+ * encryption is AES-CTR from it under the second half of the key.
+ *
+ * aes_siv_init() expands both key schedules, the CMAC subkeys and S2V's
+ * starting value (the CMAC of a zero block), once per key.  The plaintext
+ * may be encrypted and decrypted in place: pass out + AES_SIV_TAG_LEN as the
+ * plaintext.  ad or nonce may be NULL for no component at all, which is not
+ * the same as an empty one.
+ */
+
+#define AES_SIV_KEY_LEN     32
+#define AES_SIV_TAG_LEN     16
+
+typedef struct aes_siv_key
+{
+    AesCmacKey mac;                 // first half of the key
+    Aes128Key  ctr;                 // second half
+    uint8_t    d0[AES128_BLOCK_LEN]; // CMAC(K1, 0^128)
+} AesSivKey;
+
+void aes_siv_init(AesSivKey* key, const uint8_t* secret);
+// out is the tag followed by len bytes of ciphertext
+void aes_siv_encrypt(const AesSivKey* key, const uint8_t* ad, size_t ad_len, const uint8_t* nonce, size_t nonce_len,
+                     const uint8_t* plaintext, size_t len, uint8_t* out);
+// in is the tag followed by len bytes of ciphertext; false if it doesn't authenticate
+bool aes_siv_decrypt(const AesSivKey* key, const uint8_t* ad, size_t ad_len, const uint8_t* nonce, size_t nonce_len,
+                     const uint8_t* in, size_t len, uint8_t* plaintext);
+
+#endif /* AES_SIV_H_ */
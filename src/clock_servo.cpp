@@ -0,0 +1,115 @@
+#include "clock_servo.h"
+
+#define NS_PER_SEC      1000000000LL
+#define MAX_FREQ_Q32    (((int64_t)SERVO_MAX_PPM << 32) / 1000000)
+
+ClockServo::ClockServo() :
+    _steps(0),
+    _wander_q4(0)
+{
+    reset();
+}
+
+void ClockServo::reset()
+{
+    _edge_ns    = 0;
+    _edge_frac  = 0;
+    _edges      = 0;
+    _accepted   = 0;
+    _freq_carry = 0;
+    _phase_error_ns = 0;
+    setFrequency(0);
+}
+
+void ClockServo::setFrequency(int64_t freq_q32)
+{
+    if (freq_q32 > MAX_FREQ_Q32)
+        freq_q32 = MAX_FREQ_Q32;
+    if (freq_q32 < -MAX_FREQ_Q32)
+        freq_q32 = -MAX_FREQ_Q32;
+
+    _freq_q32        = freq_q32;
+    _period_ns       = NS_PER_SEC + ((NS_PER_SEC * freq_q32 + (1LL << 31)) >> 32);
+    _freq_offset_ppb = (int32_t)((NS_PER_SEC * freq_q32 + (1LL << 31)) >> 32);
+    // elapsed local ns * (1 + corr) == elapsed true ns: corr = -freq / (1 + freq)
+    int64_t denominator = (1LL << 32) + freq_q32;
+    int64_t half        = freq_q32 >= 0 ? denominator / 2 : -denominator / 2;
+    _freq_corr_q32   = (int32_t)(-((freq_q32 << 32) + half) / denominator);
+}
+
+uint32_t __time_critical_func(ClockServo::update)(uint64_t edge_ns)
+{
+    if (_edges == 0)
+    {
+        _edge_ns = edge_ns;
+        ++_edges;
+        return 1;
+    }
+
+    int64_t since = (int64_t)(edge_ns - _edge_ns);
+    if (since < _period_ns / 2)
+        return 0;
+
+    // whole seconds since the previous edge, more than one if pulses went
+    // missing, and the edge minus its prediction in 2^-16 ns: taken relative
+    // to whole seconds first so nothing shifted overflows, whatever the gap
+    uint32_t seconds    = (uint32_t)((since + _period_ns / 2) / _period_ns);
+    int64_t  offset_q16 = (NS_PER_SEC * _freq_q32) >> 16;   // local ns per second past 1e9
+    int64_t  error_q16  = ((since - seconds * NS_PER_SEC) << 16) - seconds * offset_q16 - _edge_frac;
+    int64_t  error      = (error_q16 + (1 << 15)) >> 16;
+
+    if (_edges == 1)
+    {
+        // the first interval seeds the frequency, no phase history yet
+        int64_t per_second = (since - seconds * NS_PER_SEC) / seconds;
+        if (per_second > SERVO_MAX_PPM * 1000)
+            per_second = SERVO_MAX_PPM * 1000;
+        if (per_second < -SERVO_MAX_PPM * 1000)
+            per_second = -SERVO_MAX_PPM * 1000;
+        setFrequency((per_second << 32) / NS_PER_SEC);
+        _edge_ns   = edge_ns;
+        _edge_frac = 0;
+        _phase_error_ns = 0;
+        ++_edges;
+        ++_accepted;
+        return seconds;
+    }
+
+    if (error > SERVO_MAX_PHASE_US * 1000 || error < -SERVO_MAX_PHASE_US * 1000)
+    {
+        // the receiver stepped (or this is a glitch): take the edge as it is
+        // and start locking again, the frequency estimate still holds
+        ++_steps;
+        _edge_ns   = edge_ns;
+        _edge_frac = 0;
+        _accepted  = 0;
+        _phase_error_ns = 0;
+        return seconds;
+    }
+
+    _phase_error_ns = (int32_t)error;
+    // prediction + KP * error, i.e. the edge less the rest of the error,
+    // split into whole ns and the fraction above them
+    int64_t behind = error_q16 - (error_q16 >> SERVO_KP_SHIFT);
+    int64_t whole  = (behind + 0xffff) >> 16;
+    _edge_ns   = edge_ns - whole;
+    _edge_frac = (whole << 16) - behind;
+
+    // frequency += KI * error / elapsed, in 2^-32; what doesn't divide out
+    // is carried so errors too small for one step still add up
+    int64_t step  = error_q16 * SERVO_KI_Q16 + _freq_carry;
+    int64_t per   = (int64_t)seconds * NS_PER_SEC;
+    int64_t delta = step / per;
+    _freq_carry   = step - delta * per;
+
+    int64_t previous = _freq_q32;
+    setFrequency(_freq_q32 + delta);
+    int64_t change = _freq_q32 - previous;
+    // 1/16 exponential average of how far the estimate moves per edge, in
+    // 1/16 ppb so changes well under a ppb still register
+    int32_t change_q4 = (int32_t)(((change < 0 ? -change : change) * NS_PER_SEC * 16) >> 32);
+    _wander_q4 += change_q4 - (_wander_q4 >> 4);
+    ++_edges;
+    ++_accepted;
+    return seconds;
+}
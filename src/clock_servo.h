@@ -0,0 +1,72 @@
+#ifndef CLOCK_SERVO_H_
+#define CLOCK_SERVO_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * PPS-driven clock servo for the local microsecond timer.
+ *
+ * Each PPS edge is compared with where the servo predicted it, from the
+ * previous edge estimate plus the estimated local length of one second.  A
+ * proportional term pulls the edge estimate toward the measured edge
+ * (filtering interrupt latency jitter), an integral term trims the period
+ * (the oscillator's frequency error).  Gains are set for a critically
+ * damped loop with a time constant of about 15 s; the period is seeded from
+ * the first interval so there is no long pull-in.
+ *
+ * Integer only, like ntp_time.h: the edge is kept in ns (and 2^-16 ns) and
+ * the frequency error in 2^-32 (Q32), with the remainder of each integral step carried to
+ * the next so small phase errors still move it.  Runs in the PPS ISR on
+ * core1.  Readers on core0 get the results through
+ * the published TimeState (edge estimate and freqCorrQ32()), the other
+ * getters are for statistics.
+ */
+
+#define SERVO_KP_SHIFT      3           // phase gain, 1/8
+#define SERVO_KI_Q16        273         // frequency gain in 2^-16, 0.00417: (2 - KP - 2*sqrt(1 - KP)) for critical damping
+#define SERVO_MAX_PHASE_US  500         // edges further than this from the prediction restart the servo
+#define SERVO_MAX_PPM       500         // oscillators further off than this are not believed
+#define SERVO_LOCK_EDGES    16          // consecutive accepted edges before the servo counts as locked
+
+class ClockServo
+{
+public:
+    ClockServo();
+
+    void     reset();
+
+    // Feed a PPS edge (on the hal_time_us_64() timebase, in ns).  Returns the
+    // number of seconds since the previous edge (more than 1 after missing
+    // pulses), or 0 if the edge came too early to be a second boundary and
+    // was ignored.
+    uint32_t update(uint64_t edge_ns);
+
+    uint64_t edgeNs() const         { return _edge_ns + (_edge_frac >> 15); } // estimated local time of the latest edge
+    int32_t  freqCorrQ32() const    { return _freq_corr_q32; }              // true us per local us, minus 1, in 2^-32
+    int32_t  freqOffsetPPB() const  { return _freq_offset_ppb; }            // local oscillator vs GPS, positive is fast
+    int32_t  phaseErrorNs() const   { return _phase_error_ns; }             // latest edge minus its prediction
+    bool     locked() const         { return _accepted >= SERVO_LOCK_EDGES; }
+    bool     seeded() const         { return _edges >= 2; }                 // a frequency estimate exists
+    bool     tracking() const       { return _accepted > 0; }               // the latest edge was compared with a prediction
+    uint32_t steps() const          { return _steps; }
+    int32_t  wanderPPB() const      { return _wander_q4 >> 4; }             // average change in the frequency estimate per edge
+
+private:
+    uint64_t          _edge_ns;     // estimated local time of the latest edge, whole ns
+    int64_t           _edge_frac;   // ... and the 2^-16 ns above them
+    int64_t           _freq_q32;    // local oscillator vs GPS in 2^-32, positive is fast
+    int64_t           _freq_carry;  // remainder of the last integral step, carried to the next
+    int64_t           _period_ns;   // estimated local nanoseconds per second, rounded
+    uint32_t          _edges;       // edges since reset
+    volatile uint32_t _accepted;
+    volatile uint32_t _steps;       // restarts after a phase step
+    volatile int32_t  _freq_corr_q32;
+    volatile int32_t  _freq_offset_ppb;
+    volatile int32_t  _phase_error_ns;
+    volatile int32_t  _wander_q4;   // wanderPPB() in 1/16 ppb
+
+    void     setFrequency(int64_t freq_q32);
+};
+
+#endif /* CLOCK_SERVO_H_ */
@@ -16,6 +16,10 @@
 // Initial baud is used to send configuration commands to rebaud to 115200
 #define GPS_UART_INITIAL_BAUD 9600
 #define GPS_UART_BAUD   115200 // GPS config commands are hardcoded, so if this is changed those need to also be changed
+// DMA receive ring for the GPS UART, log2 bytes: 1024 bytes is ~90 ms at 115200 baud
+#define GPS_UART_RX_RING_BITS   10
+// core1 sleeps this long between GPS::process() passes, well inside the ring's time
+#define GPS_PROCESS_INTERVAL_MS 5
 
 //TODO: Not sure this is working?
 #define  PICO_STDIO_USB_ENABLE_RESET_VIA_BAUD_RATE 1
@@ -25,9 +29,110 @@
 //#define NTP_PACKET_DEBUG
 
 
+// Write the NTP transmit timestamp in tud_network_xmit_cb() as the frame is copied into the
+// USB buffer, instead of before udp_sendto(). Comment out to disable.
+#define NTP_LATE_XMIT_TIMESTAMP
+
+// Timestamp PPS edges with a PIO-latched cycle counter instead of in the GPIO interrupt.
+// Comment out to fall back to the GPIO interrupt.
+#define PPS_PIO_CAPTURE
+
+// Enable UBX NAV-TIMEUTC and TIM-TP on u-blox receivers and label PPS edges from TIM-TP, with
+// its quantization error taken out, ahead of the NMEA. Comment out to use NMEA only.
+#define GPS_UBX_TIMING
+
 // Uncomment to enable full NMEA output
 //#define NMEA_DEBUG
 
+// Uncomment to stream raw NMEA lines and PPS edges as "GPSTRACE" lines for host/gps_replay
+//#define GPS_TRACE
+
+// Uncomment to print a cycles-per-timestamp comparison of the old and fixed-point NTP time paths,
+// the cycles per MAC of NTP_AUTH and per NTS request, at startup
+//#define NTP_BENCHMARK
+
+// Estimated error (us) at which holdover stops claiming sync: past it responses carry
+// LI_NOSYNC and stratum 16 until GPS is back.
+#ifndef HOLDOVER_MAX_ERROR_US
+#define HOLDOVER_MAX_ERROR_US   1000
+#endif
+
+// How often the main loop prints NTP/network statistics
+#define STATS_INTERVAL_MS   60000
+
+// Frames buffered between tud_network_recv_cb() and service_traffic(), must be a power of two.
+// Frames arriving while it is full are dropped at the USB layer.
+#ifndef NET_RX_RING_SIZE
+#define NET_RX_RING_SIZE    8
+#endif
+// Frames service_traffic() hands to lwIP per call before returning to the main loop
+#ifndef NET_RX_BATCH
+#define NET_RX_BATCH        4
+#endif
+
+// Frames lwIP may have waiting for the USB IN endpoint, must be a power of two.
+// When it is full, new frames are dropped (tail drop) and counted rather than blocking the main loop.
+#ifndef NET_TX_QUEUE_SIZE
+#define NET_TX_QUEUE_SIZE   8
+#endif
+
+// Per-client rate limiting: each source address may send NTP_RATE_BURST requests back to back and
+// one per NTP_RATE_INTERVAL_MS after that; past it a client gets one KoD RATE and is then ignored
+// until it slows down. Comment out to answer every request.
+#define NTP_RATE_LIMIT
+#ifndef NTP_RATE_INTERVAL_MS
+#define NTP_RATE_INTERVAL_MS    2000
+#endif
+#ifndef NTP_RATE_BURST
+#define NTP_RATE_BURST          8
+#endif
+// Clients tracked, log2: 12 bytes each, 512 slots is 6 KB of SRAM
+#ifndef NTP_RATE_TABLE_BITS
+#define NTP_RATE_TABLE_BITS     9
+#endif
+// Slots a lookup may look at, which bounds its cost
+#define NTP_RATE_PROBES         8
+
+// NTPv4 interleaved mode as chrony uses it: a client that asks for it gets the time the previous
+// response to it actually left, as ntp_late_xmit_stamp() saw it, in place of an early transmit
+// timestamp. Symmetric active requests are answered in passive mode the same way.
+// Needs NTP_LATE_XMIT_TIMESTAMP. Comment out to answer in basic mode only.
+#define NTP_INTERLEAVED
+// Responses remembered, log2: 24 bytes each, 256 slots is 6 KB of SRAM
+#ifndef NTP_INTERLEAVED_BITS
+#define NTP_INTERLEAVED_BITS    8
+#endif
+
+// Symmetric-key authentication: requests with a MAC (AES-CMAC as RFC 8573 has it, or legacy
+// SHA1) made with a key from ntp_keys.h get a response with a MAC from the same key; an unknown
+// key or a bad MAC gets a crypto-NAK. Comment out to answer only unauthenticated requests.
+#define NTP_AUTH
+#ifndef NTP_AUTH_MAX_KEYS
+#define NTP_AUTH_MAX_KEYS       8
+#endif
+
+// Network Time Security (RFC 8915): requests with NTS extension fields and a cookie from NTS-KE
+// get an authenticated response with fresh cookies; a cookie that won't open gets a KoD NTSN.
+// Cookies are sealed under master keys rotated every NTS_KEY_ROTATION_S, NTS_MASTER_KEYS of them
+// kept, so a cookie is good for (NTS_MASTER_KEYS - 1) rotations. NTS-KE itself needs TLS, see
+// the NTS_KE build option. Comment out to ignore NTS requests.
+#define NTS
+#ifndef NTS_MASTER_KEYS
+#define NTS_MASTER_KEYS         4
+#endif
+#ifndef NTS_KEY_ROTATION_S
+#define NTS_KEY_ROTATION_S      86400
+#endif
+// Cookies handed out by NTS-KE, and the most a response carries
+#ifndef NTS_MAX_COOKIES
+#define NTS_MAX_COOKIES         8
+#endif
+// NTS-KE sessions at a time, each a TLS context of several KB, and the seconds one may sit idle
+#ifndef NTS_KE_MAX_CONNECTIONS
+#define NTS_KE_MAX_CONNECTIONS  2
+#endif
+#define NTS_KE_TIMEOUT_POLLS    10
+
 //uncomment if the 12 mhz crystal has been replaced with a 10 mhz reference.
 // (better idea: synthesize a 12 mhz reference from a 10 mhz reference)
 //#define REF_CLOCK_10MHZ
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <cinttypes>
+#include "event_log.h"
+
+static_assert((EVENT_LOG_SIZE & (EVENT_LOG_SIZE - 1)) == 0, "EVENT_LOG_SIZE must be a power of two");
+
+// printf formats for the record arguments, indexed by EventId
+static const char* const event_formats[EVT_COUNT] = {
+    "ntp_udp_recv_cb(%lu) req:%lu rsp:%lu",                                  // EVT_NTP_REQUEST
+    "[WARNING] recievePacket: ignoring packet with bad length: %lu < %lu",  // EVT_NTP_BAD_LENGTH
+    "[WARNING] receivePacket: GPS data not Valid!",                          // EVT_NTP_NOT_VALID
+    "[ERROR] Failed to allocate pbuf for transmit (%lu)",                    // EVT_NET_ALLOC_FAILED
+    "tud_network_xmit_cb(%lu)",                                              // EVT_NET_XMIT
+    "[WARNING] NTP: client %08lx over the rate limit, sent KoD RATE (%lu)",  // EVT_NTP_RATE_KOD
+    "[WARNING] NTP: ignoring mode %lu packet from %08lx",                    // EVT_NTP_BAD_MODE
+    "[WARNING] NTP: bad MAC or unknown key %lu from %08lx, crypto-NAK",      // EVT_NTP_AUTH_FAILED
+    "[WARNING] NTS: bad cookie or authenticator from %08lx, sent KoD NTSN",  // EVT_NTS_NAK
+    "[WARNING] NTS: ignoring malformed request (%lu) from %08lx",            // EVT_NTS_DROP
+};
+
+static EventRecord      events[EVENT_LOG_SIZE];
+static volatile uint32_t event_head = 0;
+static volatile uint32_t event_tail = 0;
+static uint32_t         event_dropped = 0;
+static uint32_t         event_dropped_reported = 0;
+static uint64_t         event_next_drain_us = 0;
+
+void __time_critical_func(event_log)(uint16_t id, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+    uint32_t head = event_head;
+    if (head - event_tail >= EVENT_LOG_SIZE)
+    {
+        ++event_dropped;
+        return;
+    }
+
+    EventRecord* record = &events[head & (EVENT_LOG_SIZE - 1)];
+    record->timestamp_us = hal_time_us_64();
+    record->id           = id;
+    record->args[0]      = arg0;
+    record->args[1]      = arg1;
+    record->args[2]      = arg2;
+    event_head = head + 1;
+}
+
+void event_log_drain(void)
+{
+    if (event_tail == event_head && event_dropped == event_dropped_reported)
+        return;
+    uint64_t now = hal_time_us_64();
+    if (now < event_next_drain_us)
+        return;
+    event_next_drain_us = now + EVENT_LOG_DRAIN_INTERVAL_MS * 1000;
+
+    for (int i = 0; i < EVENT_LOG_DRAIN_BATCH && event_tail != event_head; ++i)
+    {
+        const EventRecord* record = &events[event_tail & (EVENT_LOG_SIZE - 1)];
+
+        printf("[%" PRIu64 "] ", record->timestamp_us);
+        if (record->id < EVT_COUNT)
+            printf(event_formats[record->id], (unsigned long)record->args[0], (unsigned long)record->args[1], (unsigned long)record->args[2]);
+        else
+            printf("event %u: %lu %lu %lu", record->id, (unsigned long)record->args[0], (unsigned long)record->args[1], (unsigned long)record->args[2]);
+        printf("\n");
+
+        event_tail = event_tail + 1;
+    }
+
+    if (event_dropped != event_dropped_reported)
+    {
+        printf("[WARNING] event log: %lu events dropped\n", (unsigned long)(event_dropped - event_dropped_reported));
+        event_dropped_reported = event_dropped;
+    }
+}
+
+uint32_t event_log_dropped(void)
+{
+    return event_dropped;
+}
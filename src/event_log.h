@@ -0,0 +1,53 @@
+#ifndef EVENT_LOG_H_
+#define EVENT_LOG_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * Deferred binary event log for the packet path.
+ *
+ * Hot paths call event_log() which only stores a fixed-size record in a ring;
+ * event_log_drain(), run from the main loop when it is otherwise idle, does
+ * the printf formatting and USB CDC output at a limited rate.  If the ring is
+ * full the new record is dropped and counted instead of blocking.
+ *
+ * Producers and the drain must run on the same core (core0).
+ */
+
+// Records held until drained, must be a power of two
+#ifndef EVENT_LOG_SIZE
+#define EVENT_LOG_SIZE              64
+#endif
+// Records formatted per event_log_drain() call, and the minimum time between calls that print
+#define EVENT_LOG_DRAIN_BATCH       4
+#define EVENT_LOG_DRAIN_INTERVAL_MS 10
+
+typedef enum event_id
+{
+    EVT_NTP_REQUEST = 0,     // len, req count, rsp count
+    EVT_NTP_BAD_LENGTH,      // len, expected len
+    EVT_NTP_NOT_VALID,
+    EVT_NET_ALLOC_FAILED,    // len
+    EVT_NET_XMIT,            // len
+    EVT_NTP_RATE_KOD,        // client addr (host order), kod count
+    EVT_NTP_BAD_MODE,        // mode, client addr (host order)
+    EVT_NTP_AUTH_FAILED,     // key id, client addr (host order)
+    EVT_NTS_NAK,             // client addr (host order)
+    EVT_NTS_DROP,            // len, client addr (host order)
+    EVT_COUNT
+} EventId;
+
+typedef struct event_record
+{
+    uint64_t timestamp_us;
+    uint16_t id;
+    uint16_t reserved;
+    uint32_t args[3];
+} EventRecord;
+
+void     event_log(uint16_t id, uint32_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0);
+void     event_log_drain(void);
+uint32_t event_log_dropped(void);
+
+#endif /* EVENT_LOG_H_ */
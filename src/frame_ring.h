@@ -0,0 +1,97 @@
+#ifndef FRAME_RING_H_
+#define FRAME_RING_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Fixed-size single-producer/single-consumer ring of pre-allocated frame
+ * buffers.  The producer copies a frame into the next free slot and
+ * publishes it by advancing _head; the consumer works on the oldest slot in
+ * place and releases it by advancing _tail.  Neither side blocks: a full
+ * ring rejects the frame and counts it as an overflow drop.
+ *
+ * SLOTS must be a power of two so the free-running 16-bit indices wrap
+ * cleanly.
+ */
+template <uint16_t SLOTS, uint16_t FRAME_SIZE>
+class FrameRing
+{
+    static_assert(SLOTS > 0 && (SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+    static_assert(SLOTS <= 0x8000, "SLOTS must fit the 16-bit indices");
+
+public:
+    typedef struct frame
+    {
+        uint64_t timestamp_ns; // arrival time, from the producer
+        uint16_t len;
+        uint8_t  data[FRAME_SIZE];
+    } Frame;
+
+    FrameRing() :
+        _head(0),
+        _tail(0),
+        _high_water(0),
+        _overflows(0)
+    {
+    }
+
+    // Producer side
+    bool push(const uint8_t* src, uint16_t len, uint64_t timestamp_ns)
+    {
+        uint16_t head = _head;
+        uint16_t used = (uint16_t)(head - _tail);
+
+        if (used >= SLOTS || len > FRAME_SIZE)
+        {
+            ++_overflows;
+            return false;
+        }
+
+        Frame* frame = &_frames[head & (SLOTS - 1)];
+        memcpy(frame->data, src, len);
+        frame->len = len;
+        frame->timestamp_ns = timestamp_ns;
+
+        __sync_synchronize(); // frame contents visible before the slot is published
+        _head = head + 1;
+
+        if (used + 1 > _high_water)
+            _high_water = used + 1;
+        return true;
+    }
+
+    // Consumer side: oldest frame, or NULL if the ring is empty.
+    Frame* peek()
+    {
+        if (_tail == _head)
+            return NULL;
+        __sync_synchronize();
+        return &_frames[_tail & (SLOTS - 1)];
+    }
+
+    void pop()
+    {
+        __sync_synchronize(); // done with the slot before handing it back
+        _tail = _tail + 1;
+    }
+
+    // Consumer side: drop everything queued.
+    void clear()
+    {
+        _tail = _head;
+    }
+
+    uint16_t occupancy() const { return (uint16_t)(_head - _tail); }
+    uint16_t highWater() const { return _high_water; }
+    uint32_t overflows() const { return _overflows; }
+
+private:
+    volatile uint16_t _head;
+    volatile uint16_t _tail;
+    uint16_t          _high_water;
+    uint32_t          _overflows;
+    Frame             _frames[SLOTS];
+};
+
+#endif /* FRAME_RING_H_ */
@@ -24,38 +24,58 @@
 #include <cinttypes>
 #include <stdio.h>
 #include <stdarg.h>
+#include <algorithm>
 #include "gps.h"
+#ifdef GPS_TRACE
+#include "gps_trace.h"
+#endif
 
 
 
 static const char* TAG = "gps";
 
-static std::function<void()> _pps;
+static std::function<void(uint64_t)> _pps;
 
 const uint8_t mt_set_speed[] = MT_SET_SPEED;
 const uint8_t mt_set_timing_product[] = MT_SET_TIMING_PRODUCT;
 const uint8_t mt_set_pps_nmea[] = MT_SET_PPS_NMEA;
 
-static __isr void __time_critical_func(_pps_isr)(unsigned int gpio, long unsigned int mask)
+static void __time_critical_func(_pps_isr)(uint64_t edge_ns)
 {
     if (_pps){
-        _pps();
+        _pps(edge_ns);
     }
 }
 
 GPS::GPS() :
-    _uart(GPS_UART),
     _valid_count(0),
-    _min_micros(0),
-    _max_micros(0),
     _last_micros(0),
     _timeouts(0),
+    _pps_raw_us(0),
     _valid(false),
-    _nmea_timestamp_us(0),
-    _pps_timestamp_us(0)
+    _sync_state(GPS_SYNC_NONE),
+    _holdover_start_us(0),
+    _holdover_next_update_us(0),
+    _holdover_initial_us(0),
+    _holdover_error_us(0),
+    _label_mismatches(0),
+    _last_rmc_us(0),
+    _fix_quality(0),
+    _fix_us(0),
+    _fix_lost_us(0),
+    _leap_seconds(0),
+    _leap_known(false),
+    _tp_pending(false),
+    _tp_fix(false),
+    _tp_seconds(0),
+    _tp_qerr_ps(0),
+    _tp_received_us(0),
+    _ubx_labels(0),
+    _ubx_holdover_ended(false)
 {
     _reason[0] = '\0';
-    memset(&_buf, 0x0, sizeof(_buf));
+    memset(&_nmea_timestamp, 0x0, sizeof(_nmea_timestamp));
+    memset(&_state, 0x0, sizeof(_state));
 
 }
 
@@ -66,79 +86,68 @@ GPS::~GPS()
 
 void GPS::begin()
 {
-    _pps = std::bind( &GPS::pps, this);
+    _pps = std::bind( &GPS::pps, this, std::placeholders::_1);
 
     //Configure GPS UART
-    gpio_set_function(PIN_GPS_TX, GPIO_FUNC_UART);
-    gpio_set_function(PIN_GPS_RX, GPIO_FUNC_UART);
-
-    uart_init(GPS_UART, GPS_UART_INITIAL_BAUD);
-    uart_set_translate_crlf(GPS_UART, 0);
+    hal_uart_init(GPS_UART_INITIAL_BAUD);
 
-    sleep_ms(50);
+    hal_sleep_ms(50);
     configure_mtk();
     configure_ubx();
 
     //Only if 9600 baud, that way we don't need to coldstart every time.
-    uart_write_blocking(GPS_UART, (uint8_t *) MT_SET_SPEED_ALT, strlen(MT_SET_SPEED_ALT));
-    uart_tx_wait_blocking(GPS_UART);
-    uart_write_blocking(GPS_UART, (uint8_t *) MT_FULL_COLD_START, strlen(MT_FULL_COLD_START));
-    uart_tx_wait_blocking(GPS_UART);
+    hal_uart_write((const uint8_t *) MT_SET_SPEED_ALT, strlen(MT_SET_SPEED_ALT));
+    hal_uart_write((const uint8_t *) MT_FULL_COLD_START, strlen(MT_FULL_COLD_START));
 
-    uart_set_baudrate(GPS_UART, GPS_UART_BAUD);
-    sleep_ms(50);
+    hal_uart_set_baud(GPS_UART_BAUD);
+    hal_sleep_ms(50);
     configure_mtk();
     configure_ubx();
 
-    
-#ifdef FAMILY_ESP32
-    
-    pinMode(PIN_PPS, INPUT);
-    attachInterrupt(PIN_PPS, _pps_isr, RISING);
-#endif
-#ifdef FAMILY_RP2040
-    gpio_set_dir(PIN_PPS, false);
-    gpio_set_irq_enabled_with_callback(PIN_PPS, GPIO_IRQ_EDGE_RISE, true, _pps_isr);
-    //irq_set_exclusive_handler(IO_IRQ_BANK0, _pps_isr);
-    //gpio_set_irq_enabled(PIN_PPS, GPIO_IRQ_EDGE_RISE, true);
-    //irq_set_enabled(IO_IRQ_BANK0, true); 
-#endif
+    hal_pps_attach(_pps_isr);
 }
+
+// Discard whatever the receiver echoed back to a configuration command
+static void uart_drain()
+{
+    uint8_t discard[32];
+    while(hal_uart_read(discard, sizeof(discard)))
+        ;
+}
+
 void GPS::configure_mtk(){
-    uart_write_blocking(GPS_UART, mt_set_timing_product, strlen(MT_SET_TIMING_PRODUCT));
-    uart_tx_wait_blocking(GPS_UART);
-    while(uart_is_readable(GPS_UART))
-        uart_getc(GPS_UART);
-
-    uart_write_blocking(GPS_UART, mt_set_pps_nmea, strlen(MT_SET_PPS_NMEA));
-    uart_tx_wait_blocking(GPS_UART);
-    while(uart_is_readable(GPS_UART))
-        uart_getc(GPS_UART);
-
-    uart_write_blocking(GPS_UART, mt_set_speed, strlen(MT_SET_SPEED));
-    uart_tx_wait_blocking(GPS_UART);
-    while(uart_is_readable(GPS_UART))
-        uart_getc(GPS_UART);
+    hal_uart_write(mt_set_timing_product, strlen(MT_SET_TIMING_PRODUCT));
+    uart_drain();
+
+    hal_uart_write(mt_set_pps_nmea, strlen(MT_SET_PPS_NMEA));
+    uart_drain();
+
+    hal_uart_write(mt_set_speed, strlen(MT_SET_SPEED));
+    uart_drain();
 }
 
 void GPS::configure_ubx(){
-    uart_write_blocking(GPS_UART, (uint8_t *) UBX_SET_SPEED, strlen(UBX_SET_SPEED));
-    uart_tx_wait_blocking(GPS_UART);
-    while(uart_is_readable(GPS_UART))
-        uart_getc(GPS_UART);
-
+    hal_uart_write((const uint8_t *) UBX_SET_SPEED, strlen(UBX_SET_SPEED));
+    uart_drain();
+
+#ifdef GPS_UBX_TIMING
+    // CFG-MSG on the port it arrives on: class, id, one per navigation solution
+    static const uint8_t timing_msgs[][3] = {
+        { UBX_CLASS_NAV, UBX_NAV_TIMEUTC, 1 },
+        { UBX_CLASS_TIM, UBX_TIM_TP,      1 },
+    };
+    for (const uint8_t* msg : timing_msgs){
+        uint8_t frame[3 + UBX_FRAME_OVERHEAD];
+        size_t  len = ubx_frame(frame, sizeof(frame), UBX_CLASS_CFG, UBX_CFG_MSG, msg, 3);
+        hal_uart_write(frame, len);
+        uart_drain();
+    }
+#endif
 }
 
 void GPS::end()
 {
-#ifdef FAMILY_ESP32
-    detachInterrupt(PIN_PPS);
-#endif
-#ifdef FAMILY_RP2040
-    //irq_remove_handler(PIN_PPS, _pps_isr);
-    //gpio_set_irq_enabled(PIN_PPS, GPIO_IRQ_EDGE_RISE, false);
-    //irq_set_enabled(IO_IRQ_BANK0, false);
-#endif
+    hal_pps_detach();
     _pps = nullptr;
 }
 
@@ -152,67 +161,130 @@ char* GPS::time_to_str(const struct tm *t){
         t->tm_hour,
         t->tm_min, 
         t->tm_sec,
-        (time_us_64()-_pps_timestamp_us)
+        (hal_time_us_64()-_state.pps_timestamp_ns/1000)
     );
 
     return result;
 
 }
 
+bool GPS::isValid()
+{
+    TimeState state;
+    _time_state.read(&state);
+    return state.valid != 0;
+}
+
+// True nanoseconds since the latest PPS edge: local elapsed time scaled by
+// the servo's frequency correction, so the oscillator's error doesn't
+// accumulate between edges.  Past ~18 minutes (long holdover) the product
+// would overflow, so it drops 16 bits of the elapsed time first.
+static inline int64_t ns_since_pps(const TimeState* state, uint64_t timestamp_ns)
+{
+    int64_t elapsed = (int64_t)(timestamp_ns - state->pps_timestamp_ns);
+    if (elapsed < (1LL << 40) && elapsed > -(1LL << 40))
+        return elapsed + ((elapsed * state->freq_corr_q32) >> 32);
+    return elapsed + (((elapsed >> 16) * state->freq_corr_q32) >> 16);
+}
+
+static inline int64_t us_since_pps(const TimeState* state, uint64_t timestamp_us)
+{
+    return ns_since_pps(state, timestamp_us * 1000) / 1000;
+}
+
 bool GPS::getTime(struct timeval* tv){
-    uint64_t cur_micros  = time_us_64();
+    TimeState state;
+    // Snapshot first: a PPS edge landing after the snapshot only makes the
+    // elapsed time below longer than a second, never negative.
+    _time_state.read(&state);
+    uint64_t cur_micros  = hal_time_us_64();
 
-    if(!_valid)
+    if(!state.valid)
         return false;
 
-    tv->tv_sec  = mktime(&_nmea_timestamp);
-    tv->tv_usec = (uint32_t)(cur_micros - _pps_timestamp_us);
-    
-    //If the pps timestamp is newer than the nmea timestamp the pps pulse has so we are 1 second later 
-    
-    if(_pps_timestamp_us > _nmea_timestamp_us){
-        //moved to pps isr
-        //tv->tv_sec += 1;
+    // pps_seconds labels the second that began at the latest PPS edge, so
+    // extrapolate from there (normally less than a second).
+    int64_t us_since_pps_lock = us_since_pps(&state, cur_micros);
+    if (us_since_pps_lock < 0)
+        us_since_pps_lock = 0;
+    uint64_t seconds_since_pps_lock = us_since_pps_lock / US_PER_SEC;
+
+    tv->tv_sec  = state.pps_seconds + seconds_since_pps_lock;
+    tv->tv_usec = us_since_pps_lock - (seconds_since_pps_lock*US_PER_SEC);
+
+    return true;
+}
+
+// Hot path for NTP: no mktime(), no division and no floating point unless
+// timestamp_ns is more than a second away from the latest PPS edge (a missed
+// edge, or a frame stamped just before the edge it is now processed after).
+// The frequency correction costs one 64-bit multiply.
+// Always fills in time, returns false if it is not backed by valid GPS data.
+bool __time_critical_func(GPS::toNTPTime)(uint64_t timestamp_ns, NTPTime* time)
+{
+    TimeState state;
+    _time_state.read(&state);
+    int64_t elapsed_ns = ns_since_pps(&state, timestamp_ns);
+
+    if (elapsed_ns >= 0 && elapsed_ns < NS_PER_SEC){
+        time->seconds  = state.pps_ntp_seconds;
+        time->fraction = ns_to_ntp_fraction((uint32_t)elapsed_ns);
     }else{
-        uint64_t us_since_nmea_lock = cur_micros-_nmea_timestamp_us;
-        uint64_t seconds_since_nmea_lock = us_since_nmea_lock / US_PER_SEC;
-
-        uint64_t us_since_pps_lock = cur_micros-_pps_timestamp_us;
-        uint64_t seconds_since_pps_lock = us_since_pps_lock / US_PER_SEC;
-        uint64_t us_remainder_since_pps_lock = us_since_pps_lock - (seconds_since_pps_lock*US_PER_SEC);
-    
-    
-        tv->tv_sec += seconds_since_nmea_lock;
-        // and since the second happens precisely every second, the latest remainder should be the most accurate info we have?
-        tv->tv_usec = us_remainder_since_pps_lock;
+        int64_t seconds_since_pps = elapsed_ns / NS_PER_SEC;
+        int64_t ns_remainder      = elapsed_ns - seconds_since_pps*NS_PER_SEC;
+        if (ns_remainder < 0){
+            ns_remainder += NS_PER_SEC;
+            seconds_since_pps -= 1;
+        }
+        time->seconds  = state.pps_ntp_seconds + (uint32_t)seconds_since_pps;
+        time->fraction = ns_to_ntp_fraction((uint32_t)ns_remainder);
     }
 
-    //printf("getTime DBG: %lu %lu %lu %lu\n", tv->tv_sec, tv->tv_usec);
-    // if micros_delta is at or bigger than one second then use the max just under 1 second.
-    // TODO: does this make sense?
-    if (tv->tv_usec >= US_PER_SEC || tv->tv_usec < 0){
-        printf("[WARNING] GPS::getTime() tv_usec too large/small?\n");
-        tv->tv_usec = 999999;
-    }
+    return state.valid != 0;
+}
 
-    return true;
+bool __time_critical_func(GPS::getNTPTime)(NTPTime* time)
+{
+    return toNTPTime(hal_time_ns_64(), time);
 }
 
-double GPS::getDispersion()
+// Root dispersion while locked, NTP short format: the largest and the RMS
+// phase error over the PPS window (edge timing and servo residual) plus the
+// 1 us timer resolution.  Until a first interval has been measured the
+// oscillator could be anything up to SERVO_MAX_PPM off.
+uint32_t __time_critical_func(GPS::lockedDispersion)()
 {
-    return us2s(MAX(MICROS_PER_SEC-_max_micros, MICROS_PER_SEC-_min_micros));
+    uint32_t dispersion_ns = _pps_stats.maxAbsNs() + _pps_stats.jitterNs() + 1000;
+    if (!_servo.seeded())
+        dispersion_ns += SERVO_MAX_PPM * 1000;
+    return us_to_ntp_short((dispersion_ns + 999) / 1000);
 }
 
 void GPS::process()
 {
-    uint64_t process_time = time_us_64();
-
-    if (_valid && process_time-_pps_timestamp_us > (PPS_VALID_TIME_MS*US_PER_MS)){
-        //invalidate("PPS timeout!");
+    // the PPS ISR writes the edge time, read it with the ISR out
+    uint32_t irq_state = hal_irq_save();
+    uint64_t process_time = hal_time_us_64();
+    uint64_t pps_raw_us   = _pps_raw_us;
+    hal_irq_restore(irq_state);
+
+    if (_sync_state == GPS_SYNC_LOCKED){
+        const char* reason = NULL;
+        if (process_time-pps_raw_us > (PPS_VALID_TIME_MS*US_PER_MS))
+            reason = "PPS timeout!";
+        else if (process_time-_state.nmea_timestamp_us > (NMEA_VALID_TIME_MS*US_PER_MS) && !fixCurrent(process_time))
+            reason = "NMEA timeout!";
+
+        if (reason){
+            if (_servo.locked())
+                enterHoldover(process_time, reason);
+            else
+                invalidate(reason);
+        }
     }
 
-    if (_valid && process_time-_nmea_timestamp_us > (NMEA_VALID_TIME_MS*US_PER_MS)){
-        //invalidate("NMEA timeout!");
+    if (_sync_state == GPS_SYNC_HOLDOVER && process_time >= _holdover_next_update_us){
+        updateHoldover(process_time);
     }
 
     if (_reason[0] != '\0')
@@ -221,56 +293,154 @@ void GPS::process()
         _reason[0] = '\0';
     }
 
+    if (_ubx_holdover_ended){
+        _ubx_holdover_ended = false;
+        printf("[INFO] GPS: holdover ended after %" PRIu64 " s\n", (process_time-_holdover_start_us)/US_PER_SEC);
+    }
+
 
-    while (uart_is_readable(_uart))
+    // everything the DMA ring has collected since the last pass
+    uint8_t chunk[64];
+    size_t  n;
+    while ((n = hal_uart_read(chunk, sizeof(chunk))) > 0)
     {
-    	 _buf[_buf_idx] = uart_getc(_uart);
-        if( _buf_idx > 1 && _buf[_buf_idx] == (char) '\n'){
-            break;
+        for (size_t i = 0; i < n; ++i)
+        {
+#ifdef GPS_UBX_TIMING
+            // UBX frames share the stream; their bytes are kept from the NMEA framer
+            const uint8_t* payload = _ubx.push(chunk[i]);
+            if (payload){
+                handleUbx(payload);
+                continue;
+            }
+            if (_ubx.inFrame())
+                continue;
+#endif
+            const char* sentence = _framer.push(chunk[i]);
+            if (sentence)
+                handleSentence(sentence, _framer.length());
         }
-        _buf_idx++;
     }
-    
-    if(_buf_idx > 1 && _buf[_buf_idx] == (char) '\n'){
-        //We have a full NMEA sentence to parse.
-
-        switch (minmea_sentence_id(_buf, false)) {
-            case MINMEA_SENTENCE_RMC: {
-                struct minmea_sentence_rmc frame;
-                if (minmea_parse_rmc(&frame, _buf)) {
-                    if(frame.valid){
-                        minmea_getdatetime(&_nmea_timestamp, &frame.date, &frame.time);
-                        _nmea_timestamp_us = time_us_64();
-
-                        _valid = true;
-
-                        printf("VALID | %s | PPS (%" PRIu64 " uS), PPStoNMEA (%" PRIu64 " uS)\n", time_to_str(&_nmea_timestamp), (_pps_timestamp_us-_pps_timestamp_us_prev), (_nmea_timestamp_us-_pps_timestamp_us));
-                    }
-                }
-            } break;
-
-            case MINMEA_SENTENCE_GGA: {
-                struct minmea_sentence_gga frame;
-                if (minmea_parse_gga(&frame, _buf)) {
-                    //printf("$GGA: fix quality: %d\n", frame.fix_quality);
-                }
-            } break;
-
-            case MINMEA_SENTENCE_GSV: {
-                struct minmea_sentence_gsv frame;
-                if (minmea_parse_gsv(&frame, _buf)) {
-                    //TODO: store satellite data somewhere so it can be plotted and we can confirm we are using enough
-                }
-            } break;
-        }
+}
+
+// One complete, checksum-verified NMEA sentence from the framer
+void GPS::handleSentence(const char* sentence, size_t len)
+{
+#ifdef GPS_TRACE
+    gps_trace_nmea(hal_time_us_64(), sentence, len);
+#endif
+
+    NmeaTime fix;
+    int      type = nmea_parse_time(sentence, len, &fix);
+    // RMC and GGA say whether there is a fix, for TIM-TP
+    if ((type == NMEA_TIME_RMC || type == NMEA_TIME_GGA) && fix.valid)
+        _fix_us = hal_time_us_64();
+    else if (type == NMEA_TIME_RMC || type == NMEA_TIME_GGA)
+        _fix_lost_us = hal_time_us_64();
+
+    switch (type) {
+        case NMEA_TIME_RMC:
+            // nothing to label until the first PPS edge
+            if (fix.valid && _state.pps_timestamp_ns != 0){
+                _last_rmc_us = hal_time_us_64();
+                labelEdge(fix.utc_seconds);
+            }
+            break;
+
+        case NMEA_TIME_ZDA:
+            // ZDA has no status field: use it only with a fix, and only when no RMC is coming
+            if (fix.valid && _fix_quality > 0 && _state.pps_timestamp_ns != 0 &&
+                hal_time_us_64() - _last_rmc_us > (NMEA_VALID_TIME_MS*US_PER_MS))
+                labelEdge(fix.utc_seconds);
+            break;
+
+        case NMEA_TIME_GGA:
+            _fix_quality = fix.fix_quality;
+            break;
+    }
 
 #ifdef NMEA_DEBUG
-        printf("NMEA_DEBUG: %s", _buf);
+    printf("NMEA_DEBUG: %s", sentence);
 #endif
-        //TODO: store last x epochs of NMEA strings?
-        memset(&_buf, 0x0, sizeof(_buf));
-        _buf_idx = 0;
+}
+
+// A valid RMC (or ZDA) names the UTC second the latest PPS edge started
+void GPS::labelEdge(time_t seconds)
+{
+    // The PPS ISR also writes _state, keep it out until this update is published.
+    uint32_t irq_state = hal_irq_save();
+    _state.nmea_timestamp_us = hal_time_us_64();
+    // The RMC labels the edge its second started on; if that
+    // edge went missing the latest edge is whole seconds older.
+    int64_t edge_age_us = us_since_pps(&_state, _state.nmea_timestamp_us);
+    if (edge_age_us >= US_PER_SEC)
+        seconds -= edge_age_us / US_PER_SEC;
+    // While serving, the edge count is trusted over a single RMC
+    // that disagrees with it (late, or from a receiver glitch).
+    if (_state.valid && seconds != _state.pps_seconds && ++_label_mismatches < NMEA_RELABEL_COUNT){
+        hal_irq_restore(irq_state);
+        printf("[WARNING] GPS: RMC labels the latest edge %" PRId64 " s off, ignored\n", (int64_t)seconds - _state.pps_seconds);
+        return;
     }
+    _label_mismatches = 0;
+    _state.pps_seconds       = seconds;
+    _state.pps_ntp_seconds   = toNTP(seconds);
+    // with the PPS gone this only relabels; holdover ends when both are back
+    bool was_holdover = _sync_state == GPS_SYNC_HOLDOVER;
+    if (_state.nmea_timestamp_us-_pps_raw_us <= (PPS_VALID_TIME_MS*US_PER_MS))
+        lock();
+    publish();
+    hal_irq_restore(irq_state);
+
+    if (was_holdover && _sync_state == GPS_SYNC_LOCKED)
+        printf("[INFO] GPS: holdover ended after %" PRIu64 " s\n", (_state.nmea_timestamp_us-_holdover_start_us)/US_PER_SEC);
+
+    gmtime_r(&seconds, &_nmea_timestamp);
+    printf("VALID | %s | PPS (%" PRIu64 " uS), PPStoNMEA (%" PRIu64 " uS)\n", time_to_str(&_nmea_timestamp), (_state.pps_timestamp_ns-_state.pps_timestamp_ns_prev)/1000, _state.nmea_timestamp_us-_state.pps_timestamp_ns/1000);
+}
+
+// One complete, checksum-verified UBX frame
+void GPS::handleUbx(const uint8_t* payload)
+{
+#ifdef GPS_TRACE
+    gps_trace_ubx(hal_time_us_64(), _ubx.msgClass(), _ubx.msgId(), payload, _ubx.length());
+#endif
+
+    if (_ubx.msgClass() == UBX_CLASS_NAV && _ubx.msgId() == UBX_NAV_TIMEUTC){
+        UbxNavTimeUtc utc;
+        if (ubx_decode_nav_timeutc(payload, _ubx.length(), &utc) && (utc.valid & UBX_TIMEUTC_VALID_UTC)){
+            _leap_seconds = ubx_leap_seconds(&utc);
+            _leap_known   = true;
+            if ((utc.valid & UBX_TIMEUTC_VALID_ALL) == UBX_TIMEUTC_VALID_ALL)
+                _fix_us = hal_time_us_64();
+        }
+    }else if (_ubx.msgClass() == UBX_CLASS_TIM && _ubx.msgId() == UBX_TIM_TP){
+        UbxTimTp tp;
+        if (!ubx_decode_tim_tp(payload, _ubx.length(), &tp) || tp.tow_ms % MS_PER_SEC != 0)
+            return;
+        // UTC needs the leap seconds: from the receiver, or from NAV-TIMEUTC for a GPS aligned pulse
+        if (!((tp.flags & UBX_TP_TIMEBASE_UTC) ? (tp.flags & UBX_TP_UTC_AVAILABLE) : _leap_known))
+            return;
+
+        uint64_t now_us    = hal_time_us_64();
+        bool     fix       = fixCurrent(now_us);
+        uint32_t irq_state = hal_irq_save();
+        _tp_seconds     = ubx_tim_tp_seconds(&tp, _leap_seconds);
+        _tp_qerr_ps     = (tp.flags & UBX_TP_QERR_INVALID) ? 0 : tp.qerr_ps;
+        _tp_received_us = now_us;
+        _tp_fix         = fix;
+        _tp_pending     = true;
+        hal_irq_restore(irq_state);
+    }
+}
+
+// Whether the receiver has a fix: it said so within NMEA_VALID_TIME_MS and
+// hasn't said otherwise since.  TIM-TP keeps coming, and keeps saying UTC is
+// available, when the receiver has lost its fix and runs on its own clock.
+bool GPS::fixCurrent(uint64_t now_us)
+{
+    return _fix_us != 0 && now_us - _fix_us <= (NMEA_VALID_TIME_MS*US_PER_MS) &&
+           (_fix_lost_us == 0 || now_us - _fix_lost_us > (NMEA_VALID_TIME_MS*US_PER_MS));
 }
 
 // Mark as not valid
@@ -285,29 +455,127 @@ void __time_critical_func(GPS::invalidate)(const char* fmt, ...)
         _reason[REASON_SIZE-1] = '\0';
         va_end(ap);
     }
+    uint32_t irq_state = hal_irq_save();
     _valid       = false;
     _last_micros = 0;
+    _sync_state  = GPS_SYNC_NONE;
+    _state.valid = 0;
+    _state.sync_state = GPS_SYNC_NONE;
+    _state.leap       = LI_NOSYNC;
+    _state.stratum    = STRATUM_UNSYNC;
+    publish();
+    hal_irq_restore(irq_state);
 }
 
-// Interrupt handler for a PPS (Pulse Per Second) signal from GPS module.
-void __time_critical_func(GPS::pps)(){
-    uint64_t _ts_us = time_us_64();
-    uint32_t cur_micros = time_us_32();
+// PPS and NMEA are both current: serve as a primary reference.  Called with
+// the PPS ISR masked, the caller publishes.
+void GPS::lock()
+{
+    _valid       = true;
+    _sync_state  = GPS_SYNC_LOCKED;
+    _state.valid = 1;
+    _state.sync_state      = GPS_SYNC_LOCKED;
+    _state.leap            = LI_NONE;
+    _state.stratum         = 1;
+    _state.root_dispersion = lockedDispersion();
+}
 
-    _pps_timestamp_us_prev = _pps_timestamp_us;
-    _pps_timestamp_us = _ts_us;
-    uint64_t us_elapsed = _ts_us-_pps_timestamp_us_prev;
+// Lost PPS or NMEA with a trained servo: keep serving from its frequency
+// estimate, with an error bound that grows from here.
+void GPS::enterHoldover(uint64_t now_us, const char* reason)
+{
+    printf("[WARNING] GPS: %s entering holdover at %ld ppb\n", reason, (long)_servo.freqOffsetPPB());
+
+    _holdover_start_us   = now_us;
+    _holdover_initial_us = (_pps_stats.maxAbsNs() + _pps_stats.jitterNs() + 999) / 1000 + 1; // as lockedDispersion()
+    _sync_state          = GPS_SYNC_HOLDOVER;
+    updateHoldover(now_us);
+}
 
-    _nmea_timestamp.tm_sec += 1;
+// Republish the holdover error estimate: the error at entry plus the
+// oscillator's stability times the time spent in holdover.  Each decade of
+// error past 1 us costs a stratum, and past HOLDOVER_MAX_ERROR_US the time
+// is served as unsynchronized.
+void GPS::updateHoldover(uint64_t now_us)
+{
+    uint64_t elapsed_us = now_us - _holdover_start_us;
+    int32_t  wander_ppb = _servo.wanderPPB();
+    uint64_t stability_ppb = std::max((int32_t)HOLDOVER_MIN_PPB, wander_ppb);
+    uint64_t error_us = _holdover_initial_us + elapsed_us * stability_ppb / 1000000000ULL;
+
+    uint8_t  stratum = 2;
+    for (uint64_t decade = 10; decade <= error_us && stratum < STRATUM_UNSYNC - 1; decade *= 10)
+        ++stratum;
+
+    _holdover_error_us = error_us > 0xffffffffULL ? 0xffffffffUL : (uint32_t)error_us;
+    _holdover_next_update_us = now_us + HOLDOVER_UPDATE_MS*US_PER_MS;
+
+    uint32_t irq_state = hal_irq_save();
+    _state.sync_state      = GPS_SYNC_HOLDOVER;
+    _state.root_dispersion = us_to_ntp_short(error_us);
+    if (error_us > HOLDOVER_MAX_ERROR_US){
+        _state.leap    = LI_NOSYNC;
+        _state.stratum = STRATUM_UNSYNC;
+    }else{
+        _state.leap    = LI_NONE;
+        _state.stratum = stratum;
+    }
+    publish();
+    hal_irq_restore(irq_state);
+}
 
-    if(us_elapsed > PPS_VALID_TIME_MS*US_PER_MS)
-        return;    
+// Make the current _state visible to readers on the other core.
+void __time_critical_func(GPS::publish)()
+{
+    _time_state.publish(&_state);
+}
 
-    if (_min_micros == 0 || us_elapsed < _min_micros)
-        _min_micros = us_elapsed;
+// Interrupt handler for a PPS (Pulse Per Second) signal from GPS module.
+void __time_critical_func(GPS::pps)(uint64_t edge_ns){
+    uint64_t _ts_us = edge_ns / 1000;
+#ifdef GPS_TRACE
+    gps_trace_pps(_ts_us);
+#endif
 
-    if (us_elapsed > _max_micros)
-        _max_micros = us_elapsed;
+    // An edge TIM-TP announced: the receiver said how far off its clock put
+    // it, take that out before the servo sees it.
+    bool announced = _tp_pending && _ts_us - _tp_received_us <= (UBX_TP_AHEAD_MS*US_PER_MS);
+    if (announced)
+        edge_ns -= (_tp_qerr_ps + (_tp_qerr_ps >= 0 ? 500 : -500)) / 1000;
+
+    uint32_t seconds = _servo.update(edge_ns);
+    if (!seconds)
+        return; // too soon after the last edge to be a second boundary
+
+    _state.pps_timestamp_ns_prev = _state.pps_timestamp_ns;
+    _state.pps_timestamp_ns = _servo.edgeNs();
+    _state.freq_corr_q32 = _servo.freqCorrQ32();
+    _state.pps_seconds += seconds;
+    _state.pps_ntp_seconds += seconds;
+
+    if (_servo.tracking())
+        _pps_stats.add(_servo.phaseErrorNs());
+    if (_sync_state == GPS_SYNC_LOCKED)
+        _state.root_dispersion = lockedDispersion();
+
+    // labelled as it happens, no waiting for the RMC, as long as the receiver
+    // has a fix; a disagreement with the edge count is treated as labelEdge()
+    // treats one
+    if (_tp_pending){
+        _tp_pending = false;
+        if (announced && _tp_fix &&
+            (!_state.valid || _tp_seconds == _state.pps_seconds || ++_label_mismatches >= NMEA_RELABEL_COUNT)){
+            _label_mismatches = 0;
+            _state.pps_seconds       = _tp_seconds;
+            _state.pps_ntp_seconds   = toNTP(_tp_seconds);
+            if (_sync_state == GPS_SYNC_HOLDOVER)
+                _ubx_holdover_ended = true;
+            lock();
+            ++_ubx_labels;
+        }
+    }
+    publish();
 
+    _pps_raw_us = _ts_us;
 }
 
@@ -22,24 +22,39 @@
 #ifndef GPS_H_
 #define GPS_H_
 
-#include <pico/stdlib.h>
-#include <pico/stdio.h>
-#include <pico/time.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <ctime>
 
-#include "minmea.h"
-
 #include "common.h"
+#include "hal.h"
+#include "time_state.h"
+#include "ntp_time.h"
+#include "clock_servo.h"
+#include "pps_stats.h"
+#include "nmea_framer.h"
+#include "nmea_time.h"
+#include "ubx.h"
 
 #define REASON_SIZE       128
-#define NMEA_BUFFER_SIZE  128
 
 #define PPS_VALID_TIME_MS       1001 // period from previous PPS pulse, if exceeded, timestamp no longer considered valid
 #define NMEA_VALID_TIME_MS      1100 // period from previous NMEA RMC, if exceeded, timestamp no longer considered valid
 
+#define NMEA_RELABEL_COUNT      3    // consecutive RMCs that must disagree with the edge count to relabel it
+#define UBX_TP_AHEAD_MS         1000 // a TIM-TP labels the first PPS edge within this of its arrival
+#define HOLDOVER_UPDATE_MS      1000 // how often the holdover error estimate is republished
+#define HOLDOVER_MIN_PPB        100  // stability assumed for the oscillator, at least, once PPS is gone
+
+// Where the served time comes from
+#define GPS_SYNC_NONE           0    // nothing to serve
+#define GPS_SYNC_LOCKED         1    // PPS and NMEA current
+#define GPS_SYNC_HOLDOVER       2    // PPS or NMEA lost, running on the servo's last frequency
+
 #define MICROS_PER_SEC          1000000
 #define US_PER_SEC              1000000
+#define NS_PER_SEC              1000000000LL
 #define US_PER_MS               1000
 #define MS_PER_SEC              1000
 
@@ -69,39 +84,79 @@ public:
     void     process();
     void     end();
 
-    bool     isValid()       { return _valid; }
-    uint32_t getJitter()     { return _max_micros - _min_micros; }
+    bool     isValid();
+    uint32_t getJitter()     { return _pps_stats.jitterNs(); }  // RMS PPS phase error over the window, ns
     uint32_t getValidCount() { return _valid_count; }
     time_t   getValidSince() { return _valid_since; }
     //uint8_t  getSatelliteCount() { return _nmea.getNumSatellites(); }
     bool     getTime(struct timeval* tv);
-    double   getDispersion();
+    bool     getNTPTime(NTPTime* time);
+    bool     toNTPTime(uint64_t timestamp_ns, NTPTime* time); // timestamp_ns from hal_time_ns_64()
+    uint32_t getState(TimeState* state) { return _time_state.read(state); }
+    uint32_t getStateSequence()         { return _time_state.sequence(); }
+    int32_t  getFrequencyPPB()  { return _servo.freqOffsetPPB(); } // local oscillator vs GPS, positive is fast
+    int32_t  getPhaseErrorNs()  { return _servo.phaseErrorNs(); }  // latest PPS edge vs the servo's prediction
+    bool     isServoLocked()    { return _servo.locked(); }
+    uint8_t  getSyncState()     { return _sync_state; }
+    uint32_t getHoldoverErrorUs() { return _holdover_error_us; } // estimated error bound in holdover
+    const NmeaFramer& getFramer() { return _framer; }              // sentence and error counts
+    const UbxParser&  getUbx()    { return _ubx; }                 // frame and error counts
+    uint32_t getUbxLabels()     { return _ubx_labels; }            // PPS edges labelled from TIM-TP
 
 private:
-    uart_inst_t*      _uart;
-    char              _buf[NMEA_BUFFER_SIZE];
     volatile uint32_t _valid_count;  // number of times we have gone valid
     volatile time_t   _valid_since;
-    volatile uint32_t _min_micros;
-    volatile uint32_t _max_micros;
     volatile uint32_t _last_micros;
     volatile uint32_t _timeouts;
-
-    volatile uint64_t _last_pps_us;
+    uint64_t          _pps_raw_us;   // hal_time_us_64() of the latest PPS edge as measured
 
     volatile bool     _valid;
     char              _reason[REASON_SIZE];
 
 
-    uint8_t           _buf_idx = 0;
+    NmeaFramer        _framer;
     struct tm         _nmea_timestamp;
-    volatile uint64_t          _nmea_timestamp_us;
-    volatile uint64_t          _pps_timestamp_us;
-    volatile uint64_t          _pps_timestamp_us_prev;
-
 
-    void pps();        // interrupt handler
+    TimeState         _state;       // core1 working copy, only touched by pps() and process()
+    TimeStateSeqlock  _time_state;  // published copy of _state, read from core0
+    ClockServo        _servo;       // PPS ISR only
+    PpsStats          _pps_stats;   // PPS ISR only
+
+    volatile uint8_t  _sync_state;
+    uint64_t          _holdover_start_us;
+    uint64_t          _holdover_next_update_us;
+    uint32_t          _holdover_initial_us;   // error bound when holdover started
+    volatile uint32_t _holdover_error_us;
+    uint32_t          _label_mismatches;      // consecutive RMCs disagreeing with the edge count
+    uint64_t          _last_rmc_us;           // valid RMCs win over ZDA
+    uint8_t           _fix_quality;           // from the latest GGA
+    uint64_t          _fix_us;                // latest valid RMC, GGA with a fix or fully valid NAV-TIMEUTC
+    uint64_t          _fix_lost_us;           // latest RMC or GGA saying there is no fix
+
+    UbxParser         _ubx;
+    int32_t           _leap_seconds;          // GPS - UTC, from NAV-TIMEUTC
+    bool              _leap_known;
+    // the next PPS edge as announced by TIM-TP, written by process() with the PPS ISR masked
+    volatile bool     _tp_pending;
+    bool              _tp_fix;                // the fix was current when it came: it may label
+    int64_t           _tp_seconds;
+    int32_t           _tp_qerr_ps;
+    uint64_t          _tp_received_us;
+    volatile uint32_t _ubx_labels;
+    volatile bool     _ubx_holdover_ended;    // for process() to report
+
+
+    void pps(uint64_t edge_ns);    // interrupt handler
+    void publish();
+    void handleSentence(const char* sentence, size_t len);
+    void labelEdge(time_t seconds);
+    void handleUbx(const uint8_t* payload);
     void invalidate(const char* fmt, ...);
+    void lock();
+    bool fixCurrent(uint64_t now_us);
+    uint32_t lockedDispersion();
+    void enterHoldover(uint64_t now_us, const char* reason);
+    void updateHoldover(uint64_t now_us);
     void configure_mtk();
     void configure_ubx();
     char* time_to_str(const struct tm *t);
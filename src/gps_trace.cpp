@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include "gps_trace.h"
+
+static_assert((GPS_TRACE_BUFFER_SIZE & (GPS_TRACE_BUFFER_SIZE - 1)) == 0, "GPS_TRACE_BUFFER_SIZE must be a power of two");
+
+static uint8_t           trace_buf[GPS_TRACE_BUFFER_SIZE];
+static volatile uint32_t trace_head = 0; // written by core1
+static volatile uint32_t trace_tail = 0; // written by core0
+static volatile uint32_t trace_dropped = 0;
+
+static inline void trace_put(uint32_t pos, uint8_t value)
+{
+    trace_buf[pos & (GPS_TRACE_BUFFER_SIZE - 1)] = value;
+}
+
+static inline uint8_t trace_get(uint32_t pos)
+{
+    return trace_buf[pos & (GPS_TRACE_BUFFER_SIZE - 1)];
+}
+
+// Writes one whole record or nothing.  The PPS ISR and GPS::process() both
+// record from core1, so the ISR is masked while a record is written.
+static void __time_critical_func(trace_write)(uint8_t type, uint64_t timestamp_us, const char* line, uint32_t len)
+{
+    uint32_t size = GPS_TRACE_HEADER_SIZE + (type != GPS_TRACE_PPS ? 1 + len : 0);
+    uint32_t irq_state = hal_irq_save();
+    uint32_t head = trace_head;
+
+    if (GPS_TRACE_BUFFER_SIZE - (head - trace_tail) < size)
+    {
+        ++trace_dropped;
+        hal_irq_restore(irq_state);
+        return;
+    }
+
+    uint32_t timestamp = (uint32_t)timestamp_us;
+    trace_put(head++, type);
+    trace_put(head++, (uint8_t)timestamp);
+    trace_put(head++, (uint8_t)(timestamp >> 8));
+    trace_put(head++, (uint8_t)(timestamp >> 16));
+    trace_put(head++, (uint8_t)(timestamp >> 24));
+    if (type != GPS_TRACE_PPS)
+    {
+        trace_put(head++, (uint8_t)len);
+        for (uint32_t i = 0; i < len; ++i)
+            trace_put(head++, (uint8_t)line[i]);
+    }
+
+    __sync_synchronize(); // record visible to core0 before it is published
+    trace_head = head;
+    hal_irq_restore(irq_state);
+}
+
+void __time_critical_func(gps_trace_pps)(uint64_t timestamp_us)
+{
+    trace_write(GPS_TRACE_PPS, timestamp_us, NULL, 0);
+}
+
+void gps_trace_nmea(uint64_t timestamp_us, const char* line, uint32_t len)
+{
+    // the trace keeps the line without its CR/LF
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        --len;
+    if (len > 255)
+        len = 255;
+    trace_write(GPS_TRACE_NMEA, timestamp_us, line, len);
+}
+
+void gps_trace_ubx(uint64_t timestamp_us, uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint32_t len)
+{
+    char record[255];
+    if (len > sizeof(record) - 2)
+        return;
+    record[0] = (char)msg_class;
+    record[1] = (char)msg_id;
+    memcpy(record + 2, payload, len);
+    trace_write(GPS_TRACE_UBX, timestamp_us, record, len + 2);
+}
+
+void gps_trace_drain(void)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[GPS_TRACE_RECORD_MAX * 2 + 1];
+
+    for (int i = 0; i < GPS_TRACE_DRAIN_BATCH && trace_tail != trace_head; ++i)
+    {
+        __sync_synchronize();
+        uint32_t tail = trace_tail;
+        uint32_t size = GPS_TRACE_HEADER_SIZE;
+        if (trace_get(tail) != GPS_TRACE_PPS)
+            size += 1 + trace_get(tail + GPS_TRACE_HEADER_SIZE);
+
+        for (uint32_t j = 0; j < size; ++j)
+        {
+            uint8_t value = trace_get(tail + j);
+            line[j * 2]     = hex[value >> 4];
+            line[j * 2 + 1] = hex[value & 0x0f];
+        }
+        line[size * 2] = '\0';
+
+        __sync_synchronize(); // done with the bytes before handing them back
+        trace_tail = tail + size;
+
+        printf("GPSTRACE %s\n", line);
+    }
+}
+
+uint32_t gps_trace_dropped(void)
+{
+    return trace_dropped;
+}
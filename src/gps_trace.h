@@ -0,0 +1,53 @@
+#ifndef GPS_TRACE_H_
+#define GPS_TRACE_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * GPS/PPS trace recorder (enable with GPS_TRACE in common.h).
+ *
+ * core1 records every PPS edge and every raw NMEA line with its
+ * hal_time_us_64() timestamp into a byte ring; core0 drains it from the main
+ * loop to stdio as "GPSTRACE <hex>" lines, one record per line.  The host
+ * replay tool (host/gps_replay) reads those lines back, or the binary file
+ * format below, and feeds them to the GPS code on a virtual clock.
+ *
+ * Record format, little endian:
+ *   uint8_t  type         GPS_TRACE_PPS, GPS_TRACE_NMEA or GPS_TRACE_UBX
+ *   uint32_t timestamp    low 32 bits of hal_time_us_64(), unwrapped on replay
+ *   GPS_TRACE_NMEA and GPS_TRACE_UBX only:
+ *   uint8_t  len          line length without the trailing CR/LF, or UBX
+ *                         payload length + 2
+ *   char     line[len]    the line, or UBX class, id and payload
+ *
+ * A binary trace file is GPS_TRACE_MAGIC followed by records back to back.
+ */
+
+#define GPS_TRACE_MAGIC         "GPST\x01"
+#define GPS_TRACE_MAGIC_SIZE    5
+
+#define GPS_TRACE_PPS           1
+#define GPS_TRACE_NMEA          2
+#define GPS_TRACE_UBX           3
+
+#define GPS_TRACE_HEADER_SIZE   5   // type + timestamp
+#define GPS_TRACE_RECORD_MAX    (GPS_TRACE_HEADER_SIZE + 1 + 255)
+
+// Bytes buffered between core1 and the drain, must be a power of two
+#ifndef GPS_TRACE_BUFFER_SIZE
+#define GPS_TRACE_BUFFER_SIZE   2048
+#endif
+// Records printed per gps_trace_drain() call
+#define GPS_TRACE_DRAIN_BATCH   2
+
+// core1: PPS ISR and GPS::process(), records that don't fit are dropped and counted
+void     gps_trace_pps(uint64_t timestamp_us);
+void     gps_trace_nmea(uint64_t timestamp_us, const char* line, uint32_t len);
+void     gps_trace_ubx(uint64_t timestamp_us, uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint32_t len);
+
+// core0
+void     gps_trace_drain(void);
+uint32_t gps_trace_dropped(void);
+
+#endif /* GPS_TRACE_H_ */
@@ -0,0 +1,81 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Hardware abstraction for the protocol, timekeeping and NMEA code (GPS, NTP
+ * and friends).  The firmware implements it on the pico SDK (hal_pico.cpp)
+ * and lwIP (net.cpp); the host build implements it on a simulated clock
+ * (host/hal_host.cpp) so the same code runs in unit tests and benchmarks.
+ */
+
+#ifdef NTP_HOST_BUILD
+#define __time_critical_func(func_name) func_name
+#define __isr
+#define __noinline __attribute__((noinline))
+#else
+#include "pico/platform.h"
+#endif
+
+// Monotonic clock: microseconds since boot
+uint64_t hal_time_us_64(void);
+// The same clock in nanoseconds, interpolated between microseconds with a
+// cycle counter where there is one (within a microsecond of hal_time_us_64())
+uint64_t hal_time_ns_64(void);
+// Smallest step hal_time_ns_64() takes
+uint32_t hal_time_resolution_ns(void);
+// Re-align the calling core's interpolation with the microsecond timer.
+// Spins for up to a microsecond; returns how far it had slipped, in ns.
+int32_t  hal_timebase_calibrate(void);
+// Core clock, for converting elapsed time to cycles
+uint32_t hal_sys_clock_hz(void);
+void     hal_sleep_ms(uint32_t ms);
+
+// Random bytes for keys and nonces: the ring oscillator and other entropy
+// via pico_rand on the firmware, a fixed-seed generator on the host
+void     hal_random(uint8_t* dst, size_t len);
+
+// Interrupt masking on the calling core, for updates shared with an ISR on that core
+uint32_t hal_irq_save(void);
+void     hal_irq_restore(uint32_t state);
+
+// GPS UART.  Received bytes are buffered in the background (DMA on the
+// pico); hal_uart_read() hands over what has arrived without waiting.
+void     hal_uart_init(uint32_t baud);
+void     hal_uart_set_baud(uint32_t baud);
+void     hal_uart_write(const uint8_t* src, size_t len); // returns once the bytes have been sent
+size_t   hal_uart_read(uint8_t* dst, size_t max);
+uint32_t hal_uart_overruns(void);   // bytes lost because the receive buffer filled
+
+// PPS input: handler runs in interrupt context after each rising edge, with
+// the edge time from hal_time_ns_64()'s timebase.  With PPS_PIO_CAPTURE the
+// edge is latched in hardware, so interrupt latency doesn't show up in it;
+// otherwise it is the time the interrupt ran.
+void     hal_pps_attach(void (*handler)(uint64_t edge_ns));
+void     hal_pps_detach(void);
+
+// Packet I/O: a UDP service on port.  The handler gets the request payload
+// in place (network byte order, not necessarily 4-byte aligned), the time it
+// arrived from the wire and the sender, rewrites it into the response and
+// returns the response length, or 0 to send nothing.  At most max_len bytes
+// may be written.
+typedef struct hal_peer
+{
+    uint32_t addr;  // IPv4, network byte order
+    uint16_t port;
+} HalPeer;
+
+typedef uint16_t (*hal_udp_handler)(void* arg, uint8_t* payload, uint16_t len, uint16_t max_len,
+                                    uint64_t arrival_ns, const HalPeer* peer);
+
+// Late-bound stamp: called as the response is handed to the wire with a
+// pointer to the 8 bytes at stamp_offset into its payload, and the payload's length.
+typedef void (*hal_late_stamp_fn)(void* arg, uint8_t* stamp, uint16_t len, const HalPeer* peer);
+
+bool     hal_udp_bind(uint16_t port, hal_udp_handler handler, void* arg,
+                      hal_late_stamp_fn late_stamp, uint16_t stamp_offset);
+
+#endif /* HAL_H_ */
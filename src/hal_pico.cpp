@@ -0,0 +1,327 @@
+#include <string.h>
+#include <pico/stdlib.h>
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/timer.h"
+#include "hardware/dma.h"
+#include "hardware/uart.h"
+#include "pico/rand.h"
+#include "hal.h"
+#include "common.h"
+#ifdef PPS_PIO_CAPTURE
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "pps_capture.h"
+#include "pps_capture.pio.h"
+#endif
+
+// pico SDK implementation of hal.h; packet I/O lives with the lwIP glue in net.cpp
+
+static void (*_pps_handler)(uint64_t edge_ns) = NULL;
+
+#ifdef PPS_PIO_CAPTURE
+#define PPS_PIO         pio0
+#define PPS_PIO_IRQ     PIO0_IRQ_0
+
+static int        _pps_sm = -1;
+static uint       _pps_offset;
+static PpsCapture _pps_capture;
+
+// Runs on the core that attached (core1) when the state machine has pushed a capture
+static __isr void __time_critical_func(_pps_isr)(void)
+{
+    while (!pio_sm_is_rx_fifo_empty(PPS_PIO, _pps_sm)){
+        uint32_t capture = pio_sm_get(PPS_PIO, _pps_sm);
+        uint64_t edge_ns;
+        if (_pps_capture.convert(capture, hal_time_ns_64(), &edge_ns) != PPS_CAPTURE_GLITCH && _pps_handler){
+            _pps_handler(edge_ns);
+        }
+    }
+    hal_timebase_calibrate();
+}
+#else
+static __isr void __time_critical_func(_pps_isr)(unsigned int gpio, long unsigned int mask)
+{
+    if (_pps_handler){
+        _pps_handler(hal_time_ns_64());
+    }
+    hal_timebase_calibrate();
+}
+#endif
+
+uint64_t __time_critical_func(hal_time_us_64)(void)
+{
+    return time_us_64();
+}
+
+// Sub-microsecond time from SysTick, which each core has its own copy of: a
+// 24-bit down counter at clk_sys.  Its reload is a whole number of
+// microseconds (_wrap_us, a power of two), so the cycles since an anchor
+// taken on a timer tick, modulo the reload, give both the microseconds
+// modulo _wrap_us and the phase within the current microsecond.  The 1 us
+// timer only has to say which wrap it is, so a read never straddles a tick.
+// Needs clk_sys to be a whole number of MHz (it is 250 MHz, from the crystal
+// or the 10 MHz reference, like the timer); otherwise it is plain microseconds.
+typedef struct timebase
+{
+    uint64_t anchor_us;     // timer value at the tick the anchor was taken on
+    uint32_t anchor_cycles; // SysTick at that tick
+    bool     ready;
+} Timebase;
+
+static Timebase _timebase[2];   // per core
+static uint32_t _cycles_per_us; // 0 if not a whole number
+static uint32_t _wrap_us;
+
+static uint64_t __time_critical_func(timebase_ns)(const Timebase* tb, uint64_t now_us, uint32_t now_cycles)
+{
+    uint32_t cycles = tb->anchor_cycles >= now_cycles ? tb->anchor_cycles - now_cycles
+                                                      : tb->anchor_cycles + _cycles_per_us * _wrap_us - now_cycles;
+    uint32_t fine_us = cycles / _cycles_per_us;
+    uint32_t phase   = cycles - fine_us * _cycles_per_us;
+
+    // the timer's microsecond and SysTick's agree to within a read or two,
+    // or an interrupt between them: far less than half a wrap
+    uint64_t coarse_us = now_us - tb->anchor_us;
+    int32_t  wraps_off = (int32_t)((uint32_t)(coarse_us - fine_us) & (_wrap_us - 1));
+    if (wraps_off >= (int32_t)(_wrap_us / 2))
+        wraps_off -= _wrap_us;
+
+    return (tb->anchor_us + coarse_us - wraps_off) * 1000 + phase * 1000 / _cycles_per_us;
+}
+
+uint64_t __time_critical_func(hal_time_ns_64)(void)
+{
+    const Timebase* tb = &_timebase[get_core_num()];
+    if (!tb->ready)
+        return time_us_64() * 1000;
+
+    // the anchor may be moved by an ISR on this core
+    uint32_t irq_state  = save_and_disable_interrupts();
+    uint64_t now_us     = time_us_64();
+    uint32_t now_cycles = systick_hw->cvr;
+    uint64_t now_ns     = timebase_ns(tb, now_us, now_cycles);
+    restore_interrupts(irq_state);
+    return now_ns;
+}
+
+uint32_t hal_time_resolution_ns(void)
+{
+    return _cycles_per_us ? (1000 + _cycles_per_us - 1) / _cycles_per_us : 1000;
+}
+
+int32_t __time_critical_func(hal_timebase_calibrate)(void)
+{
+    uint32_t hz = clock_get_hz(clk_sys);
+    if (hz % 1000000)
+        return 0;
+    _cycles_per_us = hz / 1000000;
+    _wrap_us = 1;
+    while (_cycles_per_us * _wrap_us * 2 <= M0PLUS_SYST_RVR_BITS + 1)
+        _wrap_us *= 2;
+
+    uint32_t reload = _cycles_per_us * _wrap_us - 1;
+    if (!(systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS) || systick_hw->rvr != reload){
+        systick_hw->csr = 0;
+        systick_hw->rvr = reload;
+        systick_hw->cvr = 0;
+        systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+        _timebase[get_core_num()].ready = false;
+    }
+
+    Timebase* tb        = &_timebase[get_core_num()];
+    uint32_t  irq_state = save_and_disable_interrupts();
+    uint32_t  tick      = timer_hw->timerawl;
+    while (timer_hw->timerawl == tick)
+        tight_loop_contents();
+    uint32_t  cycles    = systick_hw->cvr;
+    uint64_t  now_us    = time_us_64();
+    now_us -= (uint32_t)now_us - (tick + 1);    // the tick just seen
+
+    int32_t slip = 0;
+    if (tb->ready)
+        slip = (int32_t)(timebase_ns(tb, now_us, cycles) - now_us * 1000);
+    tb->anchor_us     = now_us;
+    tb->anchor_cycles = cycles;
+    tb->ready         = true;
+    restore_interrupts(irq_state);
+    return slip;
+}
+
+uint32_t hal_sys_clock_hz(void)
+{
+    return clock_get_hz(clk_sys);
+}
+
+void hal_sleep_ms(uint32_t ms)
+{
+    sleep_ms(ms);
+}
+
+void hal_random(uint8_t* dst, size_t len)
+{
+    while (len)
+    {
+        uint64_t value = get_rand_64();
+        size_t   n = len < sizeof(value) ? len : sizeof(value);
+        memcpy(dst, &value, n);
+        dst += n;
+        len -= n;
+    }
+}
+
+uint32_t __time_critical_func(hal_irq_save)(void)
+{
+    return save_and_disable_interrupts();
+}
+
+void __time_critical_func(hal_irq_restore)(uint32_t state)
+{
+    restore_interrupts(state);
+}
+
+// GPS UART receive: one DMA channel copies every byte from the UART into a
+// ring (the channel's address wrapping does the circular part), a second
+// channel re-arms it when its transfer count runs out (every 2^32 bytes), so
+// no byte depends on software keeping up, only on the ring not filling.
+#define UART_RX_RING_SIZE   (1u << GPS_UART_RX_RING_BITS)
+
+static uint8_t        _uart_rx_ring[UART_RX_RING_SIZE] __attribute__((aligned(UART_RX_RING_SIZE)));
+static const uint32_t _uart_rx_reload = 0xffffffff;
+static int            _uart_rx_dma = -1;
+static int            _uart_rx_rearm_dma = -1;
+static uint32_t       _uart_rx_tail;        // next ring index to hand out
+static uint32_t       _uart_rx_unread;      // bytes left in the ring by the last read
+static uint32_t       _uart_rx_written;     // bytes the channel had written at the last read
+static uint32_t       _uart_rx_overruns;
+
+void hal_uart_init(uint32_t baud)
+{
+    gpio_set_function(PIN_GPS_TX, GPIO_FUNC_UART);
+    gpio_set_function(PIN_GPS_RX, GPIO_FUNC_UART);
+
+    uart_init(GPS_UART, baud);
+    uart_set_translate_crlf(GPS_UART, 0);
+
+    if (_uart_rx_dma < 0){
+        _uart_rx_dma       = dma_claim_unused_channel(true);
+        _uart_rx_rearm_dma = dma_claim_unused_channel(true);
+    }
+    dma_channel_abort(_uart_rx_dma);
+
+    dma_channel_config c = dma_channel_get_default_config(_uart_rx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, GPS_UART_RX_RING_BITS);
+    channel_config_set_dreq(&c, uart_get_dreq(GPS_UART, false));
+    channel_config_set_chain_to(&c, _uart_rx_rearm_dma);
+    dma_channel_configure(_uart_rx_dma, &c, _uart_rx_ring, &uart_get_hw(GPS_UART)->dr, _uart_rx_reload, false);
+
+    dma_channel_config rearm = dma_channel_get_default_config(_uart_rx_rearm_dma);
+    channel_config_set_transfer_data_size(&rearm, DMA_SIZE_32);
+    channel_config_set_read_increment(&rearm, false);
+    channel_config_set_write_increment(&rearm, false);
+    dma_channel_configure(_uart_rx_rearm_dma, &rearm, &dma_hw->ch[_uart_rx_dma].al1_transfer_count_trig,
+                          &_uart_rx_reload, 1, false);
+
+    _uart_rx_tail     = 0;
+    _uart_rx_unread   = 0;
+    _uart_rx_written  = 0;
+    dma_channel_start(_uart_rx_dma);
+}
+
+void hal_uart_set_baud(uint32_t baud)
+{
+    uart_set_baudrate(GPS_UART, baud);
+}
+
+void hal_uart_write(const uint8_t* src, size_t len)
+{
+    uart_write_blocking(GPS_UART, src, len);
+    uart_tx_wait_blocking(GPS_UART);
+}
+
+size_t hal_uart_read(uint8_t* dst, size_t max)
+{
+    if (_uart_rx_dma < 0)
+        return 0;
+
+    uint32_t head    = (uint32_t)((uint8_t*)dma_channel_hw_addr(_uart_rx_dma)->write_addr - _uart_rx_ring);
+    // (one byte too many across a re-arm, every 4 days at 115200: harmless)
+    uint32_t written = _uart_rx_reload - dma_channel_hw_addr(_uart_rx_dma)->transfer_count;
+    uint32_t pending = _uart_rx_unread + (written - _uart_rx_written);
+    _uart_rx_written = written;
+
+    if (pending >= UART_RX_RING_SIZE){
+        // the channel has lapped the reader: what is left is not in order, drop it
+        _uart_rx_overruns += pending;
+        _uart_rx_tail   = head;
+        _uart_rx_unread = 0;
+        return 0;
+    }
+
+    pending = (head - _uart_rx_tail) & (UART_RX_RING_SIZE - 1);
+    size_t n = pending < max ? pending : max;
+    for (size_t i = 0; i < n; ++i){
+        dst[i] = _uart_rx_ring[_uart_rx_tail];
+        _uart_rx_tail = (_uart_rx_tail + 1) & (UART_RX_RING_SIZE - 1);
+    }
+    _uart_rx_unread = pending - n;
+    return n;
+}
+
+uint32_t hal_uart_overruns(void)
+{
+    return _uart_rx_overruns;
+}
+
+#ifdef PPS_PIO_CAPTURE
+void hal_pps_attach(void (*handler)(uint64_t edge_ns))
+{
+    _pps_handler = handler;
+
+    if (_pps_sm < 0){
+        _pps_sm     = pio_claim_unused_sm(PPS_PIO, true);
+        _pps_offset = pio_add_program(PPS_PIO, &pps_capture_program);
+    }
+    pio_sm_set_enabled(PPS_PIO, _pps_sm, false);
+    pps_capture_program_init(PPS_PIO, _pps_sm, _pps_offset, PIN_PPS);
+    pio_sm_clear_fifos(PPS_PIO, _pps_sm);
+
+    pio_set_irq0_source_enabled(PPS_PIO, (enum pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + _pps_sm), true);
+    irq_set_exclusive_handler(PPS_PIO_IRQ, _pps_isr);
+    irq_set_enabled(PPS_PIO_IRQ, true);
+
+    // The timer and the counter both run off the crystal, so this one pair
+    // places every capture.  The few cycles between the read and the enable
+    // are a constant offset.
+    uint32_t irq_state = save_and_disable_interrupts();
+    uint64_t start_ns  = hal_time_ns_64();
+    pio_sm_set_enabled(PPS_PIO, _pps_sm, true);
+    restore_interrupts(irq_state);
+    _pps_capture.start(start_ns, clock_get_hz(clk_sys) / 2);
+}
+
+void hal_pps_detach(void)
+{
+    irq_set_enabled(PPS_PIO_IRQ, false);
+    if (_pps_sm >= 0)
+        pio_sm_set_enabled(PPS_PIO, _pps_sm, false);
+    _pps_handler = NULL;
+}
+#else
+void hal_pps_attach(void (*handler)(uint64_t edge_ns))
+{
+    _pps_handler = handler;
+    gpio_set_dir(PIN_PPS, false);
+    gpio_set_irq_enabled_with_callback(PIN_PPS, GPIO_IRQ_EDGE_RISE, true, _pps_isr);
+}
+
+void hal_pps_detach(void)
+{
+    gpio_set_irq_enabled(PIN_PPS, GPIO_IRQ_EDGE_RISE, false);
+    _pps_handler = NULL;
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Fixed-bucket log2 histogram.  Bucket 0 counts zeros, bucket n counts
+ * values in [2^(n-1), 2^n); everything from 2^(BUCKETS-2) up lands in the
+ * last bucket.  Adding a sample is a count-leading-zeros and an increment,
+ * cheap enough for the packet path.
+ */
+class Log2Histogram
+{
+public:
+    static const int BUCKETS = 24; // with microsecond samples the last bucket starts at ~4.2 s
+
+    Log2Histogram()
+    {
+        reset();
+    }
+
+    void add(uint32_t value)
+    {
+        int bucket = value ? 32 - __builtin_clz(value) : 0;
+        if (bucket >= BUCKETS)
+            bucket = BUCKETS - 1;
+        ++_counts[bucket];
+        ++_total;
+        if (value > _max)
+            _max = value;
+    }
+
+    void reset()
+    {
+        memset(_counts, 0x0, sizeof(_counts));
+        _total = 0;
+        _max   = 0;
+    }
+
+    uint32_t count(int bucket) const { return _counts[bucket]; }
+    uint32_t total() const           { return _total; }
+    uint32_t max() const             { return _max; }
+
+    // One line: name, sample count, max, then "<upper bound>:<count>" per non-empty bucket.
+    void print(const char* name, const char* unit) const
+    {
+        printf("%s: n=%lu max=%lu%s", name, (unsigned long)_total, (unsigned long)_max, unit);
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            if (_counts[i])
+                printf(" <%lu:%lu", i ? (unsigned long)(1UL << i) : 1UL, (unsigned long)_counts[i]);
+        }
+        printf("\n");
+    }
+
+private:
+    uint32_t _counts[BUCKETS];
+    uint32_t _total;
+    uint32_t _max;
+};
+
+#endif /* HISTOGRAM_H_ */
@@ -0,0 +1,52 @@
+#include <string.h>
+#include "interleave.h"
+
+static const uint8_t zero[8] = { 0 };
+
+// The low bits of the fraction change with every request; fold in the rest
+// so two timestamps a second apart don't share a slot
+static inline uint32_t slot_of(const uint8_t* ts)
+{
+    uint32_t seconds  = ((uint32_t)ts[0] << 24) | ((uint32_t)ts[1] << 16) | ((uint32_t)ts[2] << 8) | ts[3];
+    uint32_t fraction = ((uint32_t)ts[4] << 24) | ((uint32_t)ts[5] << 16) | ((uint32_t)ts[6] << 8) | ts[7];
+    return ((seconds ^ fraction) * 2654435761u) >> (32 - NTP_INTERLEAVED_BITS);
+}
+
+InterleaveCache::InterleaveCache() :
+    _hits(0),
+    _misses(0)
+{
+    memset(_table, 0x0, sizeof(_table));
+}
+
+void __time_critical_func(InterleaveCache::save)(uint32_t addr, const uint8_t* rx, bool interleaved)
+{
+    Entry* entry = &_table[slot_of(rx)];
+    memcpy(entry->rx, rx, sizeof(entry->rx));
+    memset(entry->tx, 0x0, sizeof(entry->tx));
+    entry->addr        = addr;
+    entry->interleaved = interleaved;
+}
+
+bool __time_critical_func(InterleaveCache::departed)(uint32_t addr, const uint8_t* rx, const uint8_t* tx)
+{
+    Entry* entry = &_table[slot_of(rx)];
+    if (entry->addr != addr || memcmp(entry->rx, rx, sizeof(entry->rx)) != 0)
+        return false;
+    memcpy(entry->tx, tx, sizeof(entry->tx));
+    return entry->interleaved;
+}
+
+bool __time_critical_func(InterleaveCache::lookup)(uint32_t addr, const uint8_t* rx, uint8_t* tx) const
+{
+    const Entry* entry = &_table[slot_of(rx)];
+    if (entry->addr != addr || memcmp(entry->rx, rx, sizeof(entry->rx)) != 0 ||
+        memcmp(entry->tx, zero, sizeof(entry->tx)) == 0)
+    {
+        ++_misses;
+        return false;
+    }
+    memcpy(tx, entry->tx, sizeof(entry->tx));
+    ++_hits;
+    return true;
+}
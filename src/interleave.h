@@ -0,0 +1,60 @@
+#ifndef INTERLEAVE_H_
+#define INTERLEAVE_H_
+
+#include <stdint.h>
+#include "hal.h"
+#include "common.h"
+
+/*
+ * Departure times of recent responses, for NTPv4 interleaved mode as chrony
+ * implements it (client/server and symmetric).
+ *
+ * A transmit timestamp has to be in the packet before the packet leaves, so
+ * it is always a little early.  In interleaved mode a client echoes our
+ * receive timestamp of its previous request as the origin of the next one,
+ * and we answer with the departure time of the previous response, taken as
+ * it actually went out.
+ *
+ * Entries are found by that receive timestamp: one slot per hash, so save,
+ * departure and lookup are each one hash and one compare.  A slot is
+ * overwritten by the next response hashing to it; the client then gets a
+ * basic response, and carries on in basic mode until its next exchange.
+ * Timestamps are kept in network byte order, as they are in the packets.
+ */
+
+#define INTERLEAVE_SLOTS    (1u << NTP_INTERLEAVED_BITS)
+
+class InterleaveCache
+{
+public:
+    InterleaveCache();
+
+    // A response is being built: rx is its receive timestamp, interleaved
+    // whether its transmit field carries a previous departure.
+    void save(uint32_t addr, const uint8_t* rx, bool interleaved);
+    // The response to addr with receive timestamp rx is leaving at tx.
+    // Returns whether it is interleaved, i.e. its transmit field is to be
+    // left alone.
+    bool departed(uint32_t addr, const uint8_t* rx, const uint8_t* tx);
+    // Departure of the response that had receive timestamp rx, sent to addr
+    bool lookup(uint32_t addr, const uint8_t* rx, uint8_t* tx) const;
+
+    uint32_t hits() const       { return _hits; }
+    uint32_t misses() const     { return _misses; }
+
+private:
+    typedef struct entry
+    {
+        uint8_t  rx[8];
+        uint8_t  tx[8];         // all zero until it departed
+        uint32_t addr;
+        uint8_t  interleaved;
+        uint8_t  reserved[3];
+    } Entry;
+
+    Entry             _table[INTERLEAVE_SLOTS];
+    mutable uint32_t  _hits;
+    mutable uint32_t  _misses;
+};
+
+#endif /* INTERLEAVE_H_ */
@@ -0,0 +1,27 @@
+#include "hal.h"
+#include "latency.h"
+
+static Log2Histogram latency_hist[LATENCY_STAGES];
+
+static const char* const latency_names[LATENCY_STAGES] = {
+    "[INFO] latency rx queue",
+    "[INFO] latency stack   ",
+    "[INFO] latency build   ",
+    "[INFO] latency tx wait ",
+};
+
+void __time_critical_func(latency_add)(LatencyStage stage, uint64_t start_us, uint64_t end_us)
+{
+    latency_hist[stage].add((uint32_t)(end_us - start_us));
+}
+
+const Log2Histogram* latency_histogram(LatencyStage stage)
+{
+    return &latency_hist[stage];
+}
+
+void latency_print(void)
+{
+    for (int i = 0; i < LATENCY_STAGES; ++i)
+        latency_hist[i].print(latency_names[i], "us");
+}
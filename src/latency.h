@@ -0,0 +1,31 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+#include "histogram.h"
+
+/*
+ * Per-request latency through the RX-to-TX pipeline, one log2 histogram (in
+ * microseconds) per stage:
+ *
+ *   RX queue   frame arrival in tud_network_recv_cb() -> ethernet_input()
+ *   stack      ethernet_input() -> ntp_udp_recv_cb()
+ *   build      ntp_udp_recv_cb() -> udp_sendto()
+ *   TX wait    udp_sendto() -> copy into the USB buffer in tud_network_xmit_cb()
+ *
+ * Always compiled in; latency_print() dumps them at runtime.
+ */
+typedef enum latency_stage
+{
+    LATENCY_RX_QUEUE = 0,
+    LATENCY_STACK,
+    LATENCY_BUILD,
+    LATENCY_TX_WAIT,
+    LATENCY_STAGES
+} LatencyStage;
+
+void latency_add(LatencyStage stage, uint64_t start_us, uint64_t end_us);
+const Log2Histogram* latency_histogram(LatencyStage stage);
+void latency_print(void);
+
+#endif /* LATENCY_H_ */
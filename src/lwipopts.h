@@ -59,7 +59,7 @@
 
 #define LWIP_SINGLE_NETIF               1
 
-#define PBUF_POOL_SIZE                  2
+#define PBUF_POOL_SIZE                  8
 
 #define HTTPD_USE_CUSTOM_FSDATA         0
 
@@ -68,4 +68,11 @@
 #define LWIP_IPV6_MLD                   0
 #define LWIP_IPV6_SEND_ROUTER_SOLICIT   0
 
+/* NTS-KE (the NTS_KE build option) is TLS over altcp, on mbedtls */
+#ifdef NTS_KE
+#define LWIP_ALTCP                      1
+#define LWIP_ALTCP_TLS                  1
+#define LWIP_ALTCP_TLS_MBEDTLS          1
+#endif
+
 #endif /* __LWIPOPTS_H__ */
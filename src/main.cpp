@@ -8,6 +8,13 @@
 #include "net.h"
 #include "gps.h"
 #include "ntp.h"
+#include "event_log.h"
+#ifdef GPS_TRACE
+#include "gps_trace.h"
+#endif
+#ifdef NTS_KE
+#include "nts_ke_server.h"
+#endif
 
 #include "common.h"
 
@@ -28,10 +35,15 @@ NTP ntp(gps);
 #define LWIP_DEBUG 1
 
 void core1_entry(void){
+    // the PPS interrupt keeps core1's timebase calibrated from here on
+    hal_timebase_calibrate();
     gps.begin();
 
+    // the UART fills its DMA ring and the PPS is an interrupt, so there is
+    // nothing to poll for in between passes
     while(1){
         gps.process();
+        sleep_ms(GPS_PROCESS_INTERVAL_MS);
     }
 
 }
@@ -43,6 +55,7 @@ int main(void){
 #else
     set_sys_clock_khz(250000, true);
 #endif
+    hal_timebase_calibrate();
 
     // initialize TinyUSB
     board_init();
@@ -75,6 +88,10 @@ int main(void){
 
     // Start NTP Server
     ntp.begin();
+#ifdef NTS_KE
+    // Start NTS-KE, which hands out cookies for the NTP server's NTS
+    nts_ke_begin(&ntp._nts);
+#endif
 
     printf("IP address: %s\n", ip4addr_ntoa(netif_ip4_addr(&netif_data)));
     printf("main loop start!\n");
@@ -82,11 +99,39 @@ int main(void){
     multicore_reset_core1();
     multicore_launch_core1(core1_entry);
 
+    absolute_time_t next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+    uint32_t timebase_sequence = gps.getStateSequence();
+
     while (1){
         tud_task();
         service_traffic();
         tud_task();
         async_context_poll(&context.core);
+        event_log_drain();
+#ifdef NTS
+        ntp._nts.service(time_us_64());
+#endif
+
+        // re-align core0's sub-microsecond timebase whenever GPS publishes (each PPS)
+        if (gps.getStateSequence() != timebase_sequence){
+            timebase_sequence = gps.getStateSequence();
+            hal_timebase_calibrate();
+        }
+#ifdef GPS_TRACE
+        gps_trace_drain();
+#endif
+
+        if (time_reached(next_stats)){
+            ntp.printStats();
+            net_print_stats();
+#ifdef NTS_KE
+            nts_ke_print_stats();
+#endif
+#ifdef GPS_TRACE
+            printf("[INFO] GPS trace dropped:%lu\n", (unsigned long)gps_trace_dropped());
+#endif
+            next_stats = make_timeout_time_ms(STATS_INTERVAL_MS);
+        }
     }
 
     return 0;
@@ -0,0 +1,65 @@
+#ifndef MBEDTLS_CONFIG_H_
+#define MBEDTLS_CONFIG_H_
+
+/*
+ * mbedtls (3.6) for NTS-KE only, the NTS_KE build option: a TLS 1.3 server
+ * with the keying material exporter RFC 8915 takes its keys from and ALPN
+ * for "ntske/1".  One suite, TLS_AES_128_GCM_SHA256, and P-256 for the
+ * handshake and the certificate, which is what the M0+ manages in a second
+ * or so.
+ */
+
+// entropy from pico_rand, via pico_mbedtls' mbedtls_hardware_poll()
+#define MBEDTLS_ENTROPY_HARDWARE_ALT
+#define MBEDTLS_NO_PLATFORM_ENTROPY
+#define MBEDTLS_ENTROPY_C
+#define MBEDTLS_CTR_DRBG_C
+#define MBEDTLS_HAVE_TIME
+
+#define MBEDTLS_PLATFORM_C
+#define MBEDTLS_PLATFORM_MEMORY
+#define MBEDTLS_ERROR_C
+#define MBEDTLS_NO_UDBL_DIVISION
+
+// TLS 1.3 server; in 3.6 its crypto goes through PSA
+#define MBEDTLS_SSL_TLS_C
+#define MBEDTLS_SSL_SRV_C
+#define MBEDTLS_SSL_PROTO_TLS1_3
+#define MBEDTLS_SSL_TLS1_3_KEY_EXCHANGE_MODE_EPHEMERAL_ENABLED
+#define MBEDTLS_SSL_ALPN
+#define MBEDTLS_SSL_KEYING_MATERIAL_EXPORT
+#define MBEDTLS_SSL_SERVER_NAME_INDICATION
+#define MBEDTLS_PSA_CRYPTO_C
+#define MBEDTLS_USE_PSA_CRYPTO
+
+// a ClientHello fits, and the largest record the server sends is its certificate
+#define MBEDTLS_SSL_IN_CONTENT_LEN      4096
+#define MBEDTLS_SSL_OUT_CONTENT_LEN     2048
+
+#define MBEDTLS_AES_C
+#define MBEDTLS_AES_ROM_TABLES
+#define MBEDTLS_AES_FEWER_TABLES
+#define MBEDTLS_GCM_C
+#define MBEDTLS_CIPHER_C
+#define MBEDTLS_MD_C
+#define MBEDTLS_SHA256_C
+#define MBEDTLS_SHA224_C
+#define MBEDTLS_HKDF_C
+
+#define MBEDTLS_BIGNUM_C
+#define MBEDTLS_ECP_C
+#define MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#define MBEDTLS_ECP_NIST_OPTIM
+#define MBEDTLS_ECDH_C
+#define MBEDTLS_ECDSA_C
+#define MBEDTLS_ASN1_PARSE_C
+#define MBEDTLS_ASN1_WRITE_C
+#define MBEDTLS_OID_C
+#define MBEDTLS_PK_C
+#define MBEDTLS_PK_PARSE_C
+#define MBEDTLS_PEM_PARSE_C
+#define MBEDTLS_BASE64_C
+#define MBEDTLS_X509_USE_C
+#define MBEDTLS_X509_CRT_PARSE_C
+
+#endif /* MBEDTLS_CONFIG_H_ */
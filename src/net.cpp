@@ -44,14 +44,51 @@ try changing the first byte of tud_network_mac_address[] below from 0x02 to 0x00
 */
 
 #include "net.h"
+#include "frame_ring.h"
+#include "event_log.h"
+#include "latency.h"
 #include "netif/etharp.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/udp.h"
 #include "pico/unique_id.h"
 
 // lwip context
 struct netif netif_data;
 
-// shared between tud_network_recv_cb() and service_traffic()
-struct pbuf *received_frame = NULL;
+// shared between tud_network_recv_cb() (producer) and service_traffic() (consumer)
+static FrameRing<NET_RX_RING_SIZE, CFG_TUD_NET_MTU> rx_ring;
+
+// a UDP service registered with hal_udp_bind()
+typedef struct net_udp_service
+{
+  struct udp_pcb    *pcb;
+  hal_udp_handler   handler;
+  void              *arg;
+  hal_late_stamp_fn late_stamp;
+  uint16_t          stamp_offset;
+} NetUdpService;
+
+static NetUdpService udp_service;
+static uint32_t udp_tx_allocs = 0; // responses that could not reuse the request pbuf
+
+// arrival time of the frame being passed through ethernet_input()
+static uint64_t rx_current_timestamp_ns = 0;
+static uint64_t rx_current_dispatch_us = 0;
+
+// handoff times for PBUF_FLAG_TX_TIMED frames: the latest udp_sendto(),
+// and the one belonging to the frame tud_network_xmit_cb() is copying
+static uint64_t tx_handoff_us = 0;
+static uint64_t tx_current_handoff_us = 0;
+
+// frames accepted by linkoutput_fn() that TinyUSB could not take yet; each holds a pbuf reference
+static_assert((NET_TX_QUEUE_SIZE & (NET_TX_QUEUE_SIZE - 1)) == 0, "NET_TX_QUEUE_SIZE must be a power of two");
+static struct pbuf *tx_queue[NET_TX_QUEUE_SIZE];
+static uint64_t tx_queue_handoff_us[NET_TX_QUEUE_SIZE];
+static uint16_t tx_head = 0;
+static uint16_t tx_tail = 0;
+static uint16_t tx_high_water = 0;
+static uint32_t tx_drops = 0;
 
 // this is used by this code, ./class/net/net_driver.c, and usb_descriptors.c
 // ideally speaking, this should be generated from the hardware's unique ID (if available)
@@ -70,21 +107,59 @@ err_t linkoutput_fn(struct netif *netif, struct pbuf *p)
 {
   (void)netif;
 
-  for (;;)
+  /* if TinyUSB isn't ready, we must signal back to lwip that there is nothing we can do */
+  if (!tud_ready())
+    return ERR_USE;
+
+  /* nothing waiting ahead of this frame and the driver can take it: send it now */
+  uint16_t queued = tx_head - tx_tail;
+  if (!queued && tud_network_can_xmit(p->tot_len))
   {
-    /* if TinyUSB isn't ready, we must signal back to lwip that there is nothing we can do */
-    if (!tud_ready())
-      return ERR_USE;
+    tx_current_handoff_us = tx_handoff_us;
+    tud_network_xmit(p, 0 /* unused for this example */);
+    return ERR_OK;
+  }
 
-    /* if the network driver can accept another packet, we make it happen */
-    if (tud_network_can_xmit(p->tot_len))
-    {
-      tud_network_xmit(p, 0 /* unused for this example */);
-      return ERR_OK;
-    }
+  /* otherwise queue it for service_tx() rather than spinning on the endpoint; drop it if the queue is full */
+  if (queued >= NET_TX_QUEUE_SIZE)
+  {
+    ++tx_drops;
+    return ERR_MEM;
+  }
+
+  pbuf_ref(p);
+  tx_queue[tx_head & (NET_TX_QUEUE_SIZE - 1)] = p;
+  tx_queue_handoff_us[tx_head & (NET_TX_QUEUE_SIZE - 1)] = tx_handoff_us;
+  tx_head++;
+  if (queued + 1 > tx_high_water)
+    tx_high_water = queued + 1;
+
+  return ERR_OK;
+}
+
+// hand queued frames to TinyUSB as the IN endpoint frees up
+static void service_tx(void)
+{
+  while (tx_tail != tx_head)
+  {
+    struct pbuf *p = tx_queue[tx_tail & (NET_TX_QUEUE_SIZE - 1)];
 
-    /* transfer execution to TinyUSB in the hopes that it will finish transmitting the prior packet */
-    tud_task();
+    if (!tud_network_can_xmit(p->tot_len))
+      break;
+
+    tx_current_handoff_us = tx_queue_handoff_us[tx_tail & (NET_TX_QUEUE_SIZE - 1)];
+    tud_network_xmit(p, 0);
+    tx_tail++;
+    pbuf_free(p);
+  }
+}
+
+static void tx_queue_clear(void)
+{
+  while (tx_tail != tx_head)
+  {
+    pbuf_free(tx_queue[tx_tail & (NET_TX_QUEUE_SIZE - 1)]);
+    tx_tail++;
   }
 }
 
@@ -144,49 +219,190 @@ void init_lwip(void)
 
 bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
 {
-  // this shouldn't happen, but if we get another packet before 
-  //  parsing the previous, we must signal our inability to accept it 
-  if (received_frame) return false;
+  // stamp first, everything after this is queueing the NTP layer should not see
+  uint64_t timestamp_ns = hal_time_ns_64();
 
-  //printf("tud_network_recv_cb()");
-  if (size)
-  {
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+  if (!size) return false;
 
-    if (p)
-    {
-      // pbuf_alloc() has already initialized struct; all we need to do is copy the data
-      memcpy(p->payload, src, size);
+  // if the ring is full, signal our inability to accept the frame;
+  // TinyUSB drops it and re-arms the endpoint itself
+  if (!rx_ring.push(src, size, timestamp_ns)) return false;
 
-      // store away the pointer for service_traffic() to later handle 
-      received_frame = p;
-    }
+  // the frame has been copied out of TinyUSB's buffer, so it can take the next one right away
+  tud_network_recv_renew();
+  return true;
+}
+
+static inline uint16_t get16(const uint8_t *src)
+{
+  return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+// RFC 1624 incremental update of a one's complement checksum for 16-bit words changing from old to now
+static uint16_t checksum_adjust(uint16_t checksum, const uint8_t *old, const uint8_t *now, uint16_t len)
+{
+  uint32_t sum = (uint16_t)~checksum;
+  for (uint16_t i = 0; i < len; i += 2)
+  {
+    sum += (uint16_t)~get16(old + i);
+    sum += get16(now + i);
   }
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return (uint16_t)~sum;
+}
 
-  return true;
+// Fill in the late stamp of a flagged frame already copied to dst
+static void apply_late_stamp(uint8_t *dst, uint16_t len)
+{
+  // Ethernet II / IPv4 / UDP only, anything else goes out as built
+  if (len < SIZEOF_ETH_HDR + IP_HLEN || get16(dst + 12) != ETHTYPE_IP)
+    return;
+  uint8_t *ip = dst + SIZEOF_ETH_HDR;
+  uint16_t ip_hlen = (uint16_t)((ip[0] & 0x0f) * 4);
+  if (ip[9] != IP_PROTO_UDP || len < SIZEOF_ETH_HDR + ip_hlen + UDP_HLEN + udp_service.stamp_offset + 8)
+    return;
+
+  uint8_t *udp = ip + ip_hlen;
+  uint8_t *stamp = udp + UDP_HLEN + udp_service.stamp_offset;
+  HalPeer peer;
+  memcpy(&peer.addr, ip + 16, sizeof(peer.addr)); // destination address, already network order
+  peer.port = get16(udp + 2);
+
+  uint8_t old[8];
+  memcpy(old, stamp, sizeof(old));
+  udp_service.late_stamp(udp_service.arg, stamp, (uint16_t)(get16(udp + 4) - UDP_HLEN), &peer);
+
+  // a zero UDP checksum means none was computed; a computed zero is sent as 0xffff
+  uint16_t checksum = get16(udp + 6);
+  if (checksum)
+  {
+    checksum = checksum_adjust(checksum, old, stamp, sizeof(old));
+    if (!checksum)
+      checksum = 0xffff;
+    udp[6] = (uint8_t)(checksum >> 8);
+    udp[7] = (uint8_t)checksum;
+  }
 }
 
 uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
 {
   struct pbuf *p = (struct pbuf *)ref;
-  printf("tud_network_xmit_cb(%d) \n", p->tot_len);
+  event_log(EVT_NET_XMIT, p->tot_len);
   (void)arg; //unused
 
-  return pbuf_copy_partial(p, dst, p->tot_len, 0);
+  uint16_t len = pbuf_copy_partial(p, dst, p->tot_len, 0);
+
+  // as late as this device can write it: the frame goes straight from here to the IN endpoint
+  if ((p->flags & PBUF_FLAG_LATE_XMIT_STAMP) && udp_service.late_stamp)
+    apply_late_stamp(dst, len);
+
+  if (p->flags & PBUF_FLAG_TX_TIMED)
+    latency_add(LATENCY_TX_WAIT, tx_current_handoff_us, time_us_64());
+
+  return len;
 }
 
-void service_traffic(void)
+// lwIP side of hal_udp_bind(): hands the request payload to the service in
+// place and sends the same pbuf back as the response, so the request path
+// does no allocation and no copy.
+static void net_udp_recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
 {
-  // handle any packet received by tud_network_recv_cb()
-  if (received_frame)
+  NetUdpService *service = (NetUdpService *)arg;
+  uint64_t callback_us = time_us_64();
+
+  // lwIP prepends the response headers in the space the request's headers
+  // occupied.  Only a chained request (never seen with PBUF_POOL frames of
+  // the sizes we serve) needs a contiguous copy.
+  if (p->len != p->tot_len)
   {
-    //printf("received_frame\n");
-    //netif_data.input(received_frame, &netif_data);
-    ethernet_input(received_frame, &netif_data);
+    struct pbuf *p_out = pbuf_alloc(PBUF_TRANSPORT, p->tot_len, PBUF_RAM);
+    if (p_out == NULL)
+    {
+      event_log(EVT_NET_ALLOC_FAILED, p->tot_len);
+      pbuf_free(p);
+      return;
+    }
+    pbuf_copy_partial(p, p_out->payload, p->tot_len, 0);
+    pbuf_free(p);
+    p = p_out;
+    ++udp_tx_allocs;
+  }
+
+  HalPeer peer;
+  peer.addr = ip4_addr_get_u32(ip_2_ip4(addr));
+  peer.port = port;
 
-    pbuf_free(received_frame);
-    received_frame = NULL;
-    tud_network_recv_renew();
+  uint16_t len = service->handler(service->arg, (uint8_t *)p->payload, p->len, p->len, rx_current_timestamp_ns, &peer);
+  if (!len)
+  {
+    pbuf_free(p);
+    return;
+  }
+  pbuf_realloc(p, len);
+
+  uint64_t sendto_us = time_us_64();
+  latency_add(LATENCY_RX_QUEUE, rx_current_timestamp_ns / 1000, rx_current_dispatch_us);
+  latency_add(LATENCY_STACK, rx_current_dispatch_us, callback_us);
+  latency_add(LATENCY_BUILD, callback_us, sendto_us);
+
+  p->flags |= PBUF_FLAG_TX_TIMED;
+  tx_handoff_us = sendto_us;
+  if (service->late_stamp)
+    p->flags |= PBUF_FLAG_LATE_XMIT_STAMP;
+
+  // linkoutput_fn() either sends now or queues its own reference, so the
+  // main loop pushes it out; no need to run tud_task() from here.
+  udp_sendto(pcb, p, addr, port);
+  pbuf_free(p);
+}
+
+bool hal_udp_bind(uint16_t port, hal_udp_handler handler, void *arg, hal_late_stamp_fn late_stamp, uint16_t stamp_offset)
+{
+  // a single service; the late stamp hook in tud_network_xmit_cb() relies on it
+  if (udp_service.pcb)
+    return false;
+
+  udp_service.pcb = udp_new();
+  if (!udp_service.pcb)
+    return false;
+
+  udp_service.handler = handler;
+  udp_service.arg = arg;
+  udp_service.late_stamp = late_stamp;
+  udp_service.stamp_offset = stamp_offset;
+
+  udp_bind(udp_service.pcb, IP_ANY_TYPE, port);
+  udp_recv(udp_service.pcb, &net_udp_recv_cb, &udp_service);
+  return true;
+}
+
+void service_traffic(void)
+{
+  // frames waiting on the last tud_task() to finish the previous IN transfer
+  service_tx();
+
+  // handle frames queued by tud_network_recv_cb(), a batch at a time so the
+  // main loop keeps servicing USB during a burst
+  for (int i = 0; i < NET_RX_BATCH; i++)
+  {
+    FrameRing<NET_RX_RING_SIZE, CFG_TUD_NET_MTU>::Frame *frame = rx_ring.peek();
+    if (!frame) break;
+
+    // out of pbufs: leave the frame queued until lwIP frees some
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, frame->len, PBUF_POOL);
+    if (!p) break;
+
+    pbuf_take(p, frame->data, frame->len);
+    rx_current_timestamp_ns = frame->timestamp_ns;
+    rx_ring.pop();
+    rx_current_dispatch_us = time_us_64();
+
+    // ethernet_input() takes ownership of the frame: it is either freed by
+    // lwIP or handed on (net_udp_recv_cb() reuses it for the reply).
+    // lwIP processes it synchronously, so rx_current_timestamp_ns follows
+    // it all the way up to the UDP callbacks.
+    ethernet_input(p, &netif_data);
   }
 
   sys_check_timeouts();
@@ -195,10 +411,36 @@ void service_traffic(void)
 void tud_network_init_cb(void)
 {
   //printf("tud_network_init_cb()\n");
-  // if the network is re-initializing and we have a leftover packet, we must do a cleanup 
-  if (received_frame)
-  {
-    pbuf_free(received_frame);
-    received_frame = NULL;
-  }
+  // if the network is re-initializing and we have leftover frames, we must do a cleanup
+  rx_ring.clear();
+  tx_queue_clear();
+}
+
+uint16_t net_rx_high_water(void)
+{
+  return rx_ring.highWater();
+}
+
+uint32_t net_rx_overflows(void)
+{
+  return rx_ring.overflows();
+}
+
+uint16_t net_tx_high_water(void)
+{
+  return tx_high_water;
+}
+
+uint32_t net_tx_drops(void)
+{
+  return tx_drops;
+}
+
+void net_print_stats(void)
+{
+  printf("[INFO] net rx ring hwm:%u overflows:%lu | tx queue hwm:%u drops:%lu | udp tx allocs:%lu\n",
+    net_rx_high_water(), net_rx_overflows(),
+    net_tx_high_water(), net_tx_drops(),
+    udp_tx_allocs);
+  latency_print();
 }
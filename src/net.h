@@ -39,6 +39,7 @@
 #include "httpd.h"
 
 #include "common.h"
+#include "hal.h"
 
 #define INIT_IP4(a,b,c,d) { PP_HTONL(LWIP_MAKEU32(a,b,c,d)) }
 
@@ -46,9 +47,6 @@
 // lwip context
 extern struct netif netif_data;
 
-// shared between tud_network_recv_cb() and service_traffic()
-extern struct pbuf *received_frame;
-
 // this is used by this code, ./class/net/net_driver.c, and usb_descriptors.c
 // ideally speaking, this should be generated from the hardware's unique ID (if available)
 // it is suggested that the first byte is 0x02 to indicate a link-local address 
@@ -74,4 +72,23 @@ uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg);
 void service_traffic(void);
 void tud_network_init_cb(void);
 
+void net_print_stats(void);
+
+// Frames of a service bound with a late stamp (see hal_udp_bind()) carry
+// this flag (a bit lwIP leaves unused); tud_network_xmit_cb() fills the
+// stamp as it copies the frame and fixes up the UDP checksum to match.
+#define PBUF_FLAG_LATE_XMIT_STAMP 0x80U
+
+// Frames flagged with this have their udp_sendto() -> tud_network_xmit_cb()
+// time recorded as LATENCY_TX_WAIT (set on hal_udp_bind() service responses).
+#define PBUF_FLAG_TX_TIMED 0x40U
+
+// RX ring statistics
+uint16_t net_rx_high_water(void); // most frames ever waiting for service_traffic()
+uint32_t net_rx_overflows(void);  // frames dropped because the ring was full
+
+// TX queue statistics
+uint16_t net_tx_high_water(void); // most frames ever waiting for the USB IN endpoint
+uint32_t net_tx_drops(void);      // frames dropped because the queue was full
+
 #endif
@@ -0,0 +1,83 @@
+#include "nmea_framer.h"
+#include "nmea_time.h"
+
+NmeaFramer::NmeaFramer() :
+    _len(0),
+    _state(IDLE),
+    _checksum(0),
+    _received(0),
+    _sentences(0),
+    _checksum_errors(0),
+    _framing_errors(0)
+{
+    _buf[0] = '\0';
+}
+
+const char* NmeaFramer::fail(volatile uint32_t* counter)
+{
+    ++*counter;
+    _state = IDLE;
+    return NULL;
+}
+
+const char* __time_critical_func(NmeaFramer::push)(uint8_t c)
+{
+    if (c == '$')
+    {
+        if (_state != IDLE)
+            ++_framing_errors;  // the previous sentence was cut short
+        _buf[0]   = '$';
+        _len      = 1;
+        _checksum = 0;
+        _state    = BODY;
+        return NULL;
+    }
+
+    switch (_state)
+    {
+        case IDLE:
+            return NULL;
+
+        case BODY:
+            if (c == '*')
+            {
+                _buf[_len++] = '*';
+                _state = CHECKSUM_HIGH;
+                return NULL;
+            }
+            if (c < 0x20 || c > 0x7e || _len >= NMEA_MAX_SENTENCE - 3)
+                return fail(&_framing_errors);
+            _buf[_len++] = (char)c;
+            _checksum ^= c;
+            return NULL;
+
+        case CHECKSUM_HIGH:
+        {
+            int value = nmea_hex(c);
+            if (value < 0)
+                return fail(&_framing_errors);
+            _buf[_len++] = (char)c;
+            _received = (uint8_t)(value << 4);
+            _state = CHECKSUM_LOW;
+            return NULL;
+        }
+
+        case CHECKSUM_LOW:
+        {
+            int value = nmea_hex(c);
+            if (value < 0)
+                return fail(&_framing_errors);
+            _received |= (uint8_t)value;
+            if (_received != _checksum)
+                return fail(&_checksum_errors);
+            _buf[_len++] = (char)c;
+            _buf[_len++] = '\r';
+            _buf[_len++] = '\n';
+            _buf[_len]   = '\0';
+            _state = IDLE;
+            ++_sentences;
+            return _buf;
+        }
+    }
+    return NULL;
+}
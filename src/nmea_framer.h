@@ -0,0 +1,51 @@
+#ifndef NMEA_FRAMER_H_
+#define NMEA_FRAMER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+/*
+ * Incremental NMEA 0183 framing: bytes go in one at a time as they come
+ * off the UART, complete sentences come out with their checksum already
+ * checked, so the parser never sees a partial or corrupted line.
+ *
+ * A sentence is '$', printable characters, '*' and two hex digits; it is
+ * handed out as soon as the second checksum digit arrives, with "\r\n"
+ * appended and NUL terminated.  Anything else between sentences (line ends,
+ * binary protocol frames, noise) is skipped, and a '$' in the middle of a
+ * sentence starts over, so one lost byte costs at most the sentence it was in.
+ */
+
+#define NMEA_MAX_SENTENCE   120     // '$' to the checksum; the standard's limit is 82 with CR/LF
+
+class NmeaFramer
+{
+public:
+    NmeaFramer();
+
+    // Feed one received byte.  Returns the sentence it completed (valid until
+    // the next push()), or NULL.
+    const char* push(uint8_t c);
+    size_t      length() const          { return _len; }    // of the sentence push() returned, with CR/LF
+
+    uint32_t    sentences() const       { return _sentences; }
+    uint32_t    checksumErrors() const  { return _checksum_errors; }
+    uint32_t    framingErrors() const   { return _framing_errors; }    // too long, cut short or garbled
+
+private:
+    enum State { IDLE, BODY, CHECKSUM_HIGH, CHECKSUM_LOW };
+
+    char              _buf[NMEA_MAX_SENTENCE + 3];
+    size_t            _len;
+    State             _state;
+    uint8_t           _checksum;
+    uint8_t           _received;
+    volatile uint32_t _sentences;
+    volatile uint32_t _checksum_errors;
+    volatile uint32_t _framing_errors;
+
+    const char* fail(volatile uint32_t* counter);
+};
+
+#endif /* NMEA_FRAMER_H_ */
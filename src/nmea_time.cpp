@@ -0,0 +1,170 @@
+#include "nmea_time.h"
+
+#define SECONDS_PER_DAY 86400
+
+typedef struct fields
+{
+    int      type;
+    int32_t  second_of_day;
+    uint16_t ms;
+    int      day;
+    int      month;
+    int      year;
+    char     status;
+    int      fix_quality;
+} Fields;
+
+static inline int digit(char c)
+{
+    return (unsigned)(c - '0') < 10 ? c - '0' : -1;
+}
+
+// n digits at p as a number, -1 if any of them isn't one
+static int number(const char* p, int n)
+{
+    int value = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        int d = digit(p[i]);
+        if (d < 0)
+            return -1;
+        value = value * 10 + d;
+    }
+    return value;
+}
+
+// hhmmss[.fff...]
+static void parse_time(Fields* f, const char* begin, const char* end)
+{
+    if (end - begin < 6)
+        return;
+    int hours   = number(begin, 2);
+    int minutes = number(begin + 2, 2);
+    int seconds = number(begin + 4, 2);
+    if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || seconds < 0 || seconds > 60)
+        return;
+
+    uint16_t ms = 0;
+    if (end - begin > 6 && begin[6] == '.')
+    {
+        int scale = 100;
+        for (const char* p = begin + 7; p < end && scale > 0; ++p, scale /= 10)
+        {
+            int d = digit(*p);
+            if (d < 0)
+                return;
+            ms += d * scale;
+        }
+    }
+    f->second_of_day = hours * 3600 + minutes * 60 + seconds;
+    f->ms            = ms;
+}
+
+static void parse_field(Fields* f, int index, const char* begin, const char* end)
+{
+    if (index == 1)
+    {
+        parse_time(f, begin, end);
+        return;
+    }
+
+    switch (f->type)
+    {
+        case NMEA_TIME_RMC:
+            if (index == 2 && end > begin)
+                f->status = *begin;
+            else if (index == 9 && end - begin == 6)
+            {
+                // ddmmyy, two digit years as minmea reads them
+                f->day   = number(begin, 2);
+                f->month = number(begin + 2, 2);
+                f->year  = number(begin + 4, 2);
+                if (f->year >= 0)
+                    f->year += f->year < 80 ? 2000 : 1900;
+            }
+            break;
+
+        case NMEA_TIME_ZDA:
+            if (index == 2 && end - begin == 2)
+                f->day = number(begin, 2);
+            else if (index == 3 && end - begin == 2)
+                f->month = number(begin, 2);
+            else if (index == 4 && end - begin == 4)
+                f->year = number(begin, 4);
+            break;
+
+        case NMEA_TIME_GGA:
+            if (index == 6 && end - begin == 1)
+                f->fix_quality = digit(*begin);
+            break;
+    }
+}
+
+int64_t nmea_days_from_civil(int year, unsigned month, unsigned day)
+{
+    // H. Hinnant's days_from_civil: March-based years, so the leap day is last
+    year -= month <= 2;
+    int      era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = (unsigned)(year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (int64_t)era * 146097 + (int64_t)doe - 719468;
+}
+
+int __time_critical_func(nmea_parse_time)(const char* sentence, size_t len, NmeaTime* time)
+{
+    // fast reject: anything but the three sentence types costs three compares
+    if (len < 10 || sentence[0] != '$')
+        return NMEA_TIME_NONE;
+
+    Fields f = { NMEA_TIME_NONE, -1, 0, -1, -1, -1, 0, -1 };
+    const char* type = sentence + 3;
+    if (type[0] == 'R' && type[1] == 'M' && type[2] == 'C')
+        f.type = NMEA_TIME_RMC;
+    else if (type[0] == 'Z' && type[1] == 'D' && type[2] == 'A')
+        f.type = NMEA_TIME_ZDA;
+    else if (type[0] == 'G' && type[1] == 'G' && type[2] == 'A')
+        f.type = NMEA_TIME_GGA;
+    else
+        return NMEA_TIME_NONE;
+
+    const char* end   = sentence + len;
+    const char* start = sentence + 1;
+    const char* p;
+    uint8_t     checksum = 0;
+    int         index = 0;
+    for (p = sentence + 1; p < end && *p != '*'; ++p)
+    {
+        checksum ^= (uint8_t)*p;
+        if (*p == ',')
+        {
+            parse_field(&f, index++, start, p);
+            start = p + 1;
+        }
+    }
+    if (end - p < 3)
+        return NMEA_TIME_NONE;
+    parse_field(&f, index, start, p);
+
+    int high = nmea_hex((uint8_t)p[1]);
+    int low  = nmea_hex((uint8_t)p[2]);
+    if (high < 0 || low < 0 || ((high << 4) | low) != checksum)
+        return NMEA_TIME_NONE;
+
+    time->utc_seconds = -1;
+    time->ms          = f.ms;
+    time->fix_quality = f.fix_quality < 0 ? 0 : (uint8_t)f.fix_quality;
+    if (f.type != NMEA_TIME_GGA && f.second_of_day >= 0 &&
+        f.year >= 0 && f.month >= 1 && f.month <= 12 && f.day >= 1 && f.day <= 31)
+    {
+        time->utc_seconds = nmea_days_from_civil(f.year, f.month, f.day) * SECONDS_PER_DAY + f.second_of_day;
+    }
+
+    switch (f.type)
+    {
+        case NMEA_TIME_RMC: time->valid = f.status == 'A' && time->utc_seconds >= 0; break;
+        case NMEA_TIME_ZDA: time->valid = time->utc_seconds >= 0; break;
+        default:            time->valid = f.fix_quality > 0; break;
+    }
+    return f.type;
+}
@@ -0,0 +1,52 @@
+#ifndef NMEA_TIME_H_
+#define NMEA_TIME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+/*
+ * Parser for the NMEA sentences that carry time: RMC and ZDA (date, time and
+ * validity) and GGA (fix quality).  Everything else is rejected on its
+ * sentence type before a byte of it is looked at.
+ *
+ * One pass over the sentence: the checksum is accumulated while the wanted
+ * fields are picked out and converted, and nothing is reported unless it
+ * matches.  Date and time go straight to Unix seconds with integer
+ * arithmetic, no struct tm or mktime(), and nothing is allocated.
+ */
+
+#define NMEA_TIME_NONE  0   // not a time sentence, or malformed, or bad checksum
+#define NMEA_TIME_RMC   1
+#define NMEA_TIME_ZDA   2
+#define NMEA_TIME_GGA   3
+
+typedef struct nmea_time
+{
+    int64_t  utc_seconds;   // Unix seconds of the time (and date) fields, -1 if they were empty
+    uint16_t ms;            // fraction of the second in the time field
+    uint8_t  fix_quality;   // GGA only
+    bool     valid;         // RMC status A, ZDA with a full date, GGA with a fix
+} NmeaTime;
+
+// sentence is '$' to the checksum (anything after it is ignored), len its
+// length.  Returns NMEA_TIME_* and fills in time for anything but NONE.
+int nmea_parse_time(const char* sentence, size_t len, NmeaTime* time);
+
+// Value of a checksum digit, -1 if it isn't one.  Receivers send upper case,
+// lower case is taken too; the framer and the parser share this.
+static inline int nmea_hex(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+int64_t nmea_days_from_civil(int year, unsigned month, unsigned day);
+
+#endif /* NMEA_TIME_H_ */
@@ -20,8 +20,14 @@
  */
 
 #include <functional>
-#include <lwip/def.h> // htonl() & ntohl()
+#include <cinttypes>
+#include <cstddef>
+#include <cmath>
 #include "ntp.h"
+#include "event_log.h"
+#ifdef NTP_AUTH
+#include "ntp_keys.h"
+#endif
 
 static const char* TAG = "ntp";
 
@@ -45,10 +51,14 @@ typedef struct ntp_packet
     NTPTime  xmit_time;
 } NTPPacket;
 
-#define LI_NONE         0
-#define LI_SIXTY_ONE    1
-#define LI_FIFTY_NINE   2
-#define LI_NOSYNC       3
+static_assert(offsetof(NTPPacket, orig_time) == NTP_TEMPLATE_SIZE, "template must end at orig_time");
+
+// RFC 5905 crypto-NAK: a MAC of only a zero key id, for a request we can't authenticate
+#define CRYPTO_NAK_LEN  (sizeof(NTPPacket) + NTP_AUTH_KEY_ID_LEN)
+
+#if defined(NTP_INTERLEAVED) && !defined(NTP_LATE_XMIT_TIMESTAMP)
+#error "NTP_INTERLEAVED needs NTP_LATE_XMIT_TIMESTAMP to learn when responses leave"
+#endif
 
 #define MODE_RESERVED   0
 #define MODE_ACTIVE     1
@@ -62,6 +72,8 @@ typedef struct ntp_packet
 #define NTP_VERSION     4
 
 #define REF_ID          "GPS "
+#define KOD_RATE        "RATE"
+#define KOD_NTSN        "NTSN"
 
 #define setLI(value)    ((value&0x03)<<6)
 #define setVERS(value)  ((value&0x07)<<3)
@@ -71,9 +83,26 @@ typedef struct ntp_packet
 #define getVERS(value)  ((value>>3)&0x07)
 #define getMODE(value)  (value&0x07)
 
-#define SEVENTY_YEARS   2208988800L
-#define toEPOCH(t)      ((uint32_t)t-SEVENTY_YEARS)
-#define toNTP(t)        ((uint32_t)t+SEVENTY_YEARS)
+// The UDP payload sits 42 bytes into the frame, so it is only 2-byte aligned;
+// access multi-byte fields a byte at a time in network order.
+static inline void put32(uint8_t* dst, uint32_t value)
+{
+    dst[0] = (uint8_t)(value >> 24);
+    dst[1] = (uint8_t)(value >> 16);
+    dst[2] = (uint8_t)(value >> 8);
+    dst[3] = (uint8_t)(value);
+}
+
+static inline uint32_t get32(const uint8_t* src)
+{
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+static inline void putNTPTime(uint8_t* dst, const NTPTime* time)
+{
+    put32(dst, time->seconds);
+    put32(dst + 4, time->fraction);
+}
 
 #ifdef NTP_PACKET_DEBUG
 #include <time.h>
@@ -84,8 +113,23 @@ char* timestr(long int t)
     return ctime(&time);
 }
 
-void dumpNTPPacket(NTPPacket* ntp)
+void dumpNTPPacket(const uint8_t* payload)
 {
+    // payload is in network byte order and not necessarily aligned
+    NTPPacket packet;
+    NTPPacket* ntp = &packet;
+    memcpy(ntp, payload, sizeof(packet));
+    ntp->delay              = get32(payload + offsetof(NTPPacket, delay));
+    ntp->dispersion         = get32(payload + offsetof(NTPPacket, dispersion));
+    ntp->ref_time.seconds   = get32(payload + offsetof(NTPPacket, ref_time));
+    ntp->ref_time.fraction  = get32(payload + offsetof(NTPPacket, ref_time) + 4);
+    ntp->orig_time.seconds  = get32(payload + offsetof(NTPPacket, orig_time));
+    ntp->orig_time.fraction = get32(payload + offsetof(NTPPacket, orig_time) + 4);
+    ntp->recv_time.seconds  = get32(payload + offsetof(NTPPacket, recv_time));
+    ntp->recv_time.fraction = get32(payload + offsetof(NTPPacket, recv_time) + 4);
+    ntp->xmit_time.seconds  = get32(payload + offsetof(NTPPacket, xmit_time));
+    ntp->xmit_time.fraction = get32(payload + offsetof(NTPPacket, xmit_time) + 4);
+
     printf("size:       %u\n", sizeof(*ntp));
     printf("firstbyte:  0x%02x\n", *(uint8_t*)ntp);
     printf("li:         %u\n", getLI(ntp->flags));
@@ -108,13 +152,21 @@ void dumpNTPPacket(NTPPacket* ntp)
 
 static std::function<void()> _udp_cb;
 
+#ifdef NTP_LATE_XMIT_TIMESTAMP
+static void ntp_late_xmit_stamp(void* arg, uint8_t* stamp, uint16_t len, const HalPeer* peer);
+#endif
+
 NTP::NTP(GPS& gps) :
     _gps(gps),
-    _udp(),
     _req_count(0),
     _rsp_count(0),
-    _precision(0)
+    _precision(0),
+    _template_seq(0),
+    _template_stale(true),
+    _template_valid(false),
+    _auth_naks(0)
 {
+    memset(_template, 0x0, sizeof(_template));
 }
 
 NTP::~NTP()
@@ -124,113 +176,441 @@ NTP::~NTP()
 void NTP::begin()
 {
     _precision = computePrecision();
-    _udp = udp_new();
-
-
+    _template_stale = true;
+#ifdef NTP_AUTH
+    if (!ntp_auth_self_test())
+    {
+        printf("[ERROR] NTP::begin() MAC self test failed, authentication disabled\n");
+    }
+    else
+    {
+        for (const NtpKeyConfig* config = ntp_keys; config->id; ++config)
+        {
+            if (!_auth.addKey(config->id, config->type, config->key, config->len))
+                printf("[ERROR] NTP::begin() can't add key %lu\n", (unsigned long)config->id);
+        }
+    }
+#endif
+#ifdef NTS
+    if (!nts_self_test())
+        printf("[ERROR] NTP::begin() AES-SIV self test failed, NTS disabled\n");
+    else
+        _nts.begin(hal_time_us_64());
+#endif
+#ifdef NTP_BENCHMARK
+    benchmark();
+#endif
 
-    udp_bind(_udp, IP_ANY_TYPE, NTP_PORT);
-    udp_recv(_udp, &ntp_udp_recv_cb, this);
+#ifdef NTP_LATE_XMIT_TIMESTAMP
+    hal_udp_bind(NTP_PORT, &ntp_udp_recv_cb, this, &ntp_late_xmit_stamp, offsetof(NTPPacket, xmit_time));
+#else
+    hal_udp_bind(NTP_PORT, &ntp_udp_recv_cb, this, NULL, 0);
+#endif
     printf("[INFO] NTP::begin() complete, NTP bound to %d\n", NTP_PORT);
 }
 
+// Precision as RFC 5905 has it: the smallest step between two readings of
+// the clock timestamps come from, which is its resolution or the time it
+// takes to read, whichever is longer.
 int8_t NTP::computePrecision()
 {
-    NTPTime t;
-    uint64_t start = time_us_64();
+    uint32_t resolution = hal_time_resolution_ns();
+    uint64_t step       = UINT64_MAX;
+    uint64_t previous   = hal_time_ns_64();
     for (int i = 0; i < PRECISION_COUNT; ++i)
     {
-        getNTPTime(&t);
+        uint64_t now = hal_time_ns_64();
+        if (now != previous && now - previous < step)
+            step = now - previous;
+        previous = now;
     }
-    uint64_t      end   = time_us_64();
-    double        total = (double)(end - start) / 1000000.0;
-    double        time  = total / PRECISION_COUNT;
-    double        prec  = log2(time);
-    printf("INFO: computePrecision: total:%f time:%f prec:%f (%d)\n", total, time, prec, (int8_t)prec);
+    if (step == UINT64_MAX || step < resolution)
+        step = resolution;  // never moved: the host's simulated clock
+    double prec = log2((double)step / 1e9);
+    printf("INFO: computePrecision: resolution:%luns step:%luns prec:%f (%d)\n",
+        (unsigned long)resolution, (unsigned long)step, prec, (int8_t)prec);
     return (int8_t)prec;
 }
 
-void NTP::getNTPTime(NTPTime *time)
+#ifdef NTP_BENCHMARK
+// The timestamp path as it was before the fixed-point engine: mktime() on a
+// struct tm, 64-bit divisions and a soft-float fraction.
+static void __noinline legacyNTPTime(const struct tm* nmea_timestamp, uint64_t pps_timestamp_us, NTPTime* time)
 {
-    struct timeval tv;
-    bool status = _gps.getTime(&tv);
-    //TODO: if status == false we should not use this timestamp.
-    time->seconds = toNTP(tv.tv_sec);
-
-    double percent = us2s(tv.tv_usec);
+    struct tm t = *nmea_timestamp;
+    uint64_t  cur_micros = hal_time_us_64();
+    time_t    seconds = mktime(&t);
+    uint64_t  us_since_pps = cur_micros - pps_timestamp_us;
+    uint64_t  seconds_since_pps = us_since_pps / US_PER_SEC;
+
+    time->seconds = toNTP(seconds + seconds_since_pps);
+    double percent = us2s(us_since_pps - seconds_since_pps*US_PER_SEC);
     time->fraction = (uint32_t)(percent * (double)4294967296L);
 }
 
-void ntp_udp_recv_cb(void* arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+void NTP::benchmark()
+{
+    NTPTime   t;
+    struct tm tm = {};
+    tm.tm_year = 124;
+    tm.tm_mday = 1;
+    uint64_t  pps_timestamp_us = hal_time_us_64();
+    uint32_t  cycles_per_us = hal_sys_clock_hz() / US_PER_SEC;
+
+    uint64_t start = hal_time_us_64();
+    for (int i = 0; i < PRECISION_COUNT; ++i)
+    {
+        legacyNTPTime(&tm, pps_timestamp_us, &t);
+    }
+    uint64_t legacy_us = hal_time_us_64() - start;
+
+    start = hal_time_us_64();
+    for (int i = 0; i < PRECISION_COUNT; ++i)
+    {
+        getNTPTime(&t);
+    }
+    uint64_t fixed_us = hal_time_us_64() - start;
+
+    printf("INFO: benchmark: legacy %" PRIu64 " cycles/timestamp, fixed-point %" PRIu64 " cycles/timestamp\n",
+        legacy_us * cycles_per_us / PRECISION_COUNT,
+        fixed_us * cycles_per_us / PRECISION_COUNT);
+
+#ifdef NTP_AUTH
+    // an authenticated response costs a MAC of the request and one of the response
+    static NtpAuth auth;
+    static const uint8_t secret[SHA1_DIGEST_LEN] = { 0 };
+    uint8_t header[NTP_AUTH_DATA_LEN] = { 0 };
+    uint8_t mac[NTP_AUTH_MAX_MAC_LEN];
+    auth.addKey(1, NTP_KEY_AES128_CMAC, secret, AES128_KEY_LEN);
+    auth.addKey(2, NTP_KEY_SHA1, secret, sizeof(secret));
+    for (uint32_t id = 1; id <= 2; ++id)
+    {
+        const NtpKey* key = auth.find(id);
+        start = hal_time_us_64();
+        for (int i = 0; i < PRECISION_COUNT / 10; ++i)
+            auth.mac(key, header, mac);
+        uint64_t mac_us = hal_time_us_64() - start;
+        printf("INFO: benchmark: %s %" PRIu64 " cycles/MAC\n", id == 1 ? "AES-CMAC" : "SHA1",
+            mac_us * cycles_per_us * 10 / PRECISION_COUNT);
+    }
+#endif
+
+#ifdef NTS
+    // an NTS request with one cookie: open it, check the authenticator, make
+    // a new cookie and encrypt it into the response
+    static NtsServer nts;
+    static const uint8_t keys[NTS_KEY_LEN] = { 0 };
+    static const uint8_t uid[NTS_UNIQUE_ID_MIN_LEN] = { 0 };
+    uint8_t    cookie[NTS_COOKIE_LEN];
+    uint8_t    request[256] = { 0 };
+    uint8_t    packet[sizeof(request)];
+    NtsRequest req;
+    nts.begin(hal_time_us_64());
+    nts.makeCookie(keys, keys, cookie);
+    uint16_t len = nts_client_request(request, sizeof(NTPPacket), uid, cookie, 0, keys);
+    start = hal_time_us_64();
+    for (int i = 0; i < PRECISION_COUNT / 100; ++i)
+    {
+        memcpy(packet, request, len);
+        nts.parse(packet, len, &req);
+        nts.respond(packet, len, &req);
+    }
+    uint64_t nts_cycles = (hal_time_us_64() - start) * cycles_per_us * 100 / PRECISION_COUNT;
+    printf("INFO: benchmark: NTS %" PRIu64 " cycles/request, %" PRIu64 " clients at 64 s polling\n",
+        nts_cycles, nts_cycles ? (uint64_t)hal_sys_clock_hz() * 64 / nts_cycles : 0);
+#endif
+}
+#endif
+
+bool NTP::getNTPTime(NTPTime *time)
+{
+    return _gps.getNTPTime(time);
+}
+
+bool NTP::getNTPTime(uint64_t timestamp_ns, NTPTime *time)
+{
+    return _gps.toNTPTime(timestamp_ns, time);
+}
+
+void NTP::printStats()
+{
+    printf("[INFO] NTP req:%lu rsp:%lu | log dropped:%lu\n",
+        (unsigned long)_req_count, (unsigned long)_rsp_count, (unsigned long)event_log_dropped());
+    _rx_delay_hist.print("[INFO] NTP arrival->callback", "us");
+    static const char* const sync_names[] = { "none", "locked", "holdover" };
+    uint8_t sync_state = _gps.getSyncState();
+    printf("[INFO] GPS %s", sync_state < 3 ? sync_names[sync_state] : "?");
+    if (sync_state == GPS_SYNC_HOLDOVER)
+        printf(" error:%lu us", (unsigned long)_gps.getHoldoverErrorUs());
+    printf(" | servo %s freq:%ld ppb phase:%ld ns jitter:%lu ns\n", _gps.isServoLocked() ? "locked" : "unlocked",
+        (long)_gps.getFrequencyPPB(), (long)_gps.getPhaseErrorNs(), (unsigned long)_gps.getJitter());
+    const NmeaFramer& framer = _gps.getFramer();
+    printf("[INFO] NMEA sentences:%lu checksum errors:%lu framing errors:%lu | UART overruns:%lu\n",
+        (unsigned long)framer.sentences(), (unsigned long)framer.checksumErrors(),
+        (unsigned long)framer.framingErrors(), (unsigned long)hal_uart_overruns());
+#ifdef NTP_RATE_LIMIT
+    printf("[INFO] NTP rate limit clients:%lu evictions:%lu kod:%lu dropped:%lu\n",
+        (unsigned long)_rate_limiter.clients(), (unsigned long)_rate_limiter.evictions(),
+        (unsigned long)_rate_limiter.kods(), (unsigned long)_rate_limiter.drops());
+#endif
+#ifdef NTP_AUTH
+    printf("[INFO] NTP auth keys:%u verified:%lu failed:%lu crypto-NAK:%lu\n", _auth.keys(),
+        (unsigned long)_auth.verified(), (unsigned long)_auth.failed(), (unsigned long)_auth_naks);
+#endif
+#ifdef NTS
+    printf("[INFO] NTS key:%08lx requests:%lu cookies:%lu NTSN:%lu dropped:%lu\n", (unsigned long)_nts.keyId(),
+        (unsigned long)_nts.requests(), (unsigned long)_nts.cookies(), (unsigned long)_nts.naks(),
+        (unsigned long)_nts.drops());
+#endif
+#ifdef NTP_INTERLEAVED
+    printf("[INFO] NTP interleaved hits:%lu misses:%lu\n",
+        (unsigned long)_interleave.hits(), (unsigned long)_interleave.misses());
+#endif
+}
+
+#ifdef NTP_LATE_XMIT_TIMESTAMP
+// Called as a response is handed to the wire (tud_network_xmit_cb() on the
+// firmware), stamp points at its xmit_time as it sits in the USB buffer.
+static void __time_critical_func(ntp_late_xmit_stamp)(void* arg, uint8_t* stamp, uint16_t len, const HalPeer* peer)
 {
-    printf("ntp_udp_recv_cb(%d)\n", p->tot_len);
     NTP* that = (NTP*) arg;
-    ++that->_req_count;
-    NTPPacket ntp;
+    NTPTime xmit_time;
+    uint8_t departure[sizeof(NTPTime)];
+    that->getNTPTime(&xmit_time);
+    putNTPTime(departure, &xmit_time);
+#ifdef NTP_INTERLEAVED
+    // Remember when this response left for the client's next request.  An
+    // interleaved response already carries the previous departure instead.
+    const uint8_t* packet = stamp - offsetof(NTPPacket, xmit_time);
+    if (that->_interleave.departed(peer->addr, packet + offsetof(NTPPacket, recv_time), departure))
+        return;
+#else
+    (void)peer;
+#endif
+#if defined(NTP_AUTH) || defined(NTS)
+    // a MAC or NTS authenticator covers the transmit timestamp: a signed response goes as built
+    if (len > CRYPTO_NAK_LEN)
+        return;
+#endif
+    memcpy(stamp, departure, sizeof(departure));
+}
+#endif
+
+// Rebuild the shared part of the response if the GPS state has been
+// republished (every PPS edge, RMC fix or invalidation) since the last build.
+// Returns whether responses built from it are backed by valid GPS data.
+bool __time_critical_func(NTP::updateTemplate)()
+{
+    if (!_template_stale && _template_seq == _gps.getStateSequence())
+        return _template_valid;
+
+    TimeState state;
+    _template_seq   = _gps.getState(&state);
+    _template_valid = state.valid != 0;
+    _template_stale = false;
+
+    // reference time is the PPS edge the current second started on
+    NTPTime ref_time;
+    ref_time.seconds  = state.pps_ntp_seconds;
+    ref_time.fraction = 0;
+
+    _template[offsetof(NTPPacket, flags)]     = setLI(state.leap) | setVERS(NTP_VERSION) | setMODE(MODE_SERVER);
+    _template[offsetof(NTPPacket, stratum)]   = state.stratum;
+    _template[offsetof(NTPPacket, poll)]      = 0; // echoed from the request
+    _template[offsetof(NTPPacket, precision)] = _precision;
+
+    // The reference is wired to us, there is no network path to it: root
+    // delay is 0.  Root dispersion comes precomputed from the PPS jitter
+    // window (locked) or the holdover error estimate.
+    put32(_template + offsetof(NTPPacket, delay), 0);
+    put32(_template + offsetof(NTPPacket, dispersion), state.root_dispersion);
+    memcpy(_template + offsetof(NTPPacket, ref_id), REF_ID, sizeof(((NTPPacket*)0)->ref_id));
+    putNTPTime(_template + offsetof(NTPPacket, ref_time), &ref_time);
+
+    return _template_valid;
+}
+
+#if defined(NTP_RATE_LIMIT) || defined(NTS)
+// RFC 5905 Kiss-o'-Death: stratum 0, the kiss code as the reference id and
+// LI alarm, with the timestamps of a normal response so the client can match
+// it to its request.  Built over the request like any response.
+static uint16_t __time_critical_func(ntp_kod)(NTP* that, uint8_t* ntp, const char* code, const NTPTime* recv_time)
+{
+    uint8_t poll = ntp[offsetof(NTPPacket, poll)];
+    memcpy(ntp + offsetof(NTPPacket, orig_time), ntp + offsetof(NTPPacket, xmit_time), sizeof(NTPTime));
+    memset(ntp, 0x0, offsetof(NTPPacket, orig_time));
+    ntp[offsetof(NTPPacket, flags)]     = setLI(LI_NOSYNC) | setVERS(NTP_VERSION) | setMODE(MODE_SERVER);
+    ntp[offsetof(NTPPacket, poll)]      = poll;
+    ntp[offsetof(NTPPacket, precision)] = that->_precision;
+    memcpy(ntp + offsetof(NTPPacket, ref_id), code, sizeof(((NTPPacket*)0)->ref_id));
+    putNTPTime(ntp + offsetof(NTPPacket, recv_time), recv_time);
+
+    NTPTime xmit_time;
+    that->getNTPTime(&xmit_time);
+    putNTPTime(ntp + offsetof(NTPPacket, xmit_time), &xmit_time);
+    return sizeof(NTPPacket);
+}
+#endif
+
+uint16_t __time_critical_func(ntp_udp_recv_cb)(void* arg, uint8_t* ntp, uint16_t len, uint16_t max_len,
+                                               uint64_t arrival_ns, const HalPeer* peer)
+{
+    NTP* that = (NTP*) arg;
+    // receive time is when the frame came off the wire, not now: the time it
+    // spent queued and going up through the stack is not the client's path delay
     NTPTime   recv_time;
-    that->getNTPTime(&recv_time);
-    if (p->tot_len != sizeof(NTPPacket))
+    that->getNTPTime(arrival_ns, &recv_time);
+    that->_rx_delay_hist.add((uint32_t)((hal_time_ns_64() - arrival_ns) / 1000));
+    ++that->_req_count;
+    event_log(EVT_NTP_REQUEST, len, that->_req_count, that->_rsp_count);
+
+    // the header alone or, with NTP_AUTH, followed by a key id and MAC, or
+    // with NTS by extension fields, which are whole 32-bit words
+    bool authenticated = false;
+    bool nts = false;
+#ifdef NTP_AUTH
+    authenticated = len == sizeof(NTPPacket) + NTP_AUTH_KEY_ID_LEN + AES_CMAC_LEN ||
+                    len == sizeof(NTPPacket) + NTP_AUTH_KEY_ID_LEN + SHA1_DIGEST_LEN;
+#endif
+#ifdef NTS
+    nts = len > sizeof(NTPPacket) && (len & 3) == 0 && !authenticated;
+#endif
+    if (len != sizeof(NTPPacket) && !authenticated && !nts)
     {
-        printf("[WARNING] recievePacket: ignoring packet with bad length: %d < %d\n", p->tot_len, sizeof(NTPPacket));
-        return;
+        event_log(EVT_NTP_BAD_LENGTH, len, sizeof(NTPPacket));
+        return 0;
     }
 
-    if (!that->_gps.isValid())
+    // Only requests get an answer: client requests as a server, symmetric
+    // active ones as a passive peer.  Answering anything else could start a
+    // loop with another server.
+    uint8_t mode = getMODE(ntp[offsetof(NTPPacket, flags)]);
+    if (mode != MODE_CLIENT && mode != MODE_ACTIVE)
     {
-        printf("[WARNING] receivePacket: GPS data not Valid!");
-        return;
+        event_log(EVT_NTP_BAD_MODE, mode, get32((const uint8_t*)&peer->addr));
+        return 0;
     }
 
-    memcpy(&ntp, p->payload, sizeof(ntp));
-    ntp.delay              = ntohl(ntp.delay);
-    ntp.dispersion         = ntohl(ntp.dispersion);
-    ntp.orig_time.seconds  = ntohl(ntp.orig_time.seconds);
-    ntp.orig_time.fraction = ntohl(ntp.orig_time.fraction);
-    ntp.ref_time.seconds   = ntohl(ntp.ref_time.seconds);
-    ntp.ref_time.fraction  = ntohl(ntp.ref_time.fraction);
-    ntp.recv_time.seconds  = ntohl(ntp.recv_time.seconds);
-    ntp.recv_time.fraction = ntohl(ntp.recv_time.fraction);
-    ntp.xmit_time.seconds  = ntohl(ntp.xmit_time.seconds);
-    ntp.xmit_time.fraction = ntohl(ntp.xmit_time.fraction);
-    dumpNTPPacket(&ntp);
-
-
-    // Build the response
-    ntp.flags      = setLI(LI_NONE) | setVERS(NTP_VERSION) | setMODE(MODE_SERVER);
-    ntp.stratum    = 1;
-    ntp.precision  = that->_precision;
-
-    // TODO: compute actual root delay, and root dispersion
-
-    ntp.delay = 0;      //(uint32)(0.000001 * 65536.0);
-    ntp.dispersion = 0; //(uint32_t)(_gps.getDispersion() * 65536.0); // TODO: pre-calculate this?
-    strncpy((char*)ntp.ref_id, REF_ID, sizeof(ntp.ref_id));
-    ntp.orig_time  = ntp.xmit_time;
-    ntp.recv_time  = recv_time;
-    that->getNTPTime(&(ntp.ref_time));
-    dumpNTPPacket(&ntp);
-    ntp.delay              = htonl(ntp.delay);
-    ntp.dispersion         = htonl(ntp.dispersion);
-    ntp.orig_time.seconds  = htonl(ntp.orig_time.seconds);
-    ntp.orig_time.fraction = htonl(ntp.orig_time.fraction);
-    ntp.ref_time.seconds   = htonl(ntp.ref_time.seconds);
-    ntp.ref_time.fraction  = htonl(ntp.ref_time.fraction);
-    ntp.recv_time.seconds  = htonl(ntp.recv_time.seconds);
-    ntp.recv_time.fraction = htonl(ntp.recv_time.fraction);
-    that->getNTPTime(&(ntp.xmit_time));
-    ntp.xmit_time.seconds  = htonl(ntp.xmit_time.seconds);
-    ntp.xmit_time.fraction = htonl(ntp.xmit_time.fraction);
-
-    struct pbuf *p_out;
-    p_out = pbuf_alloc(PBUF_TRANSPORT, sizeof(ntp), PBUF_RAM);
-    if(p_out == NULL){
-        printf("[ERROR] Failed to allocate pbuf for transmit");
-        return;
+#ifdef NTP_RATE_LIMIT
+    switch (that->_rate_limiter.check(peer->addr, arrival_ns))
+    {
+        case RATE_LIMIT_KOD:
+            event_log(EVT_NTP_RATE_KOD, get32((const uint8_t*)&peer->addr), that->_rate_limiter.kods());
+            return ntp_kod(that, ntp, KOD_RATE, &recv_time);
+        case RATE_LIMIT_DROP:
+            return 0;
     }
-    memcpy(p_out->payload, &ntp, sizeof(ntp));
-    udp_sendto(pcb, p_out, addr, port);
-    pbuf_free(p_out);
-    pbuf_free(p);
-    tud_task();
-    
+#endif
+
+    if (!that->updateTemplate())
+    {
+        event_log(EVT_NTP_NOT_VALID);
+        return 0;
+    }
+
+    dumpNTPPacket(ntp);
+
+#ifdef NTP_AUTH
+    // The MAC covers the request's header.  An unknown key, or one with a
+    // different MAC length, is answered like a bad MAC: with a crypto-NAK.
+    const NtpKey* key = NULL;
+    if (authenticated)
+    {
+        const uint8_t* mac = ntp + sizeof(NTPPacket);
+        key = that->_auth.find(get32(mac));
+        if (!key || len != sizeof(NTPPacket) + NTP_AUTH_KEY_ID_LEN + key->mac_len ||
+            !that->_auth.verify(key, ntp, mac + NTP_AUTH_KEY_ID_LEN))
+        {
+            event_log(EVT_NTP_AUTH_FAILED, get32(mac), get32((const uint8_t*)&peer->addr));
+            key = NULL;
+        }
+    }
+#endif
+
+#ifdef NTS
+    // The cookie gives the client's keys, the authenticator is checked with
+    // them; one that fails gets a KoD NTSN so the client goes back to NTS-KE.
+    NtsRequest nts_req;
+    if (nts)
+    {
+        switch (that->_nts.parse(ntp, len, &nts_req))
+        {
+            case NTS_NAK:
+                event_log(EVT_NTS_NAK, get32((const uint8_t*)&peer->addr));
+                ntp_kod(that, ntp, KOD_NTSN, &recv_time);
+                return that->_nts.nak(ntp, &nts_req);
+            case NTS_DROP:
+                event_log(EVT_NTS_DROP, len, get32((const uint8_t*)&peer->addr));
+                return 0;
+        }
+    }
+#endif
+
+    bool interleaved = false;
+#ifdef NTP_INTERLEAVED
+    // chrony's test for an interleaved request: its origin is our receive
+    // timestamp of the client's previous request, which can't be mistaken for
+    // the receive or transmit timestamps it would carry in basic mode.
+    const uint8_t* origin = ntp + offsetof(NTPPacket, orig_time);
+    uint8_t        departure[sizeof(NTPTime)];
+    interleaved = (get32(origin) | get32(origin + 4)) != 0 &&
+        memcmp(origin, ntp + offsetof(NTPPacket, recv_time), sizeof(NTPTime)) != 0 &&
+        memcmp(origin, ntp + offsetof(NTPPacket, xmit_time), sizeof(NTPTime)) != 0 &&
+        that->_interleave.lookup(peer->addr, origin, departure);
+#endif
+
+    // Build the response over the request: the per-second template, then the
+    // client's poll and the three per-request timestamps.
+    uint8_t poll = ntp[offsetof(NTPPacket, poll)];
+    memcpy(ntp, that->_template, NTP_TEMPLATE_SIZE);
+    ntp[offsetof(NTPPacket, poll)] = poll;
+    if (mode == MODE_ACTIVE)
+        ntp[offsetof(NTPPacket, flags)] = (ntp[offsetof(NTPPacket, flags)] & ~0x07) | setMODE(MODE_PASSIVE);
+
+    // Origin is the client's transmit time, already in network order.  In
+    // interleaved mode it is the client's receive time of our previous
+    // response, and transmit the time that response left.
+    memcpy(ntp + offsetof(NTPPacket, orig_time),
+           ntp + (interleaved ? offsetof(NTPPacket, recv_time) : offsetof(NTPPacket, xmit_time)), sizeof(NTPTime));
+    putNTPTime(ntp + offsetof(NTPPacket, recv_time), &recv_time);
+#ifdef NTP_INTERLEAVED
+    that->_interleave.save(peer->addr, ntp + offsetof(NTPPacket, recv_time), interleaved);
+    if (interleaved)
+        memcpy(ntp + offsetof(NTPPacket, xmit_time), departure, sizeof(departure));
+#endif
+
+    if (!interleaved)
+    {
+        // with NTP_LATE_XMIT_TIMESTAMP this is a placeholder that
+        // ntp_late_xmit_stamp() overwrites as the frame leaves, unless signed
+        NTPTime xmit_time;
+        that->getNTPTime(&xmit_time);
+        putNTPTime(ntp + offsetof(NTPPacket, xmit_time), &xmit_time);
+    }
+    dumpNTPPacket(ntp);
+
+    uint16_t rsp_len = sizeof(NTPPacket);
+#ifdef NTP_AUTH
+    if (key)
+    {
+        uint8_t* mac = ntp + sizeof(NTPPacket);
+        put32(mac, key->id);
+        that->_auth.mac(key, ntp, mac + NTP_AUTH_KEY_ID_LEN);
+        rsp_len += NTP_AUTH_KEY_ID_LEN + key->mac_len;
+    }
+    else if (authenticated)
+    {
+        put32(ntp + sizeof(NTPPacket), 0);
+        rsp_len = CRYPTO_NAK_LEN;
+        ++that->_auth_naks;
+    }
+#endif
+#ifdef NTS
+    // the unique identifier, new cookies and an authenticator over the lot
+    if (nts)
+        rsp_len = that->_nts.respond(ntp, max_len, &nts_req);
+#endif
+
     ++that->_rsp_count;
+    return rsp_len;
 }
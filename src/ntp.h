@@ -21,14 +21,18 @@
 
 #ifndef NTP_H_
 #define NTP_H_
-#include "net.h"
+#include "hal.h"
 #include "gps.h"
+#include "ntp_time.h"
+#include "histogram.h"
+#include "rate_limit.h"
+#include "interleave.h"
+#include "ntp_auth.h"
+#include "nts.h"
 
-typedef struct ntp_time
-{
-    uint32_t seconds;
-    uint32_t fraction;
-} NTPTime;
+// Bytes of a response that are the same for every client within a second
+// (flags through ref_time), see NTP::updateTemplate().
+#define NTP_TEMPLATE_SIZE   24
 
 class NTP
 {
@@ -40,18 +44,45 @@ public:
 
     uint32_t getReqCount() { return _req_count; }
     uint32_t getRspCount() { return _rsp_count; }
+    void     printStats();
 
 
     GPS&     _gps;
-    udp_pcb* _udp;
     uint32_t _req_count;
     uint32_t _rsp_count;
     uint8_t  _precision;
 
-    void getNTPTime(NTPTime *time);
+    uint8_t  _template[NTP_TEMPLATE_SIZE]; // network byte order
+    uint32_t _template_seq;                // GPS state sequence the template was built from
+    bool     _template_stale;
+    bool     _template_valid;
+
+    Log2Histogram _rx_delay_hist; // us from USB frame arrival to ntp_udp_recv_cb()
+#ifdef NTP_RATE_LIMIT
+    RateLimiter   _rate_limiter;
+#endif
+#ifdef NTP_INTERLEAVED
+    InterleaveCache _interleave;
+#endif
+#ifdef NTP_AUTH
+    NtpAuth       _auth;
+#endif
+    uint32_t      _auth_naks;
+#ifdef NTS
+    NtsServer     _nts;
+#endif
+
+    bool updateTemplate();
+    bool getNTPTime(NTPTime *time);
+    bool getNTPTime(uint64_t timestamp_ns, NTPTime *time);
     int8_t computePrecision();
+#ifdef NTP_BENCHMARK
+    void benchmark();
+#endif
 };
 
-void ntp_udp_recv_cb(void* arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+// hal_udp_handler for the NTP port: builds the response in place over the request
+uint16_t ntp_udp_recv_cb(void* arg, uint8_t* payload, uint16_t len, uint16_t max_len,
+                         uint64_t arrival_ns, const HalPeer* peer);
 
 #endif /* NTP_H_ */
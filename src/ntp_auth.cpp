@@ -0,0 +1,152 @@
+#include <string.h>
+#include "ntp_auth.h"
+
+NtpAuth::NtpAuth() :
+    _count(0),
+    _verified(0),
+    _failed(0)
+{
+    memset(_keys, 0x0, sizeof(_keys));
+}
+
+bool NtpAuth::addKey(uint32_t id, uint8_t type, const uint8_t* secret, size_t len)
+{
+    if (_count >= NTP_AUTH_MAX_KEYS || id == 0 || find(id))
+        return false;
+
+    NtpKey* key = &_keys[_count];
+    switch (type)
+    {
+        case NTP_KEY_AES128_CMAC:
+            if (len != AES128_KEY_LEN)
+                return false;
+            aes_cmac_init(&key->cmac, secret);
+            key->mac_len = AES_CMAC_LEN;
+            break;
+
+        case NTP_KEY_SHA1:
+        {
+            if (len == 0 || len > NTP_AUTH_MAX_SHA1_KEY)
+                return false;
+            // key || header || 0x80 || 0... || bit length, as whole blocks
+            size_t   total = len + NTP_AUTH_DATA_LEN;
+            uint64_t bits  = (uint64_t)total * 8;
+            key->sha1_blocks  = (uint8_t)((total + 1 + 8 + SHA1_BLOCK_LEN - 1) / SHA1_BLOCK_LEN);
+            key->sha1_key_len = (uint8_t)len;
+            memcpy(key->sha1, secret, len);
+            key->sha1[total] = 0x80;
+            uint8_t* end = key->sha1 + key->sha1_blocks * SHA1_BLOCK_LEN;
+            for (int i = 0; i < 8; ++i)
+                end[-1 - i] = (uint8_t)(bits >> (8 * i));
+            key->mac_len = SHA1_DIGEST_LEN;
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    key->id   = id;
+    key->type = type;
+    ++_count;
+    return true;
+}
+
+const NtpKey* __time_critical_func(NtpAuth::find)(uint32_t id) const
+{
+    for (uint8_t i = 0; i < _count; ++i)
+    {
+        if (_keys[i].id == id)
+            return &_keys[i];
+    }
+    return NULL;
+}
+
+void __time_critical_func(NtpAuth::mac)(const NtpKey* key, const uint8_t* header, uint8_t* mac) const
+{
+    if (key->type == NTP_KEY_AES128_CMAC)
+    {
+        aes_cmac(&key->cmac, header, NTP_AUTH_DATA_LEN, mac);
+        return;
+    }
+
+    uint8_t  blocks[sizeof(key->sha1)];
+    uint32_t state[5];
+    memcpy(blocks, key->sha1, key->sha1_blocks * SHA1_BLOCK_LEN);
+    memcpy(blocks + key->sha1_key_len, header, NTP_AUTH_DATA_LEN);
+    sha1_init(state);
+    for (uint8_t i = 0; i < key->sha1_blocks; ++i)
+        sha1_compress(state, blocks + i * SHA1_BLOCK_LEN);
+    sha1_digest(state, mac);
+}
+
+bool __time_critical_func(NtpAuth::verify)(const NtpKey* key, const uint8_t* header, const uint8_t* mac) const
+{
+    uint8_t expected[NTP_AUTH_MAX_MAC_LEN];
+    this->mac(key, header, expected);
+
+    uint8_t diff = 0;
+    for (uint8_t i = 0; i < key->mac_len; ++i)
+        diff |= expected[i] ^ mac[i];
+
+    if (diff)
+    {
+        ++_failed;
+        return false;
+    }
+    ++_verified;
+    return true;
+}
+
+static inline uint8_t hex_nibble(char c)
+{
+    return (uint8_t)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+}
+
+static bool hex_equal(const uint8_t* bytes, const char* hex, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (bytes[i] != ((hex_nibble(hex[2 * i]) << 4) | hex_nibble(hex[2 * i + 1])))
+            return false;
+    }
+    return true;
+}
+
+bool ntp_auth_self_test()
+{
+    static const uint8_t fips_key[AES128_KEY_LEN] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    static const uint8_t fips_plain[AES128_BLOCK_LEN] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    static const uint8_t cmac_key[AES128_KEY_LEN] = {
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+    static const uint8_t cmac_msg[40] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11 };
+
+    uint8_t out[SHA1_DIGEST_LEN];
+    bool    ok = true;
+
+    Aes128Key aes;
+    aes128_expand_key(&aes, fips_key);
+    aes128_encrypt(&aes, fips_plain, out);
+    ok &= hex_equal(out, "69c4e0d86a7b0430d8cdb78070b4c55a", AES128_BLOCK_LEN);
+
+    AesCmacKey cmac;
+    aes_cmac_init(&cmac, cmac_key);
+    aes_cmac(&cmac, cmac_msg, 0, out);
+    ok &= hex_equal(out, "bb1d6929e95937287fa37d129b756746", AES_CMAC_LEN);
+    aes_cmac(&cmac, cmac_msg, 16, out);
+    ok &= hex_equal(out, "070a16b46b4d4144f79bdd9dd04a287c", AES_CMAC_LEN);
+    aes_cmac(&cmac, cmac_msg, 40, out);
+    ok &= hex_equal(out, "dfa66747de9ae63030ca32611497c827", AES_CMAC_LEN);
+
+    sha1((const uint8_t*)"abc", 3, out);
+    ok &= hex_equal(out, "a9993e364706816aba3e25717850c26c9cd0d89d", SHA1_DIGEST_LEN);
+    sha1((const uint8_t*)"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, out);
+    ok &= hex_equal(out, "84983e441c3bd26ebaae4aa1f95129e5e54670f1", SHA1_DIGEST_LEN);
+
+    return ok;
+}
@@ -0,0 +1,73 @@
+#ifndef NTP_AUTH_H_
+#define NTP_AUTH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+#include "common.h"
+#include "aes_cmac.h"
+#include "sha1.h"
+
+/*
+ * Symmetric-key NTP authentication: a MAC of key id and digest after the
+ * 48-byte header (RFC 5905), made with AES-CMAC (RFC 8573) or the legacy
+ * SHA1 digest of key and header that ntpd and chrony still accept.
+ *
+ * Keys are prepared when they are added, so the per-packet work is only the
+ * MAC itself: for AES-CMAC the expanded key schedule and subkeys, three block
+ * encryptions per header; for SHA1 the key, the header's place and the
+ * padding laid out as complete blocks, so a header is copied in and
+ * compressed.  The table is small and fixed; nothing is allocated per packet.
+ */
+
+#define NTP_KEY_AES128_CMAC     1
+#define NTP_KEY_SHA1            2
+
+#define NTP_AUTH_DATA_LEN       48  // the header, which is all a MAC covers here
+#define NTP_AUTH_KEY_ID_LEN     4
+#define NTP_AUTH_MAX_MAC_LEN    SHA1_DIGEST_LEN
+#define NTP_AUTH_MAX_SHA1_KEY   32
+
+typedef struct ntp_key
+{
+    uint32_t id;
+    uint8_t  type;
+    uint8_t  mac_len;
+    uint8_t  sha1_key_len;
+    uint8_t  sha1_blocks;
+    union
+    {
+        AesCmacKey cmac;
+        uint8_t    sha1[2 * SHA1_BLOCK_LEN];    // key, header, padding, length
+    };
+} NtpKey;
+
+class NtpAuth
+{
+public:
+    NtpAuth();
+
+    // AES-CMAC keys are 16 bytes, SHA1 keys up to NTP_AUTH_MAX_SHA1_KEY
+    bool          addKey(uint32_t id, uint8_t type, const uint8_t* secret, size_t len);
+    const NtpKey* find(uint32_t id) const;
+    uint8_t       keys() const      { return _count; }
+
+    // MAC of an NTP_AUTH_DATA_LEN header, key->mac_len bytes
+    void mac(const NtpKey* key, const uint8_t* header, uint8_t* mac) const;
+    // Compares in constant time
+    bool verify(const NtpKey* key, const uint8_t* header, const uint8_t* mac) const;
+
+    uint32_t verified() const       { return _verified; }
+    uint32_t failed() const         { return _failed; }
+
+private:
+    NtpKey           _keys[NTP_AUTH_MAX_KEYS];
+    uint8_t          _count;
+    mutable uint32_t _verified;
+    mutable uint32_t _failed;
+};
+
+// Known-answer checks of AES-128, AES-CMAC and SHA1 (FIPS 197, RFC 4493, FIPS 180)
+bool ntp_auth_self_test();
+
+#endif /* NTP_AUTH_H_ */
@@ -0,0 +1,24 @@
+# Protocol, timekeeping and NMEA sources shared by the firmware and the host
+# build.  They only reach hardware through hal.h; each build supplies its own
+# HAL implementation (src/hal_pico.cpp + src/net.cpp, or host/hal_host.cpp).
+set(NTP_CORE_SOURCES
+    ${CMAKE_CURRENT_LIST_DIR}/aes128.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/aes_cmac.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/aes_siv.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/clock_servo.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/gps.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/gps_trace.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/interleave.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/ntp.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/ntp_auth.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/nts.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/nts_ke.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/event_log.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/latency.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/nmea_framer.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/nmea_time.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/pps_capture.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/rate_limit.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/sha1.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/ubx.cpp
+)
@@ -0,0 +1,31 @@
+#ifndef NTP_KEYS_H_
+#define NTP_KEYS_H_
+
+#include "ntp_auth.h"
+
+/*
+ * Symmetric keys for NTP_AUTH, added by NTP::begin().  The same id, type and
+ * key go in each client's keys file, e.g. for chrony
+ *
+ *     1 AES128 HEX:000102030405060708090A0B0C0D0E0F
+ *
+ * and "server <address> key 1" in its configuration.  AES-CMAC keys are 16
+ * bytes; SHA1 keys up to NTP_AUTH_MAX_SHA1_KEY.  Keep real keys out of any
+ * public copy of this file.
+ */
+
+typedef struct ntp_key_config
+{
+    uint32_t id;        // 1..2^32-1, 0 ends the table
+    uint8_t  type;      // NTP_KEY_AES128_CMAC or NTP_KEY_SHA1
+    uint8_t  len;
+    uint8_t  key[NTP_AUTH_MAX_SHA1_KEY];
+} NtpKeyConfig;
+
+static const NtpKeyConfig ntp_keys[] = {
+    // { 1, NTP_KEY_AES128_CMAC, 16, { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    //                                 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f } },
+    { 0, 0, 0, { 0 } }
+};
+
+#endif /* NTP_KEYS_H_ */
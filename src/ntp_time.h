@@ -0,0 +1,62 @@
+#ifndef NTP_TIME_H_
+#define NTP_TIME_H_
+
+#include <stdint.h>
+
+/*
+ * NTP 32.32 fixed-point timestamp: whole seconds since 1900 plus a binary
+ * fraction of a second.  All conversions here are integer only, the RP2040
+ * has no FPU.
+ */
+typedef struct ntp_time
+{
+    uint32_t seconds;
+    uint32_t fraction;
+} NTPTime;
+
+// Leap indicator
+#define LI_NONE         0
+#define LI_SIXTY_ONE    1
+#define LI_FIFTY_NINE   2
+#define LI_NOSYNC       3
+
+#define STRATUM_UNSYNC  16
+
+#define SEVENTY_YEARS   2208988800L
+#define toEPOCH(t)      ((uint32_t)t-SEVENTY_YEARS)
+#define toNTP(t)        ((uint32_t)t+SEVENTY_YEARS)
+
+// round(2^51 / 10^6): us * 2^32 / 10^6 == (us * NTP_FRAC_PER_US_Q19) >> 19.
+// Fits in 32 bits, so this is a single 32x32->64 multiply, error < 1 LSB for us < 10^6.
+#define NTP_FRAC_PER_US_Q19     2251799814UL
+
+// Microseconds (0..999999) to an NTP fraction.
+static inline uint32_t us_to_ntp_fraction(uint32_t us)
+{
+    return (uint32_t)(((uint64_t)us * NTP_FRAC_PER_US_Q19) >> 19);
+}
+
+// round(2^62 / 10^9): ns * 2^32 / 10^9 == (ns * NTP_FRAC_PER_NS_Q30) >> 30.
+// 33 bits, so ns < 10^9 keeps the product within 63 bits; error < 1 LSB.
+#define NTP_FRAC_PER_NS_Q30     4611686018ULL
+
+// Nanoseconds (0..999999999) to an NTP fraction.
+static inline uint32_t ns_to_ntp_fraction(uint32_t ns)
+{
+    return (uint32_t)(((uint64_t)ns * NTP_FRAC_PER_NS_Q30) >> 30);
+}
+
+// NTP fraction to microseconds (rounded, round-trips us_to_ntp_fraction()).
+static inline uint32_t ntp_fraction_to_us(uint32_t fraction)
+{
+    return (uint32_t)(((uint64_t)fraction * 1000000UL + 0x80000000UL) >> 32);
+}
+
+// Microseconds to NTP short format (16.16 seconds), rounded up as dispersion should be.
+static inline uint32_t us_to_ntp_short(uint64_t us)
+{
+    uint64_t value = (us * 65536 + 999999) / 1000000;
+    return value > 0xffffffffULL ? 0xffffffffUL : (uint32_t)value;
+}
+
+#endif /* NTP_TIME_H_ */
@@ -0,0 +1,389 @@
+#include <string.h>
+#include "nts.h"
+
+#define NTP_HEADER_LEN      48
+// type, length, nonce length and ciphertext length
+#define AUTH_HEADER_LEN     (NTS_EF_HEADER_LEN + 4)
+#define COOKIE_FIELD_LEN    (NTS_EF_HEADER_LEN + NTS_COOKIE_LEN)
+
+static_assert((NTS_MASTER_KEYS & (NTS_MASTER_KEYS - 1)) == 0, "NTS_MASTER_KEYS must be a power of two");
+static_assert(NTS_COOKIE_LEN % 4 == 0, "cookie fields must need no padding");
+
+// Requests are only 2-byte aligned, as in ntp.cpp
+static inline void put16(uint8_t* dst, uint16_t value)
+{
+    dst[0] = (uint8_t)(value >> 8);
+    dst[1] = (uint8_t)value;
+}
+
+static inline uint16_t get16(const uint8_t* src)
+{
+    return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+static inline void put32(uint8_t* dst, uint32_t value)
+{
+    put16(dst, (uint16_t)(value >> 16));
+    put16(dst + 2, (uint16_t)value);
+}
+
+static inline uint32_t get32(const uint8_t* src)
+{
+    return ((uint32_t)get16(src) << 16) | get16(src + 2);
+}
+
+static inline uint16_t padded(uint16_t len)
+{
+    return (uint16_t)((len + 3) & ~3);
+}
+
+NtsServer::NtsServer() :
+    _current(0),
+    _rotated_us(0),
+    _nonce_count(0),
+    _requests(0),
+    _naks(0),
+    _drops(0),
+    _cookies(0)
+{
+    memset(_ring, 0x0, sizeof(_ring));
+    memset(&_nonce_key, 0x0, sizeof(_nonce_key));
+    // until begin(), every slot holds an id that names another slot, so no cookie opens
+    for (uint32_t i = 0; i < NTS_MASTER_KEYS; ++i)
+        _ring[i].id = i + 1;
+}
+
+void NtsServer::begin(uint64_t now_us)
+{
+    uint8_t secret[AES128_KEY_LEN];
+    hal_random(secret, sizeof(secret));
+    aes128_expand_key(&_nonce_key, secret);
+    memset(secret, 0x0, sizeof(secret));
+
+    // a random starting id, so cookies from before a restart name slots nobody holds
+    hal_random((uint8_t*)&_current, sizeof(_current));
+    for (int i = 0; i < NTS_MASTER_KEYS; ++i)
+        rotate();
+    _rotated_us = now_us;
+}
+
+void NtsServer::service(uint64_t now_us)
+{
+    if (now_us - _rotated_us < (uint64_t)NTS_KEY_ROTATION_S * 1000000)
+        return;
+    rotate();
+    _rotated_us = now_us;
+}
+
+void NtsServer::rotate()
+{
+    uint8_t       secret[NTS_KEY_LEN];
+    NtsMasterKey* slot = &_ring[++_current & (NTS_MASTER_KEYS - 1)];
+    hal_random(secret, sizeof(secret));
+    aes_siv_init(&slot->key, secret);
+    slot->id = _current;
+    memset(secret, 0x0, sizeof(secret));
+}
+
+// A counter encrypted under a key of our own: never repeats, and says nothing
+// about how many cookies were made or for whom
+void __time_critical_func(NtsServer::nonce)(uint8_t* out)
+{
+    uint8_t count[AES128_BLOCK_LEN] = { 0 };
+    put32(count + 8, (uint32_t)(_nonce_count >> 32));
+    put32(count + 12, (uint32_t)_nonce_count);
+    ++_nonce_count;
+    aes128_encrypt(&_nonce_key, count, out);
+}
+
+// key id || nonce || AES-SIV(master key, nonce, c2s || s2c)
+void __time_critical_func(NtsServer::makeCookie)(const uint8_t* c2s, const uint8_t* s2c, uint8_t* cookie)
+{
+    const NtsMasterKey* master = &_ring[_current & (NTS_MASTER_KEYS - 1)];
+    uint8_t*            nonce = cookie + 4;
+    uint8_t*            keys  = nonce + NTS_NONCE_LEN + AES_SIV_TAG_LEN;
+    put32(cookie, master->id);
+    this->nonce(nonce);
+    memcpy(keys, c2s, NTS_KEY_LEN);
+    memcpy(keys + NTS_KEY_LEN, s2c, NTS_KEY_LEN);
+    aes_siv_encrypt(&master->key, NULL, 0, nonce, NTS_NONCE_LEN, keys, 2 * NTS_KEY_LEN, nonce + NTS_NONCE_LEN);
+    ++_cookies;
+}
+
+bool __time_critical_func(NtsServer::openCookie)(const uint8_t* cookie, uint8_t* c2s, uint8_t* s2c)
+{
+    uint32_t            id = get32(cookie);
+    const NtsMasterKey* master = &_ring[id & (NTS_MASTER_KEYS - 1)];
+    const uint8_t*      nonce = cookie + 4;
+    uint8_t             keys[2 * NTS_KEY_LEN];
+    if (master->id != id)
+        return false;   // rotated out
+    bool ok = aes_siv_decrypt(&master->key, NULL, 0, nonce, NTS_NONCE_LEN, nonce + NTS_NONCE_LEN,
+                              sizeof(keys), keys);
+    if (ok)
+    {
+        memcpy(c2s, keys, NTS_KEY_LEN);
+        memcpy(s2c, keys + NTS_KEY_LEN, NTS_KEY_LEN);
+    }
+    memset(keys, 0x0, sizeof(keys));
+    return ok;
+}
+
+int __time_critical_func(NtsServer::parse)(uint8_t* packet, uint16_t len, NtsRequest* req)
+{
+    const uint8_t* cookie = NULL;
+    uint16_t       cookie_len = 0;
+    uint16_t       auth = 0;
+    uint8_t        placeholders = 0;
+
+    ++_requests;
+    req->uid_len = 0;
+
+    // RFC 7822 fields: type, length of the whole field (a multiple of 4), body
+    uint16_t offset = NTP_HEADER_LEN;
+    for (int fields = 0; offset < len; ++fields)
+    {
+        if (fields == NTS_MAX_FIELDS || auth || len - offset < NTS_EF_HEADER_LEN)
+            goto drop;  // too many, something after the authenticator, or a fragment
+        uint16_t type = get16(packet + offset);
+        uint16_t field_len = get16(packet + offset + 2);
+        if (field_len < NTS_EF_HEADER_LEN || (field_len & 3) || field_len > len - offset)
+            goto drop;
+
+        switch (type)
+        {
+            case NTS_EF_UNIQUE_ID:
+                if (req->uid_len || field_len - NTS_EF_HEADER_LEN < NTS_UNIQUE_ID_MIN_LEN)
+                    goto drop;
+                req->uid_offset = offset;
+                req->uid_len    = field_len;
+                break;
+
+            case NTS_EF_COOKIE:
+                if (cookie)
+                    goto drop;
+                cookie     = packet + offset + NTS_EF_HEADER_LEN;
+                cookie_len = field_len - NTS_EF_HEADER_LEN;
+                break;
+
+            case NTS_EF_COOKIE_PLACEHOLDER:
+                // only a placeholder the size of a cookie leaves room for one
+                if (field_len == COOKIE_FIELD_LEN && placeholders < NTS_MAX_COOKIES - 1)
+                    ++placeholders;
+                break;
+
+            case NTS_EF_AUTHENTICATOR:
+                auth = offset;
+                break;
+
+            default:
+                break;  // not ours to understand
+        }
+        offset += field_len;
+    }
+    if (!req->uid_len || !cookie || !auth)
+        goto drop;
+
+    {
+        // a cookie we can't open, made before a restart or rotated out, gets a NAK
+        uint8_t c2s[NTS_KEY_LEN];
+        if (cookie_len != NTS_COOKIE_LEN || !openCookie(cookie, c2s, req->s2c))
+            goto nak;
+        memcpy(req->c2s, c2s, sizeof(c2s));
+        memset(c2s, 0x0, sizeof(c2s));
+
+        // nonce length, ciphertext length, then each padded to 4 bytes
+        uint8_t* field = packet + auth;
+        uint16_t field_len = get16(field + 2);
+        if (field_len < AUTH_HEADER_LEN)
+            goto drop;
+        uint16_t nonce_len = get16(field + 4);
+        uint16_t ct_len = get16(field + 6);
+        if (nonce_len < NTS_NONCE_LEN || ct_len < AES_SIV_TAG_LEN ||
+            (uint32_t)padded(nonce_len) + padded(ct_len) > (uint32_t)field_len - AUTH_HEADER_LEN)
+            goto drop;
+
+        // everything before the authenticator is its associated data; any
+        // encrypted fields are decrypted in place and otherwise left alone
+        AesSivKey key;
+        uint8_t*  nonce = field + AUTH_HEADER_LEN;
+        uint8_t*  ct = nonce + padded(nonce_len);
+        aes_siv_init(&key, req->c2s);
+        bool ok = aes_siv_decrypt(&key, packet, auth, nonce, nonce_len, ct, ct_len - AES_SIV_TAG_LEN,
+                                  ct + AES_SIV_TAG_LEN);
+        memset(&key, 0x0, sizeof(key));
+        if (!ok)
+            goto nak;
+    }
+
+    req->cookies = (uint8_t)(1 + placeholders);
+    return NTS_OK;
+
+nak:
+    ++_naks;
+    return NTS_NAK;
+
+drop:
+    ++_drops;
+    return NTS_DROP;
+}
+
+uint16_t __time_critical_func(NtsServer::respond)(uint8_t* packet, uint16_t max_len, const NtsRequest* req)
+{
+    // the unique identifier first, it is associated data for the authenticator
+    memmove(packet + NTP_HEADER_LEN, packet + req->uid_offset, req->uid_len);
+    uint16_t ad_len = (uint16_t)(NTP_HEADER_LEN + req->uid_len);
+
+    // as many new cookies as were asked for and fit, which for a request
+    // padded as RFC 8915 has it is all of them
+    uint16_t fixed = (uint16_t)(ad_len + AUTH_HEADER_LEN + NTS_NONCE_LEN + AES_SIV_TAG_LEN);
+    if (fixed > max_len)
+        return 0;
+    uint8_t cookies = req->cookies;
+    while (cookies && fixed + cookies * COOKIE_FIELD_LEN > max_len)
+        --cookies;
+
+    uint8_t* field = packet + ad_len;
+    uint8_t* nonce = field + AUTH_HEADER_LEN;
+    uint8_t* ct = nonce + NTS_NONCE_LEN;
+    uint8_t* plain = ct + AES_SIV_TAG_LEN;
+    uint16_t plain_len = (uint16_t)(cookies * COOKIE_FIELD_LEN);
+    for (uint8_t i = 0; i < cookies; ++i)
+    {
+        uint8_t* cookie = plain + i * COOKIE_FIELD_LEN;
+        put16(cookie, NTS_EF_COOKIE);
+        put16(cookie + 2, COOKIE_FIELD_LEN);
+        makeCookie(req->c2s, req->s2c, cookie + NTS_EF_HEADER_LEN);
+    }
+
+    put16(field, NTS_EF_AUTHENTICATOR);
+    put16(field + 2, (uint16_t)(AUTH_HEADER_LEN + NTS_NONCE_LEN + AES_SIV_TAG_LEN + plain_len));
+    put16(field + 4, NTS_NONCE_LEN);
+    put16(field + 6, (uint16_t)(AES_SIV_TAG_LEN + plain_len));
+    this->nonce(nonce);
+
+    AesSivKey key;
+    aes_siv_init(&key, req->s2c);
+    aes_siv_encrypt(&key, packet, ad_len, nonce, NTS_NONCE_LEN, plain, plain_len, ct);
+    memset(&key, 0x0, sizeof(key));
+    return (uint16_t)(fixed + plain_len);
+}
+
+uint16_t __time_critical_func(NtsServer::nak)(uint8_t* packet, const NtsRequest* req)
+{
+    memmove(packet + NTP_HEADER_LEN, packet + req->uid_offset, req->uid_len);
+    return (uint16_t)(NTP_HEADER_LEN + req->uid_len);
+}
+
+uint16_t nts_client_request(uint8_t* packet, uint16_t header_len, const uint8_t* uid, const uint8_t* cookie,
+                            uint8_t placeholders, const uint8_t* c2s)
+{
+    uint8_t* field = packet + header_len;
+    put16(field, NTS_EF_UNIQUE_ID);
+    put16(field + 2, NTS_EF_HEADER_LEN + NTS_UNIQUE_ID_MIN_LEN);
+    memcpy(field + NTS_EF_HEADER_LEN, uid, NTS_UNIQUE_ID_MIN_LEN);
+    field += NTS_EF_HEADER_LEN + NTS_UNIQUE_ID_MIN_LEN;
+
+    put16(field, NTS_EF_COOKIE);
+    put16(field + 2, COOKIE_FIELD_LEN);
+    memcpy(field + NTS_EF_HEADER_LEN, cookie, NTS_COOKIE_LEN);
+    field += COOKIE_FIELD_LEN;
+
+    for (uint8_t i = 0; i < placeholders; ++i)
+    {
+        put16(field, NTS_EF_COOKIE_PLACEHOLDER);
+        put16(field + 2, COOKIE_FIELD_LEN);
+        memset(field + NTS_EF_HEADER_LEN, 0x0, NTS_COOKIE_LEN);
+        field += COOKIE_FIELD_LEN;
+    }
+
+    // an authenticator over all of it, with nothing encrypted
+    uint16_t ad_len = (uint16_t)(field - packet);
+    put16(field, NTS_EF_AUTHENTICATOR);
+    put16(field + 2, AUTH_HEADER_LEN + NTS_NONCE_LEN + AES_SIV_TAG_LEN);
+    put16(field + 4, NTS_NONCE_LEN);
+    put16(field + 6, AES_SIV_TAG_LEN);
+    hal_random(field + AUTH_HEADER_LEN, NTS_NONCE_LEN);
+
+    AesSivKey key;
+    aes_siv_init(&key, c2s);
+    aes_siv_encrypt(&key, packet, ad_len, field + AUTH_HEADER_LEN, NTS_NONCE_LEN, NULL, 0,
+                    field + AUTH_HEADER_LEN + NTS_NONCE_LEN);
+    return (uint16_t)(ad_len + AUTH_HEADER_LEN + NTS_NONCE_LEN + AES_SIV_TAG_LEN);
+}
+
+int nts_client_response(const uint8_t* packet, uint16_t len, const uint8_t* uid, const uint8_t* s2c,
+                        uint8_t* cookies, uint8_t max_cookies)
+{
+    // the unique identifier and then the authenticator, as respond() lays them out
+    const uint8_t* field = packet + NTP_HEADER_LEN;
+    uint16_t       uid_len = NTS_EF_HEADER_LEN + NTS_UNIQUE_ID_MIN_LEN;
+    if (len < NTP_HEADER_LEN + uid_len + AUTH_HEADER_LEN || get16(field) != NTS_EF_UNIQUE_ID ||
+        get16(field + 2) != uid_len || memcmp(field + NTS_EF_HEADER_LEN, uid, NTS_UNIQUE_ID_MIN_LEN) != 0)
+        return -1;
+
+    const uint8_t* auth = field + uid_len;
+    uint16_t       ad_len = (uint16_t)(auth - packet);
+    uint16_t       nonce_len = get16(auth + 4);
+    uint16_t       ct_len = get16(auth + 6);
+    if (get16(auth) != NTS_EF_AUTHENTICATOR || get16(auth + 2) != len - ad_len || ct_len < AES_SIV_TAG_LEN ||
+        AUTH_HEADER_LEN + padded(nonce_len) + padded(ct_len) > len - ad_len)
+        return -1;
+
+    uint8_t   plain[NTS_MAX_COOKIES * COOKIE_FIELD_LEN];
+    uint16_t  plain_len = (uint16_t)(ct_len - AES_SIV_TAG_LEN);
+    AesSivKey key;
+    if (plain_len > sizeof(plain))
+        return -1;
+    aes_siv_init(&key, s2c);
+    if (!aes_siv_decrypt(&key, packet, ad_len, auth + AUTH_HEADER_LEN, nonce_len,
+                         auth + AUTH_HEADER_LEN + padded(nonce_len), plain_len, plain))
+        return -1;
+
+    int count = 0;
+    for (uint16_t offset = 0; offset + COOKIE_FIELD_LEN <= plain_len; offset += COOKIE_FIELD_LEN)
+    {
+        if (get16(plain + offset) != NTS_EF_COOKIE || get16(plain + offset + 2) != COOKIE_FIELD_LEN)
+            return -1;
+        if (count < max_cookies)
+            memcpy(cookies + count * NTS_COOKIE_LEN, plain + offset + NTS_EF_HEADER_LEN, NTS_COOKIE_LEN);
+        ++count;
+    }
+    return count;
+}
+
+static inline uint8_t hex_nibble(char c)
+{
+    return (uint8_t)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+}
+
+static void from_hex(const char* hex, uint8_t* bytes, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+        bytes[i] = (uint8_t)((hex_nibble(hex[2 * i]) << 4) | hex_nibble(hex[2 * i + 1]));
+}
+
+bool nts_self_test()
+{
+    uint8_t secret[AES_SIV_KEY_LEN];
+    uint8_t ad[24];
+    uint8_t plain[14];
+    uint8_t expected[AES_SIV_TAG_LEN + sizeof(plain)];
+    uint8_t out[sizeof(expected)];
+    bool    ok = true;
+
+    from_hex("fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff", secret, sizeof(secret));
+    from_hex("101112131415161718191a1b1c1d1e1f2021222324252627", ad, sizeof(ad));
+    from_hex("112233445566778899aabbccddee", plain, sizeof(plain));
+    from_hex("85632d07c6e8f37f950acd320a2ecc9340c02b9690c4dc04daef7f6afe5c", expected, sizeof(expected));
+
+    AesSivKey key;
+    aes_siv_init(&key, secret);
+    aes_siv_encrypt(&key, ad, sizeof(ad), NULL, 0, plain, sizeof(plain), out);
+    ok &= memcmp(out, expected, sizeof(out)) == 0;
+    ok &= aes_siv_decrypt(&key, ad, sizeof(ad), NULL, 0, out, sizeof(plain), out + AES_SIV_TAG_LEN);
+    ok &= memcmp(out + AES_SIV_TAG_LEN, plain, sizeof(plain)) == 0;
+    out[0] ^= 1;
+    ok &= !aes_siv_decrypt(&key, ad, sizeof(ad), NULL, 0, out, sizeof(plain), out + AES_SIV_TAG_LEN);
+    return ok;
+}
@@ -0,0 +1,119 @@
+#ifndef NTS_H_
+#define NTS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+#include "common.h"
+#include "aes_siv.h"
+
+/*
+ * Network Time Security for NTPv4 (RFC 8915), the NTP side: cookies and the
+ * extension fields of NTS requests and responses.  NTS-KE (nts_ke.h) hands
+ * clients their first cookies; each request then carries one, which holds the
+ * client's two AES-SIV keys sealed under a master key only the server knows,
+ * so the server keeps no state per client.
+ *
+ * Master keys live in a ring of NTS_MASTER_KEYS slots.  A cookie names its
+ * master key by id and the id picks the slot, so finding the key is an index,
+ * and rotation overwrites the oldest: cookies stay good for NTS_MASTER_KEYS - 1
+ * rotations.  Each slot holds the key already expanded (both AES schedules,
+ * the CMAC subkeys and S2V's start), as does the nonce generator.
+ *
+ * A request's work is bounded: at most NTS_MAX_FIELDS extension fields are
+ * looked at, one cookie is opened, and a response carries at most
+ * NTS_MAX_COOKIES new ones.  Nothing is allocated.
+ */
+
+#define NTS_AEAD_AES_SIV_CMAC_256   15
+#define NTS_KEY_LEN                 AES_SIV_KEY_LEN
+#define NTS_NONCE_LEN               16
+// key id, nonce, tag and the sealed c2s and s2c keys
+#define NTS_COOKIE_LEN              (4 + NTS_NONCE_LEN + AES_SIV_TAG_LEN + 2 * NTS_KEY_LEN)
+
+// Extension field types
+#define NTS_EF_UNIQUE_ID            0x0104
+#define NTS_EF_COOKIE               0x0204
+#define NTS_EF_COOKIE_PLACEHOLDER   0x0304
+#define NTS_EF_AUTHENTICATOR        0x0404
+#define NTS_EF_HEADER_LEN           4
+#define NTS_UNIQUE_ID_MIN_LEN       32
+
+// Extension fields a request may have before it is dropped unread
+#define NTS_MAX_FIELDS              (NTS_MAX_COOKIES + 4)
+
+#define NTS_OK      0   // authenticated, answer with respond()
+#define NTS_NAK     1   // a cookie or authenticator that fails, answer with nak()
+#define NTS_DROP    2   // not worth an answer
+
+typedef struct nts_request
+{
+    uint16_t uid_offset;    // the unique identifier field, header included
+    uint16_t uid_len;
+    uint8_t  cookies;       // to send back: one for the one used, one per placeholder
+    uint8_t  c2s[NTS_KEY_LEN];
+    uint8_t  s2c[NTS_KEY_LEN];
+} NtsRequest;
+
+typedef struct nts_master_key
+{
+    uint32_t  id;
+    AesSivKey key;
+} NtsMasterKey;
+
+class NtsServer
+{
+public:
+    NtsServer();
+
+    // Fills the ring with fresh keys and the nonce generator with a fresh key
+    void begin(uint64_t now_us);
+    // Rotates the master key once NTS_KEY_ROTATION_S has passed
+    void service(uint64_t now_us);
+    void rotate();
+
+    // A cookie (NTS_COOKIE_LEN bytes) for the current master key, and back
+    void makeCookie(const uint8_t* c2s, const uint8_t* s2c, uint8_t* cookie);
+    bool openCookie(const uint8_t* cookie, uint8_t* c2s, uint8_t* s2c);
+
+    // Checks the extension fields after the header of an NTS request and,
+    // if it authenticates, decrypts its encrypted fields in place
+    int      parse(uint8_t* packet, uint16_t len, NtsRequest* req);
+    // Appends the unique identifier and an authenticator with new cookies to
+    // the header already built over the request; returns the response length
+    uint16_t respond(uint8_t* packet, uint16_t max_len, const NtsRequest* req);
+    // Appends the unique identifier to a KoD NTSN header; returns the response length
+    uint16_t nak(uint8_t* packet, const NtsRequest* req);
+
+    uint32_t keyId() const      { return _current; }
+    uint32_t requests() const   { return _requests; }
+    uint32_t naks() const       { return _naks; }
+    uint32_t drops() const      { return _drops; }
+    uint32_t cookies() const    { return _cookies; }
+
+private:
+    void nonce(uint8_t* out);
+
+    NtsMasterKey _ring[NTS_MASTER_KEYS];
+    uint32_t     _current;
+    uint64_t     _rotated_us;
+    Aes128Key    _nonce_key;    // nonces are a counter encrypted under it
+    uint64_t     _nonce_count;
+    uint32_t     _requests;
+    uint32_t     _naks;
+    uint32_t     _drops;
+    uint32_t     _cookies;
+};
+
+// The client's half of NTS, for benchmarks: a request with a cookie and
+// placeholders for more, and the check of the response it gets
+uint16_t nts_client_request(uint8_t* packet, uint16_t header_len, const uint8_t* uid, const uint8_t* cookie,
+                            uint8_t placeholders, const uint8_t* c2s);
+// Returns the cookies it carries (copied to cookies, NTS_COOKIE_LEN each), or -1
+int      nts_client_response(const uint8_t* packet, uint16_t len, const uint8_t* uid, const uint8_t* s2c,
+                             uint8_t* cookies, uint8_t max_cookies);
+
+// Known-answer check of AES-SIV (RFC 5297 A.1)
+bool nts_self_test();
+
+#endif /* NTS_H_ */
@@ -0,0 +1,155 @@
+#include <string.h>
+#include "nts_ke.h"
+
+static inline void put16(uint8_t* dst, uint16_t value)
+{
+    dst[0] = (uint8_t)(value >> 8);
+    dst[1] = (uint8_t)value;
+}
+
+static inline uint16_t get16(const uint8_t* src)
+{
+    return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+// Whether a list of 16-bit ids has this one
+static bool has_id(const uint8_t* body, uint16_t len, uint16_t id)
+{
+    for (uint16_t i = 0; i + 2 <= len; i += 2)
+    {
+        if (get16(body + i) == id)
+            return true;
+    }
+    return false;
+}
+
+int nts_ke_parse(const uint8_t* request, size_t len, NtsKeRequest* req)
+{
+    memset(req, 0x0, sizeof(*req));
+    req->error = -1;
+
+    size_t offset = 0;
+    while (len - offset >= NTS_KE_RECORD_HEADER_LEN)
+    {
+        uint16_t       type = get16(request + offset);
+        uint16_t       body_len = get16(request + offset + 2);
+        const uint8_t* body = request + offset + NTS_KE_RECORD_HEADER_LEN;
+        if (body_len > len - offset - NTS_KE_RECORD_HEADER_LEN)
+            break;  // the rest hasn't arrived
+        offset += NTS_KE_RECORD_HEADER_LEN + body_len;
+
+        switch (type & ~NTS_KE_CRITICAL)
+        {
+            case NTS_KE_END:
+                // both negotiations are required
+                if (!req->next_protocol || (req->ntpv4 && !req->aead) || body_len)
+                    req->error = NTS_KE_ERROR_BAD_REQUEST;
+                return NTS_KE_COMPLETE;
+
+            case NTS_KE_NEXT_PROTOCOL:
+                if (req->next_protocol || (body_len & 1))
+                    goto bad;
+                req->next_protocol = true;
+                req->ntpv4 = has_id(body, body_len, NTS_KE_PROTOCOL_NTPV4);
+                break;
+
+            case NTS_KE_AEAD:
+                if (req->aead || (body_len & 1))
+                    goto bad;
+                req->aead = true;
+                req->aes_siv = has_id(body, body_len, NTS_AEAD_AES_SIV_CMAC_256);
+                break;
+
+            case NTS_KE_ERROR:
+            case NTS_KE_WARNING:
+                goto bad;   // only a server sends these
+
+            case NTS_KE_NEW_COOKIE:
+            case NTS_KE_SERVER:
+            case NTS_KE_PORT_NEGOTIATION:
+                break;      // NTP is only served here, on its own port
+
+            default:
+                if (type & NTS_KE_CRITICAL)
+                {
+                    req->error = NTS_KE_ERROR_UNRECOGNIZED;
+                    return NTS_KE_COMPLETE;
+                }
+                break;
+        }
+    }
+
+    if (len < NTS_KE_MAX_REQUEST)
+        return NTS_KE_INCOMPLETE;
+bad:
+    req->error = NTS_KE_ERROR_BAD_REQUEST;
+    return NTS_KE_COMPLETE;
+}
+
+void nts_ke_context(uint8_t direction, uint8_t* context)
+{
+    put16(context, NTS_KE_PROTOCOL_NTPV4);
+    put16(context + 2, NTS_AEAD_AES_SIV_CMAC_256);
+    context[4] = direction;
+}
+
+static uint8_t* put_record(uint8_t* dst, uint16_t type, uint16_t len)
+{
+    put16(dst, type);
+    put16(dst + 2, len);
+    return dst + NTS_KE_RECORD_HEADER_LEN;
+}
+
+size_t nts_ke_respond(NtsServer* server, const NtsKeRequest* req, nts_ke_exporter exporter, void* tls,
+                      uint8_t* response)
+{
+    uint8_t* p = response;
+    uint8_t  c2s[NTS_KEY_LEN];
+    uint8_t  s2c[NTS_KEY_LEN];
+    uint8_t  context[NTS_KE_CONTEXT_LEN];
+    int16_t  error = req->error;
+
+    // a protocol or AEAD we don't do is answered with an empty list, and no cookies
+    if (error < 0 && req->ntpv4 && req->aes_siv)
+    {
+        nts_ke_context(NTS_KE_C2S, context);
+        bool ok = exporter(tls, NTS_KE_EXPORTER_LABEL, context, sizeof(context), c2s, sizeof(c2s));
+        nts_ke_context(NTS_KE_S2C, context);
+        ok = ok && exporter(tls, NTS_KE_EXPORTER_LABEL, context, sizeof(context), s2c, sizeof(s2c));
+        if (!ok)
+            error = NTS_KE_ERROR_INTERNAL;
+    }
+
+    if (error >= 0)
+    {
+        p = put_record(p, NTS_KE_CRITICAL | NTS_KE_ERROR, 2);
+        put16(p, (uint16_t)error);
+        p += 2;
+    }
+    else
+    {
+        p = put_record(p, NTS_KE_CRITICAL | NTS_KE_NEXT_PROTOCOL, req->ntpv4 ? 2 : 0);
+        if (req->ntpv4)
+        {
+            put16(p, NTS_KE_PROTOCOL_NTPV4);
+            p += 2;
+            p = put_record(p, NTS_KE_CRITICAL | NTS_KE_AEAD, req->aes_siv ? 2 : 0);
+        }
+        if (req->ntpv4 && req->aes_siv)
+        {
+            put16(p, NTS_AEAD_AES_SIV_CMAC_256);
+            p += 2;
+            for (int i = 0; i < NTS_MAX_COOKIES; ++i)
+            {
+                p = put_record(p, NTS_KE_NEW_COOKIE, NTS_COOKIE_LEN);
+                server->makeCookie(c2s, s2c, p);
+                p += NTS_COOKIE_LEN;
+            }
+        }
+    }
+    p = put_record(p, NTS_KE_CRITICAL | NTS_KE_END, 0);
+
+    memset(c2s, 0x0, sizeof(c2s));
+    memset(s2c, 0x0, sizeof(s2c));
+    return (size_t)(p - response);
+}
@@ -0,0 +1,73 @@
+#ifndef NTS_KE_H_
+#define NTS_KE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "nts.h"
+
+/*
+ * NTS Key Establishment (RFC 8915 section 4), the records exchanged over TLS:
+ * a request is parsed as far as it has arrived, and once complete gets a
+ * response with NTS_MAX_COOKIES cookies for NTPv4 and AEAD_AES_SIV_CMAC_256,
+ * or an error record.  The TLS itself (nts_ke_server.cpp on the firmware)
+ * is kept out of it, so the host build can run the exchange; the keys come
+ * from an exporter callback.
+ */
+
+#define NTS_KE_PORT                 4460
+#define NTS_KE_ALPN                 "ntske/1"
+#define NTS_KE_EXPORTER_LABEL       "EXPORTER-network-time-security"
+
+// Record types; the top bit of the type marks a record critical
+#define NTS_KE_END                  0
+#define NTS_KE_NEXT_PROTOCOL        1
+#define NTS_KE_ERROR                2
+#define NTS_KE_WARNING              3
+#define NTS_KE_AEAD                 4
+#define NTS_KE_NEW_COOKIE           5
+#define NTS_KE_SERVER               6
+#define NTS_KE_PORT_NEGOTIATION     7
+#define NTS_KE_CRITICAL             0x8000
+#define NTS_KE_RECORD_HEADER_LEN    4
+
+#define NTS_KE_ERROR_UNRECOGNIZED   0
+#define NTS_KE_ERROR_BAD_REQUEST    1
+#define NTS_KE_ERROR_INTERNAL       2
+
+#define NTS_KE_PROTOCOL_NTPV4       0
+
+// A request that hasn't ended by this many bytes is a bad one
+#define NTS_KE_MAX_REQUEST          512
+// next protocol, AEAD, the cookies and end
+#define NTS_KE_MAX_RESPONSE         (4 * NTS_KE_RECORD_HEADER_LEN + 2 * 2 + \
+                                     NTS_MAX_COOKIES * (NTS_KE_RECORD_HEADER_LEN + NTS_COOKIE_LEN))
+
+// Exporter context: protocol id, AEAD id, direction
+#define NTS_KE_CONTEXT_LEN          5
+#define NTS_KE_C2S                  0
+#define NTS_KE_S2C                  1
+
+#define NTS_KE_INCOMPLETE           0
+#define NTS_KE_COMPLETE             1
+
+typedef struct nts_ke_request
+{
+    bool    next_protocol;  // had a next protocol record
+    bool    ntpv4;          // ... offering NTPv4
+    bool    aead;           // had an AEAD record
+    bool    aes_siv;        // ... offering AEAD_AES_SIV_CMAC_256
+    int16_t error;          // NTS_KE_ERROR_*, or -1
+} NtsKeRequest;
+
+// TLS keying material exporter (RFC 5705/8446) of the session the request came in on
+typedef bool (*nts_ke_exporter)(void* tls, const char* label, const uint8_t* context, size_t context_len,
+                                uint8_t* out, size_t len);
+
+int    nts_ke_parse(const uint8_t* request, size_t len, NtsKeRequest* req);
+// The response to a complete request, at most NTS_KE_MAX_RESPONSE bytes
+size_t nts_ke_respond(NtsServer* server, const NtsKeRequest* req, nts_ke_exporter exporter, void* tls,
+                      uint8_t* response);
+// The exporter context of the c2s or s2c key
+void   nts_ke_context(uint8_t direction, uint8_t* context);
+
+#endif /* NTS_KE_H_ */
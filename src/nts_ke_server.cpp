@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include "nts_ke_server.h"
+#include "nts_ke.h"
+#include "nts_ke_cert.h"
+#include "lwip/altcp.h"
+#include "lwip/altcp_tls.h"
+#include "mbedtls/ssl.h"
+
+// an NTS-KE session: the request as far as it has arrived
+typedef struct nts_ke_conn
+{
+  struct altcp_pcb *pcb;
+  uint8_t          request[NTS_KE_MAX_REQUEST];
+  uint16_t         len;
+  uint16_t         unsent;  // response bytes not yet acknowledged
+  uint8_t          idle;    // polls without progress
+  bool             done;    // responded
+} NtsKeConn;
+
+static NtsServer       *nts_server;
+static NtsKeConn       conns[NTS_KE_MAX_CONNECTIONS];
+static uint8_t         response[NTS_KE_MAX_RESPONSE];
+static uint32_t        ke_sessions = 0;
+static uint32_t        ke_errors = 0;
+static uint32_t        ke_refused = 0;
+
+// mbedtls' RFC 8446 exporter for the session the request came in on
+static bool nts_ke_export(void *tls, const char *label, const uint8_t *context, size_t context_len,
+                          uint8_t *out, size_t len)
+{
+  mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)tls;
+  return mbedtls_ssl_export_keying_material(ssl, out, len, label, strlen(label), context, context_len, 1) == 0;
+}
+
+// returns ERR_ABRT if the pcb had to be aborted, for a callback to pass on
+static err_t nts_ke_close(NtsKeConn *conn)
+{
+  struct altcp_pcb *pcb = conn->pcb;
+  conn->pcb = NULL;
+  if (!pcb)
+    return ERR_OK;
+  altcp_arg(pcb, NULL);
+  altcp_recv(pcb, NULL);
+  altcp_sent(pcb, NULL);
+  altcp_err(pcb, NULL);
+  altcp_poll(pcb, NULL, 0);
+  if (altcp_close(pcb) == ERR_OK)
+    return ERR_OK;
+  altcp_abort(pcb);
+  return ERR_ABRT;
+}
+
+static err_t nts_ke_respond_to(NtsKeConn *conn, const NtsKeRequest *req)
+{
+  size_t len = nts_ke_respond(nts_server, req, &nts_ke_export, altcp_tls_context(conn->pcb), response);
+  if (req->error >= 0)
+    ++ke_errors;
+
+  // the response fits TCP_SND_BUF in one go; copied, so response[] is free again
+  conn->done = true;
+  err_t err = altcp_write(conn->pcb, response, (u16_t)len, TCP_WRITE_FLAG_COPY);
+  memset(response, 0x0, len);
+  if (err != ERR_OK)
+    return nts_ke_close(conn);
+  conn->unsent = (uint16_t)len;
+  altcp_output(conn->pcb);
+  return ERR_OK;
+}
+
+static err_t nts_ke_recv_cb(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+  NtsKeConn *conn = (NtsKeConn *)arg;
+  if (!p)
+  {
+    // the client closed its side
+    return nts_ke_close(conn);
+  }
+
+  // anything after the request is ignored, as is anything past NTS_KE_MAX_REQUEST
+  if (!conn->done)
+  {
+    uint16_t room = (uint16_t)(sizeof(conn->request) - conn->len);
+    conn->len += pbuf_copy_partial(p, conn->request + conn->len, p->tot_len < room ? p->tot_len : room, 0);
+  }
+  altcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  conn->idle = 0;
+
+  NtsKeRequest req;
+  if (!conn->done && nts_ke_parse(conn->request, conn->len, &req) == NTS_KE_COMPLETE)
+    return nts_ke_respond_to(conn, &req);
+  return ERR_OK;
+}
+
+static err_t nts_ke_sent_cb(void *arg, struct altcp_pcb *pcb, u16_t len)
+{
+  NtsKeConn *conn = (NtsKeConn *)arg;
+  conn->unsent = len < conn->unsent ? conn->unsent - len : 0;
+  conn->idle = 0;
+  // one exchange per connection, RFC 8915 4: the server closes it
+  if (conn->done && !conn->unsent)
+    return nts_ke_close(conn);
+  return ERR_OK;
+}
+
+static err_t nts_ke_poll_cb(void *arg, struct altcp_pcb *pcb)
+{
+  NtsKeConn *conn = (NtsKeConn *)arg;
+  if (++conn->idle >= NTS_KE_TIMEOUT_POLLS)
+    return nts_ke_close(conn);
+  return ERR_OK;
+}
+
+static void nts_ke_err_cb(void *arg, err_t err)
+{
+  // the pcb is already gone
+  NtsKeConn *conn = (NtsKeConn *)arg;
+  if (conn)
+    conn->pcb = NULL;
+}
+
+static err_t nts_ke_accept_cb(void *arg, struct altcp_pcb *pcb, err_t err)
+{
+  if (err != ERR_OK || !pcb)
+    return ERR_VAL;
+
+  // a fixed number of sessions: each holds a TLS context of several KB
+  NtsKeConn *conn = NULL;
+  for (int i = 0; i < NTS_KE_MAX_CONNECTIONS && !conn; i++)
+  {
+    if (!conns[i].pcb)
+      conn = &conns[i];
+  }
+  if (!conn)
+  {
+    ++ke_refused;
+    altcp_abort(pcb);
+    return ERR_ABRT;
+  }
+
+  memset(conn, 0x0, sizeof(*conn));
+  conn->pcb = pcb;
+  ++ke_sessions;
+  altcp_arg(pcb, conn);
+  altcp_recv(pcb, &nts_ke_recv_cb);
+  altcp_sent(pcb, &nts_ke_sent_cb);
+  altcp_err(pcb, &nts_ke_err_cb);
+  altcp_poll(pcb, &nts_ke_poll_cb, 2); // every second
+  return ERR_OK;
+}
+
+bool nts_ke_begin(NtsServer *server)
+{
+  static const char *alpn[] = { NTS_KE_ALPN, NULL };
+
+  if (sizeof(nts_ke_cert_pem) <= 1 || sizeof(nts_ke_key_pem) <= 1)
+  {
+    printf("[ERROR] nts_ke_begin() no certificate in nts_ke_cert.h, NTS-KE disabled\n");
+    return false;
+  }
+
+  // mbedtls wants PEM lengths that count the terminating NUL
+  struct altcp_tls_config *config = altcp_tls_create_config_server_privkey_cert(
+    (const u8_t *)nts_ke_key_pem, sizeof(nts_ke_key_pem), NULL, 0,
+    (const u8_t *)nts_ke_cert_pem, sizeof(nts_ke_cert_pem));
+  if (!config || altcp_tls_configure_alpn_protocols(config, alpn) != ERR_OK)
+  {
+    printf("[ERROR] nts_ke_begin() bad certificate or key, NTS-KE disabled\n");
+    return false;
+  }
+
+  struct altcp_pcb *pcb = altcp_tls_new(config, IPADDR_TYPE_V4);
+  if (!pcb || altcp_bind(pcb, IP_ANY_TYPE, NTS_KE_PORT) != ERR_OK)
+    return false;
+  struct altcp_pcb *listen = altcp_listen_with_backlog(pcb, NTS_KE_MAX_CONNECTIONS);
+  if (!listen)
+  {
+    altcp_close(pcb);
+    return false;
+  }
+
+  nts_server = server;
+  altcp_accept(listen, &nts_ke_accept_cb);
+  printf("[INFO] nts_ke_begin() complete, NTS-KE bound to %d\n", NTS_KE_PORT);
+  return true;
+}
+
+void nts_ke_print_stats(void)
+{
+  printf("[INFO] NTS-KE sessions:%lu errors:%lu refused:%lu\n",
+    (unsigned long)ke_sessions, (unsigned long)ke_errors, (unsigned long)ke_refused);
+}
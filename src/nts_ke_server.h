@@ -0,0 +1,12 @@
+#ifndef SRC_NTS_KE_SERVER_H_
+#define SRC_NTS_KE_SERVER_H_
+
+#include "nts.h"
+
+// NTS-KE over TLS 1.3 on NTS_KE_PORT (lwIP altcp_tls on mbedtls): each
+// connection sends one request, gets its cookies from server and is closed.
+// Built with the NTS_KE option; needs a certificate in nts_ke_cert.h.
+bool nts_ke_begin(NtsServer *server);
+void nts_ke_print_stats(void);
+
+#endif
@@ -0,0 +1,96 @@
+#include "pps_capture.h"
+
+#define NS_PER_SEC  1000000000ULL
+
+PpsCapture::PpsCapture() :
+    _start_ns(0),
+    _counts_per_sec(1),
+    _latency_ns(0),
+    _last_edge_ns(0),
+    _captures(0),
+    _glitches(0),
+    _glitch_run(0)
+{
+}
+
+void PpsCapture::start(uint64_t start_ns, uint32_t counts_per_sec)
+{
+    _start_ns       = start_ns;
+    _counts_per_sec = counts_per_sec;
+    // the counter runs at half the core clock
+    _latency_ns     = (uint32_t)(PPS_CAPTURE_LATENCY_CYCLES * NS_PER_SEC / (2ULL * counts_per_sec));
+    _last_edge_ns   = 0;
+    _captures       = 0;
+    _glitches       = 0;
+    _glitch_run     = 0;
+}
+
+// Counts since start at ns after start, split so nothing overflows 64 bits
+uint64_t __time_critical_func(PpsCapture::countsAt)(uint64_t ns) const
+{
+    return (ns / NS_PER_SEC) * _counts_per_sec + (ns % NS_PER_SEC) * _counts_per_sec / NS_PER_SEC;
+}
+
+// Nanoseconds since start at this many core cycles, half counts
+uint64_t __time_critical_func(PpsCapture::nsAtCycles)(uint64_t cycles) const
+{
+    uint64_t cycles_per_sec = 2ULL * _counts_per_sec;
+    return (cycles / cycles_per_sec) * NS_PER_SEC + (cycles % cycles_per_sec) * NS_PER_SEC / cycles_per_sec;
+}
+
+int __time_critical_func(PpsCapture::convert)(uint32_t capture, uint64_t now_ns, uint64_t* edge_ns)
+{
+    // counts from start to the edge, modulo 2^32; every earlier capture held
+    // the counter for one cycle, half a count, so an odd number of them
+    // leaves a cycle over
+    uint32_t edge_counts_low = (uint32_t)(PPS_CAPTURE_X0 - capture) + (_captures >> 1);
+    uint32_t odd_cycle       = _captures & 1;
+    ++_captures;
+
+    // the edge is less than half a wrap from now; it can look slightly in
+    // the future when it was read within the timer's microsecond
+    uint64_t now_counts  = countsAt(now_ns - _start_ns);
+    int32_t  edge_age    = (int32_t)((uint32_t)now_counts - edge_counts_low);
+    uint64_t edge_counts = now_counts - edge_age;
+
+    *edge_ns = _start_ns + nsAtCycles(2 * edge_counts + odd_cycle) - _latency_ns;
+
+    if (_last_edge_ns == 0)
+    {
+        _last_edge_ns = *edge_ns;
+        return PPS_CAPTURE_FIRST;
+    }
+
+    uint64_t interval  = *edge_ns - _last_edge_ns;
+    uint64_t seconds   = (interval + NS_PER_SEC / 2) / NS_PER_SEC;
+    uint64_t whole     = seconds * NS_PER_SEC;
+    uint64_t off       = interval > whole ? interval - whole : whole - interval;
+    uint64_t tolerance = PPS_CAPTURE_TOLERANCE_NS + seconds * PPS_CAPTURE_TOLERANCE_PPM * 1000;
+
+    if (interval < PPS_CAPTURE_MIN_INTERVAL_NS || off > tolerance)
+    {
+        ++_glitches;
+        if (++_glitch_run < PPS_CAPTURE_RESYNC)
+            return PPS_CAPTURE_GLITCH;
+        // the edge everything was checked against was probably the glitch
+        _glitch_run   = 0;
+        _last_edge_ns = *edge_ns;
+        return PPS_CAPTURE_FIRST;
+    }
+
+    _glitch_run   = 0;
+    _last_edge_ns = *edge_ns;
+    return PPS_CAPTURE_OK;
+}
+
+uint32_t PpsCapture::simulate(uint64_t edge_ns, uint32_t captures_before) const
+{
+    // Cycles from start to the in that latches X.  Every cycle of the
+    // program but one per capture (its in) is half of a two-cycle decrement
+    // loop, so X has been decremented once per two of the others.
+    uint64_t ns             = edge_ns + _latency_ns - _start_ns;
+    uint64_t cycles_per_sec = 2ULL * _counts_per_sec;
+    uint64_t cycles         = (ns / NS_PER_SEC) * cycles_per_sec + (ns % NS_PER_SEC) * cycles_per_sec / NS_PER_SEC;
+    uint64_t decrements = (cycles - captures_before) / 2;
+    return (uint32_t)(PPS_CAPTURE_X0 - decrements);
+}
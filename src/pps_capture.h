@@ -0,0 +1,65 @@
+#ifndef PPS_CAPTURE_H_
+#define PPS_CAPTURE_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * Converts raw PPS captures from the PIO counter (pps_capture.pio) to the
+ * hal_time_us_64() timebase, in nanoseconds, and validates them.
+ *
+ * The state machine's counter starts at PPS_CAPTURE_X0 when it is enabled
+ * and counts down at sys_clk / 2, which is derived from the same crystal as
+ * the microsecond timer, so one (timer, counter) pair taken at start is
+ * enough to place every later capture.  Each capture holds the counter for
+ * one cycle, half a count, added back here.  The 32-bit counter wraps every
+ * ~34 s at 250 MHz; captures are unwrapped against the time they were read, so they must be
+ * read within half a wrap of the edge.
+ *
+ * No hardware access: the firmware feeds it from the PIO FIFO in the PIO
+ * interrupt on core1, the host build from synthetic values.
+ */
+
+#define PPS_CAPTURE_X0                  0xffffffffUL
+#define PPS_CAPTURE_LATENCY_CYCLES      3       // input synchronizer + half a poll loop, on average
+#define PPS_CAPTURE_MIN_INTERVAL_NS     500000000ULL
+#define PPS_CAPTURE_TOLERANCE_NS        1000000ULL // allowed distance from a whole number of seconds,
+#define PPS_CAPTURE_TOLERANCE_PPM       500        // plus this much per second elapsed
+#define PPS_CAPTURE_RESYNC              3       // glitches in a row before the reference edge itself is suspect
+
+#define PPS_CAPTURE_OK          0
+#define PPS_CAPTURE_FIRST       1   // no previous edge to check it against
+#define PPS_CAPTURE_GLITCH      2   // not a whole number of seconds after the previous edge
+
+class PpsCapture
+{
+public:
+    PpsCapture();
+
+    // The counter was set to PPS_CAPTURE_X0 and started at start_ns, counting counts_per_sec.
+    void     start(uint64_t start_ns, uint32_t counts_per_sec);
+
+    // One FIFO value, read at now_ns.  Fills in the edge time and returns
+    // PPS_CAPTURE_*; only OK and FIRST edges should be used as PPS.
+    int      convert(uint32_t capture, uint64_t now_ns, uint64_t* edge_ns);
+
+    uint32_t captures() const   { return _captures; }
+    uint32_t glitches() const   { return _glitches; }
+
+    // What the state machine would push for an edge at edge_ns, for the host build
+    uint32_t simulate(uint64_t edge_ns, uint32_t captures_before) const;
+
+private:
+    uint64_t _start_ns;
+    uint32_t _counts_per_sec;
+    uint32_t _latency_ns;
+    uint64_t _last_edge_ns;
+    uint32_t _captures;
+    uint32_t _glitches;
+    uint32_t _glitch_run;
+
+    uint64_t countsAt(uint64_t ns) const;
+    uint64_t nsAtCycles(uint64_t cycles) const;
+};
+
+#endif /* PPS_CAPTURE_H_ */
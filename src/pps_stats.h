@@ -0,0 +1,93 @@
+#ifndef PPS_STATS_H_
+#define PPS_STATS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Sliding-window statistics over the servo's per-edge phase errors.
+ *
+ * add() is called once per PPS edge from the ISR: it replaces the oldest
+ * sample, keeps running sums for the RMS jitter and rescans the window for
+ * the largest error (WINDOW compares, once a second).  The results are kept
+ * in nanoseconds; GPS turns them into NTP short format as it publishes, so
+ * nothing is computed per request.
+ */
+class PpsStats
+{
+public:
+    static const int WINDOW = 64; // edges, about a minute
+
+    PpsStats()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        memset(_samples, 0x0, sizeof(_samples));
+        _count  = 0;
+        _next   = 0;
+        _sum_sq = 0;
+        _jitter_ns  = 0;
+        _max_abs_ns = 0;
+    }
+
+    void add(int32_t phase_error_ns)
+    {
+        int64_t old = _samples[_next];
+        _samples[_next] = phase_error_ns;
+        _next = (_next + 1) % WINDOW;
+        if (_count < WINDOW)
+            ++_count;
+        else
+            _sum_sq -= (uint64_t)(old * old);
+        _sum_sq += (uint64_t)((int64_t)phase_error_ns * phase_error_ns);
+
+        uint32_t max_abs = 0;
+        for (int i = 0; i < _count; ++i)
+        {
+            uint32_t value = _samples[i] < 0 ? -(uint32_t)_samples[i] : (uint32_t)_samples[i];
+            if (value > max_abs)
+                max_abs = value;
+        }
+        _max_abs_ns = max_abs;
+        _jitter_ns  = isqrt(_sum_sq / _count);
+    }
+
+    uint32_t count() const     { return _count; }
+    uint32_t jitterNs() const  { return _jitter_ns; }   // RMS phase error over the window
+    uint32_t maxAbsNs() const  { return _max_abs_ns; }  // largest phase error over the window
+
+private:
+    int32_t           _samples[WINDOW];
+    int               _count;
+    int               _next;
+    uint64_t          _sum_sq;
+    volatile uint32_t _jitter_ns;
+    volatile uint32_t _max_abs_ns;
+
+    static uint32_t isqrt(uint64_t value)
+    {
+        uint64_t result = 0;
+        uint64_t bit = 1ULL << 62;
+        while (bit > value)
+            bit >>= 2;
+        while (bit)
+        {
+            if (value >= result + bit)
+            {
+                value -= result + bit;
+                result = (result >> 1) + bit;
+            }
+            else
+            {
+                result >>= 1;
+            }
+            bit >>= 2;
+        }
+        return (uint32_t)result;
+    }
+};
+
+#endif /* PPS_STATS_H_ */
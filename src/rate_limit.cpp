@@ -0,0 +1,89 @@
+#include <string.h>
+#include "rate_limit.h"
+
+#define INTERVAL_TICKS      ((uint32_t)((NTP_RATE_INTERVAL_MS * 1000000ULL) >> RATE_LIMIT_TICK_SHIFT))
+#define TOKEN               INTERVAL_TICKS
+#define TOKENS_FULL         (NTP_RATE_BURST * TOKEN)
+
+static_assert(INTERVAL_TICKS > 0, "NTP_RATE_INTERVAL_MS shorter than a tick");
+
+RateLimiter::RateLimiter() :
+    _clients(0),
+    _evictions(0),
+    _kods(0),
+    _drops(0)
+{
+    memset(_table, 0x0, sizeof(_table));
+}
+
+// Fibonacci hashing: the top bits of the product mix every bit of the address
+static inline uint32_t slot_of(uint32_t addr)
+{
+    return (addr * 2654435761u) >> (32 - NTP_RATE_TABLE_BITS);
+}
+
+int __time_critical_func(RateLimiter::check)(uint32_t addr, uint64_t now_ns)
+{
+    uint32_t now = (uint32_t)(now_ns >> RATE_LIMIT_TICK_SHIFT);
+    Entry*   entry  = NULL;
+    Entry*   oldest = NULL;
+    uint32_t home   = slot_of(addr);
+
+    for (uint32_t i = 0; i < NTP_RATE_PROBES; ++i)
+    {
+        Entry* slot = &_table[(home + i) & (RATE_LIMIT_SLOTS - 1)];
+        if (slot->addr == addr)
+        {
+            entry = slot;
+            break;
+        }
+        if (slot->addr == 0)
+        {
+            ++_clients;
+            oldest = slot;
+            break;
+        }
+        if (!oldest || now - slot->last_tick > now - oldest->last_tick)
+            oldest = slot;
+    }
+
+    if (!entry)
+    {
+        if (oldest->addr != 0)
+            ++_evictions;
+        // a new client starts with a full bucket, less this request
+        oldest->addr      = addr;
+        oldest->last_tick = now;
+        oldest->tokens    = TOKENS_FULL - TOKEN;
+        oldest->kod_sent  = 0;
+        return RATE_LIMIT_ALLOW;
+    }
+
+    // refill for the time since the last request, every tick of it
+    uint32_t elapsed = now - entry->last_tick;
+    uint32_t tokens  = entry->tokens;
+    if (elapsed >= TOKENS_FULL)
+        tokens = TOKENS_FULL;
+    else
+        tokens += elapsed;
+    if (tokens > TOKENS_FULL)
+        tokens = TOKENS_FULL;
+    entry->last_tick = now;
+
+    if (tokens >= TOKEN)
+    {
+        entry->tokens   = tokens - TOKEN;
+        entry->kod_sent = 0;
+        return RATE_LIMIT_ALLOW;
+    }
+
+    entry->tokens = tokens;
+    if (!entry->kod_sent)
+    {
+        entry->kod_sent = 1;
+        ++_kods;
+        return RATE_LIMIT_KOD;
+    }
+    ++_drops;
+    return RATE_LIMIT_DROP;
+}
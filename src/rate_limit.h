@@ -0,0 +1,68 @@
+#ifndef RATE_LIMIT_H_
+#define RATE_LIMIT_H_
+
+#include <stdint.h>
+#include "hal.h"
+#include "common.h"
+
+/*
+ * Per-client request rate limiting for the NTP responder.
+ *
+ * Each source address has a token bucket of NTP_RATE_BURST requests,
+ * refilled at one per NTP_RATE_INTERVAL_MS.  A request that finds the bucket
+ * empty gets one Kiss-o'-Death RATE response; after that the client's
+ * requests are dropped until it has earned a whole token again, so a client
+ * that ignores the KoD costs no more responses than one polling at the limit.
+ *
+ * Clients live in a fixed, open-addressed table of 2^NTP_RATE_TABLE_BITS
+ * slots.  An address is only ever looked for in the NTP_RATE_PROBES slots
+ * from its hash; when those are all taken by other clients the least
+ * recently seen of them is replaced, so the cost of a lookup is bounded and
+ * the table never needs rehashing.  Slots are overwritten, never emptied,
+ * so an empty slot ends a search.
+ *
+ * The bucket holds its credit in ticks, a request costing a whole interval
+ * of them, so the time between two requests is added in full however close
+ * together they come: no fraction of a token is rounded away, and a client
+ * polling above the limit is held to it rather than starved.
+ */
+
+#define RATE_LIMIT_ALLOW    0
+#define RATE_LIMIT_KOD      1   // answer with a KoD RATE
+#define RATE_LIMIT_DROP     2   // send nothing
+
+#define RATE_LIMIT_SLOTS    (1u << NTP_RATE_TABLE_BITS)
+// Time in 2^20 ns (~1.05 ms) ticks: a shift instead of a 64-bit division per request
+#define RATE_LIMIT_TICK_SHIFT   20
+
+class RateLimiter
+{
+public:
+    RateLimiter();
+
+    // addr is the IPv4 source in network byte order, now_ns when the request arrived
+    int      check(uint32_t addr, uint64_t now_ns);
+
+    uint32_t clients() const    { return _clients; }    // slots in use
+    uint32_t evictions() const  { return _evictions; }
+    uint32_t kods() const       { return _kods; }
+    uint32_t drops() const      { return _drops; }
+
+private:
+    typedef struct entry
+    {
+        uint32_t addr;          // 0: never used
+        uint32_t last_tick;     // last request, and when tokens were last refilled
+        uint32_t tokens;        // credit in ticks, a request costs an interval's worth
+        uint8_t  kod_sent;      // since the bucket last ran dry
+        uint8_t  reserved[3];
+    } Entry;
+
+    Entry    _table[RATE_LIMIT_SLOTS];
+    uint32_t _clients;
+    uint32_t _evictions;
+    uint32_t _kods;
+    uint32_t _drops;
+};
+
+#endif /* RATE_LIMIT_H_ */
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "sha1.h"
+
+static inline uint32_t rol(uint32_t x, unsigned n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+void sha1_init(uint32_t* state)
+{
+    state[0] = 0x67452301;
+    state[1] = 0xefcdab89;
+    state[2] = 0x98badcfe;
+    state[3] = 0x10325476;
+    state[4] = 0xc3d2e1f0;
+}
+
+// The message schedule is kept as a 16-word window rather than all 80 words
+#define SHA1_W(i)   ((i) < 16 ? w[i] : (w[(i) & 15] = rol(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ \
+                                                       w[((i) + 2) & 15] ^ w[(i) & 15], 1)))
+#define SHA1_ROUND(f, k, i)                                         \
+    do {                                                            \
+        uint32_t temp = rol(a, 5) + (f) + e + (k) + SHA1_W(i);      \
+        e = d;                                                      \
+        d = c;                                                      \
+        c = rol(b, 30);                                             \
+        b = a;                                                      \
+        a = temp;                                                   \
+    } while (0)
+
+void __time_critical_func(sha1_compress)(uint32_t* state, const uint8_t* block)
+{
+    uint32_t w[16];
+    for (int i = 0; i < 16; ++i)
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+
+    // one loop per round function, so no round decides which it is
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    int i = 0;
+    for (; i < 20; ++i)
+        SHA1_ROUND(d ^ (b & (c ^ d)), 0x5a827999, i);
+    for (; i < 40; ++i)
+        SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1, i);
+    for (; i < 60; ++i)
+        SHA1_ROUND((b & c) | (d & (b | c)), 0x8f1bbcdc, i);
+    for (; i < 80; ++i)
+        SHA1_ROUND(b ^ c ^ d, 0xca62c1d6, i);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void sha1_digest(const uint32_t* state, uint8_t* digest)
+{
+    for (int i = 0; i < 5; ++i)
+    {
+        digest[4 * i]     = (uint8_t)(state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)state[i];
+    }
+}
+
+void sha1(const uint8_t* msg, size_t len, uint8_t* digest)
+{
+    uint32_t state[5];
+    uint8_t  block[SHA1_BLOCK_LEN];
+    uint64_t bits = (uint64_t)len * 8;
+
+    sha1_init(state);
+    while (len >= SHA1_BLOCK_LEN)
+    {
+        sha1_compress(state, msg);
+        msg += SHA1_BLOCK_LEN;
+        len -= SHA1_BLOCK_LEN;
+    }
+
+    memset(block, 0x0, sizeof(block));
+    memcpy(block, msg, len);
+    block[len] = 0x80;
+    if (len >= SHA1_BLOCK_LEN - 8)
+    {
+        sha1_compress(state, block);
+        memset(block, 0x0, sizeof(block));
+    }
+    for (int i = 0; i < 8; ++i)
+        block[SHA1_BLOCK_LEN - 1 - i] = (uint8_t)(bits >> (8 * i));
+    sha1_compress(state, block);
+    sha1_digest(state, digest);
+}
@@ -0,0 +1,25 @@
+#ifndef SHA1_H_
+#define SHA1_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+/*
+ * SHA-1, for the legacy MAC of NTP symmetric keys (the digest of key and
+ * packet, as ntpd and chrony compute it).  The block function is exposed so
+ * a caller that knows its message length ahead of time can pad once and
+ * only run the compressions per message.
+ */
+
+#define SHA1_BLOCK_LEN      64
+#define SHA1_DIGEST_LEN     20
+
+void sha1_init(uint32_t* state);
+void sha1_compress(uint32_t* state, const uint8_t* block);
+// state as the big-endian digest
+void sha1_digest(const uint32_t* state, uint8_t* digest);
+// One-shot, for when the length isn't known ahead
+void sha1(const uint8_t* msg, size_t len, uint8_t* digest);
+
+#endif /* SHA1_H_ */
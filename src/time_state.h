@@ -0,0 +1,77 @@
+#ifndef TIME_STATE_H_
+#define TIME_STATE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Time state shared between core1 (PPS ISR and GPS::process()) and core0
+ * (NTP::getNTPTime()).  Everything a reader needs to turn a local timestamp
+ * into UTC lives in this one record so it can be published as a unit.
+ *
+ * Fields are ordered largest first so any padding is at the end.
+ */
+typedef struct time_state
+{
+    uint64_t pps_timestamp_ns;      // hal_time_ns_64() of the latest PPS edge, as estimated by the servo
+    uint64_t pps_timestamp_ns_prev; // the same for the PPS edge before it
+    uint64_t nmea_timestamp_us;     // hal_time_us_64() when the latest label (valid RMC or TIM-TP) came in
+    int64_t  pps_seconds;           // UTC (unix) second that started at pps_timestamp_ns
+    uint32_t pps_ntp_seconds;       // the same second on the NTP timescale, kept in step with pps_seconds
+    uint32_t valid;                 // non-zero once NMEA has labelled the PPS edges
+    int32_t  freq_corr_q32;         // local time since pps_timestamp_ns * (1 + this / 2^32) == true time
+    uint32_t root_dispersion;       // NTP short format, ready to serve
+    uint8_t  stratum;               // to serve
+    uint8_t  leap;                  // LI_* to serve
+    uint8_t  sync_state;            // GPS_SYNC_*
+} TimeState;
+
+/*
+ * Single writer, multiple reader seqlock over two TimeState slots.
+ *
+ * The writer always fills the slot readers are *not* pointed at and then
+ * bumps the sequence, so a reader never waits on the writer; it only copies
+ * again if a publish completed while it was copying (at most a couple of
+ * times per second).
+ *
+ * Writes must come from one core only; callers on that core that can be
+ * preempted by another writer (e.g. the PPS ISR) must mask interrupts
+ * around their update + publish.
+ */
+class TimeStateSeqlock
+{
+public:
+    TimeStateSeqlock() : _seq(0)
+    {
+        memset(_slots, 0x0, sizeof(_slots));
+    }
+
+    void publish(const TimeState* state)
+    {
+        uint32_t seq = _seq;
+        memcpy(&_slots[(seq + 1) & 1], state, sizeof(TimeState));
+        __sync_synchronize(); // slot contents visible before the new sequence
+        _seq = seq + 1;
+    }
+
+    // Copies a consistent snapshot into state, returns its sequence number.
+    uint32_t read(TimeState* state) const
+    {
+        uint32_t seq;
+        do {
+            seq = _seq;
+            __sync_synchronize();
+            memcpy(state, &_slots[seq & 1], sizeof(TimeState));
+            __sync_synchronize(); // copy complete before re-checking the sequence
+        } while (seq != _seq);
+        return seq;
+    }
+
+    uint32_t sequence() const { return _seq; }
+
+private:
+    volatile uint32_t _seq;
+    TimeState         _slots[2];
+};
+
+#endif /* TIME_STATE_H_ */
@@ -0,0 +1,123 @@
+#ifndef UBX_H_
+#define UBX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+/*
+ * u-blox UBX binary protocol: an incremental frame parser that runs next to
+ * the NMEA framer on the same byte stream, decoders for the two timing
+ * messages the GPS code uses, and a frame builder for configuration.
+ *
+ * A frame is 0xb5 0x62, class, id, little endian payload length, payload and
+ * an 8-bit Fletcher checksum over class to the end of the payload.  Payloads
+ * longer than UBX_MAX_PAYLOAD (messages we don't decode) are checked and
+ * skipped without being buffered.
+ *
+ * TIM-TP is sent ahead of each time pulse and gives the time of that pulse
+ * and its quantization error (qErr): the receiver can only start the pulse
+ * on an edge of its own clock, so it comes out up to half a clock period
+ * off, and says by how much.  NAV-TIMEUTC gives UTC and its validity, and
+ * with it the GPS-UTC offset needed when the pulse is aligned to GPS time.
+ */
+
+#define UBX_SYNC_1              0xb5
+#define UBX_SYNC_2              0x62
+#define UBX_MAX_PAYLOAD         32
+#define UBX_MAX_LENGTH          1024    // longer than any message, the length field was corrupt
+#define UBX_FRAME_OVERHEAD      8       // sync, class, id, length and checksum
+
+#define UBX_CLASS_NAV           0x01
+#define UBX_CLASS_ACK           0x05
+#define UBX_CLASS_CFG           0x06
+#define UBX_CLASS_TIM           0x0d
+
+#define UBX_NAV_TIMEUTC         0x21
+#define UBX_CFG_MSG             0x01
+#define UBX_TIM_TP              0x01
+
+#define UBX_NAV_TIMEUTC_LEN     20
+#define UBX_TIM_TP_LEN          16
+
+#define UBX_TIMEUTC_VALID_TOW   0x01    // NAV-TIMEUTC valid: time of week is known
+#define UBX_TIMEUTC_VALID_WKN   0x02    // NAV-TIMEUTC valid: week number is known
+#define UBX_TIMEUTC_VALID_UTC   0x04    // NAV-TIMEUTC valid: UTC is known (leap seconds included)
+#define UBX_TIMEUTC_VALID_ALL   (UBX_TIMEUTC_VALID_TOW | UBX_TIMEUTC_VALID_WKN | UBX_TIMEUTC_VALID_UTC)
+#define UBX_TP_TIMEBASE_UTC     0x01    // TIM-TP flags: tow/week are UTC, not GPS time
+#define UBX_TP_UTC_AVAILABLE    0x02    // TIM-TP flags: UTC parameters are known
+#define UBX_TP_QERR_INVALID     0x10    // TIM-TP flags: qErr is not to be used
+
+#define UBX_GPS_EPOCH           315964800LL // 1980-01-06 in Unix seconds
+#define UBX_SECONDS_PER_WEEK    604800
+
+typedef struct ubx_tim_tp
+{
+    uint32_t tow_ms;        // time of week of the next pulse
+    uint32_t tow_sub_ms;    // and the fraction of a ms, 2^-32 ms
+    int32_t  qerr_ps;       // pulse time minus the time it should have had
+    uint16_t week;
+    uint8_t  flags;         // UBX_TP_*
+} UbxTimTp;
+
+typedef struct ubx_nav_timeutc
+{
+    uint32_t itow_ms;       // GPS time of week of the navigation epoch
+    uint32_t tacc_ns;
+    int32_t  nano;          // UTC below the second, -1e9..1e9
+    uint16_t year;
+    uint8_t  month;
+    uint8_t  day;
+    uint8_t  hour;
+    uint8_t  min;
+    uint8_t  sec;
+    uint8_t  valid;         // UBX_TIMEUTC_*
+} UbxNavTimeUtc;
+
+class UbxParser
+{
+public:
+    UbxParser();
+
+    // Feed one received byte.  Returns the payload of the frame it completed
+    // (valid until the next push()), or NULL.
+    const uint8_t* push(uint8_t c);
+    bool           inFrame() const      { return _state != IDLE; }  // the last byte belonged to a UBX frame
+    uint8_t        msgClass() const     { return _class; }
+    uint8_t        msgId() const        { return _id; }
+    uint16_t       length() const       { return _len; }
+
+    uint32_t       frames() const          { return _frames; }
+    uint32_t       checksumErrors() const  { return _checksum_errors; }
+
+private:
+    enum State { IDLE, SYNC, CLASS, ID, LENGTH_LOW, LENGTH_HIGH, PAYLOAD, CHECKSUM_A, CHECKSUM_B };
+
+    uint8_t           _payload[UBX_MAX_PAYLOAD];
+    State             _state;
+    uint8_t           _class;
+    uint8_t           _id;
+    uint16_t          _len;
+    uint16_t          _pos;
+    uint8_t           _ck_a;
+    uint8_t           _ck_b;
+    volatile uint32_t _frames;
+    volatile uint32_t _checksum_errors;
+
+    void checksum(uint8_t c) { _ck_a += c; _ck_b += _ck_a; }
+};
+
+bool ubx_decode_tim_tp(const uint8_t* payload, uint16_t len, UbxTimTp* tp);
+bool ubx_decode_nav_timeutc(const uint8_t* payload, uint16_t len, UbxNavTimeUtc* utc);
+
+// GPS-UTC offset (leap seconds) from a NAV-TIMEUTC with valid UTC
+int32_t ubx_leap_seconds(const UbxNavTimeUtc* utc);
+
+// Unix seconds of the pulse a TIM-TP announces, leap_seconds is only used
+// when the pulse is aligned to GPS time
+int64_t ubx_tim_tp_seconds(const UbxTimTp* tp, int32_t leap_seconds);
+
+// Builds a frame into buf, returns its size or 0 if it doesn't fit
+size_t ubx_frame(uint8_t* buf, size_t size, uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len);
+
+#endif /* UBX_H_ */